@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Boots a PlatformIO ESP32 build under Espressif's QEMU fork and reports the
+# Unity result. Used as test_testing_command by [env:esp32-qemu].
+#   QEMU_XTENSA   qemu-system-xtensa binary (default: from PATH)
+#   QEMU_TIMEOUT  seconds to wait for the Unity summary (default: 300)
+
+BUILD_DIR="${1:?usage: run-qemu.sh <build dir>}"
+QEMU="${QEMU_XTENSA:-qemu-system-xtensa}"
+TIMEOUT="${QEMU_TIMEOUT:-300}"
+FRAMEWORK_DIR="$HOME/.platformio/packages/framework-arduinoespressif32"
+FLASH="$BUILD_DIR/qemu_flash.bin"
+LOG="$BUILD_DIR/qemu_serial.log"
+
+if ! command -v "$QEMU" &>/dev/null; then
+    echo "$QEMU not found. Install Espressif QEMU (idf_tools.py install qemu-xtensa) or set QEMU_XTENSA."
+    exit 1
+fi
+
+ESPTOOL="$HOME/.platformio/packages/tool-esptoolpy/esptool.py"
+if [ -f "$ESPTOOL" ]; then
+    ESPTOOL_CMD=(python3 "$ESPTOOL")
+else
+    ESPTOOL_CMD=(python3 -m esptool)
+fi
+
+# QEMU boots from a full flash image, not the separate app binaries
+"${ESPTOOL_CMD[@]}" --chip esp32 merge_bin --fill-flash-size 4MB -o "$FLASH" \
+    0x1000 "$BUILD_DIR/bootloader.bin" \
+    0x8000 "$BUILD_DIR/partitions.bin" \
+    0xe000 "$FRAMEWORK_DIR/tools/partitions/boot_app0.bin" \
+    0x10000 "$BUILD_DIR/firmware.bin" >/dev/null
+
+: > "$LOG"
+"$QEMU" -machine esp32 -display none -monitor none \
+    -drive file="$FLASH",if=mtd,format=raw \
+    -serial file:"$LOG" &
+QEMU_PID=$!
+trap 'kill "$QEMU_PID" 2>/dev/null || true' EXIT
+
+# The test firmware never exits; stop once Unity prints its summary
+deadline=$((SECONDS + TIMEOUT))
+while kill -0 "$QEMU_PID" 2>/dev/null && [ "$SECONDS" -lt "$deadline" ]; do
+    if grep -Eq '[0-9]+ Tests [0-9]+ Failures' "$LOG"; then
+        break
+    fi
+    sleep 1
+done
+
+cat "$LOG"
+grep -Eq '[0-9]+ Tests 0 Failures' "$LOG"
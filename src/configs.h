@@ -6,7 +6,10 @@
 
 // SHA-256 Implementation
 // 0 = Pure C, 1 = ESP32 Hardware Acceleration
+// Host builds (native test/bench environments) override this with -DUSE_HW_SHA256=0
+#ifndef USE_HW_SHA256
 #define USE_HW_SHA256 1
+#endif
 
 // Debug and Verbose Flags
 #define DEBUG 0
@@ -22,7 +25,23 @@
 // Mining Configuration
 // #define THREADS 1 // Now auto-detected
 #define MAX_NONCE 0xFFFFFFFF  // Use full 32-bit range for better share finding
-#define NONCE_RANGE_SIZE 100000  // Nonces per mining cycle per worker
+#define NONCE_RANGE_SIZE 100000  // First claim of a worker from the nonce space, before its rate is known
+#define JOB_SWITCH_TARGET_MS 50  // Claims are sized to this much hashing, bounding work on a replaced job
+
+// BIP310 version rolling: header version bits asked of the pool in
+// mining.configure; the pool may grant fewer. 0 disables the request.
+#define VERSION_ROLLING_MASK 0x1fffe000
+#define VERSION_ROLLING_MIN_BITS 2
+#define VERSION_ROLLING_TIMEOUT_MS 5000  // Pools that ignore mining.configure never answer it
+
+// ntime rolling: headers use the job's ntime plus the seconds since its
+// mining.notify, up to NTIME_CLOCK_WINDOW_S. Each pass over a job's whole
+// nonce space moves ntime on by a full window plus one second, so the clock
+// never carries one pass onto the ntime of another. Pools reject ntime
+// further than NTIME_ROLL_LIMIT_S past the job's.
+#define NTIME_ROLL_LIMIT_S 7000
+#define NTIME_CLOCK_WINDOW_S 600
+#define NTIME_ROLL_PASSES ((NTIME_ROLL_LIMIT_S - NTIME_CLOCK_WINDOW_S) / (NTIME_CLOCK_WINDOW_S + 1))
 
 // Share Difficulty Configuration (for pool visibility)
 #define SHARE_DIFFICULTY_LEVEL 2  // 1=easy (2 zeros), 2=medium (3 zeros), 3=hard (4 zeros), 4=very hard (5 zeros), 5=extreme (6 zeros)
@@ -49,9 +68,12 @@
 #define CPU_FREQUENCY_MHZ 240
 #define WDT_TIMEOUT_SECONDS 120
 
-// FreeRTOS task stack sizes (bytes)
+// FreeRTOS task stack sizes (bytes); a worker's job snapshot and coinbase
+// cache are static (worker_job_state_t), not on its stack. DEBUG prints the
+// stack a worker never used once per job.
 #define WORKER_STACK_SIZE 12288
 #define MONITOR_STACK_SIZE 4096
+#define WORK_PREP_STACK_SIZE 4096
 
 // Worker startup stagger to avoid resource conflicts at boot
 #define WORKER_STAGGER_MS 2000
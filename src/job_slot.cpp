@@ -0,0 +1,173 @@
+#include "job_slot.h"
+
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+
+job_slot_t mining_job_slot;
+
+void job_slot_init(job_slot_t *slot) {
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Rewrites one history entry behind its sequence count; generation 0
+// retires it
+static void write_history(job_history_entry_t *entry, uint32_t generation, const char *job_id) {
+    uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->generation = generation;
+    strncpy(entry->job_id, job_id, MAX_JOB_ID_LEN);
+    entry->job_id[MAX_JOB_ID_LEN] = '\0';
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void retire_history(job_slot_t *slot) {
+    for (int i = 0; i < JOB_HISTORY_SIZE; i++) {
+        write_history(&slot->history[i], 0, "");
+    }
+}
+
+bool job_slot_publish(job_slot_t *slot, const StratumState *state, uint32_t generation) {
+    while (__atomic_exchange_n(&slot->writing, 1, __ATOMIC_ACQUIRE)) {
+        delay(1);
+    }
+
+    // 0 means nothing published; skipping to 2 keeps the buffers alternating
+    uint32_t published = __atomic_load_n(&slot->published, __ATOMIC_RELAXED) + 1;
+    if (published == 0) published = 2;
+
+    job_slot_buffer_t *buffer = &slot->buffers[published & 1];
+    uint32_t seq = __atomic_load_n(&buffer->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&buffer->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    job_snapshot_t *snapshot = &buffer->snapshot;
+    snapshot->published = published;
+    snapshot->generation = generation;
+    memcpy(&snapshot->job, &state->current_job, sizeof(snapshot->job));
+    int extranonce1_len = state->extranonce1_len;
+    if (extranonce1_len < 0) extranonce1_len = 0;
+    if (extranonce1_len > MAX_EXTRANONCE1_BYTES) extranonce1_len = MAX_EXTRANONCE1_BYTES;
+    memcpy(snapshot->extranonce1, state->extranonce1, extranonce1_len);
+    snapshot->extranonce1_len = extranonce1_len;
+    snapshot->version_mask = state->version_rolling ? state->version_mask : 0;
+
+    __atomic_store_n(&buffer->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->published, published, __ATOMIC_RELEASE);
+
+    // Shares of jobs before a clean_jobs one, or before the new block an
+    // abort signalled for this job, would be rejected as stale
+    bool retired = state->current_job.clean_jobs ||
+                   generation == __atomic_load_n(&slot->valid_from, __ATOMIC_ACQUIRE);
+    if (retired) retire_history(slot);
+    write_history(&slot->history[generation % JOB_HISTORY_SIZE], generation, state->current_job.job_id);
+
+    __atomic_store_n(&slot->writing, 0, __ATOMIC_RELEASE);
+    return retired;
+}
+
+void job_slot_retire_all(job_slot_t *slot) {
+    while (__atomic_exchange_n(&slot->writing, 1, __ATOMIC_ACQUIRE)) {
+        delay(1);
+    }
+    retire_history(slot);
+    __atomic_store_n(&slot->writing, 0, __ATOMIC_RELEASE);
+}
+
+uint32_t job_slot_abort(job_slot_t *slot, uint32_t generation, uint32_t notify_us) {
+    __atomic_store_n(&slot->abort_us, notify_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->abort_latency_us, 0, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->aborts, 1, __ATOMIC_RELAXED);
+    // Only the signal: the history is retired when the job is published, so
+    // a refused notify can still be taken back
+    return __atomic_exchange_n(&slot->valid_from, generation ? generation : 1, __ATOMIC_ACQ_REL);
+}
+
+void job_slot_abort_cancel(job_slot_t *slot, uint32_t valid_from) {
+    __atomic_store_n(&slot->valid_from, valid_from, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&slot->aborts, 1, __ATOMIC_RELAXED);
+}
+
+bool job_slot_aborted(const job_slot_t *slot, uint32_t generation) {
+    uint32_t valid_from = __atomic_load_n(&slot->valid_from, __ATOMIC_ACQUIRE);
+    return valid_from != 0 && (int32_t)(generation - valid_from) < 0;
+}
+
+// Raises *value to latency unless it is already higher
+static void raise_to(volatile uint32_t *value, uint32_t latency) {
+    uint32_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+    while (latency > current &&
+           !__atomic_compare_exchange_n(value, &current, latency, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void job_slot_note_abort(job_slot_t *slot, uint32_t now_us) {
+    uint32_t latency = now_us - __atomic_load_n(&slot->abort_us, __ATOMIC_RELAXED);
+    if (latency == 0) latency = 1;
+    raise_to(&slot->abort_latency_us, latency);
+    raise_to(&slot->max_abort_latency_us, latency);
+}
+
+uint32_t job_slot_published(const job_slot_t *slot) {
+    return __atomic_load_n(&slot->published, __ATOMIC_ACQUIRE);
+}
+
+// Copies len bytes at offset of the current snapshot; false before the first
+// publish
+static bool read_current(job_slot_t *slot, size_t offset, size_t len, void *out) {
+    for (;;) {
+        uint32_t published = __atomic_load_n(&slot->published, __ATOMIC_ACQUIRE);
+        if (published == 0) return false;
+        job_slot_buffer_t *buffer = &slot->buffers[published & 1];
+        uint32_t seq = __atomic_load_n(&buffer->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            memcpy(out, (const uint8_t *)&buffer->snapshot + offset, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&buffer->seq, __ATOMIC_RELAXED) == seq) return true;
+        }
+        __atomic_fetch_add(&slot->retries, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool job_slot_read(job_slot_t *slot, job_snapshot_t *out) {
+    return read_current(slot, 0, sizeof(*out), out);
+}
+
+void job_slot_read_id(job_slot_t *slot, char *job_id, size_t size) {
+    char id[MAX_JOB_ID_LEN + 1];
+    if (size == 0) return;
+    if (!read_current(slot, offsetof(job_snapshot_t, job) + offsetof(StratumJob, job_id), sizeof(id), id)) {
+        id[0] = '\0';
+    }
+    id[MAX_JOB_ID_LEN] = '\0';
+    strncpy(job_id, id, size - 1);
+    job_id[size - 1] = '\0';
+}
+
+bool job_slot_lookup(job_slot_t *slot, uint32_t generation, char *job_id, size_t size) {
+    if (generation == 0 || size == 0 || job_slot_aborted(slot, generation)) return false;
+    job_history_entry_t *entry = &slot->history[generation % JOB_HISTORY_SIZE];
+    char id[MAX_JOB_ID_LEN + 1];
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            uint32_t entry_generation = entry->generation;
+            memcpy(id, entry->job_id, sizeof(id));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+                if (entry_generation != generation) return false;
+                break;
+            }
+        }
+        __atomic_fetch_add(&slot->retries, 1, __ATOMIC_RELAXED);
+    }
+    id[MAX_JOB_ID_LEN] = '\0';
+    strncpy(job_id, id, size - 1);
+    job_id[size - 1] = '\0';
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef JOB_SLOT_H
+#define JOB_SLOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pool_connection.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOB_HISTORY_SIZE 8               // recent jobs whose shares are still submitted
+
+// Everything a worker builds headers of one job from
+typedef struct {
+    uint32_t published;                  // job_slot_published() this snapshot was published as
+    uint32_t generation;                 // nonce space generation of the job's units
+    StratumJob job;
+    uint8_t extranonce1[MAX_EXTRANONCE1_BYTES];
+    int extranonce1_len;
+    uint32_t version_mask;               // negotiated mask, 0 without version rolling
+} job_snapshot_t;
+
+typedef struct {
+    volatile uint32_t seq;               // odd while the buffer is rewritten
+    job_snapshot_t snapshot;
+} job_slot_buffer_t;
+
+// A published job as its shares are submitted
+typedef struct {
+    volatile uint32_t seq;               // odd while the entry is rewritten
+    uint32_t generation;                 // 0 when empty or retired
+    char job_id[MAX_JOB_ID_LEN + 1];
+} job_history_entry_t;
+
+// The current job, passed from the task handling pool messages to the
+// workers without locks. The current job lives in buffers[published & 1];
+// a publish fills the other buffer and then makes it current with one
+// atomic store, so readers copy a buffer no one writes. A reader is only
+// overtaken when two publishes land during its copy; the buffer's sequence
+// count shows that and it copies again.
+// The ids of recent jobs stay in history[generation % JOB_HISTORY_SIZE]
+// until clean_jobs, a new block or a new session retires them, so a share
+// is submitted for the job it was hashed for, not the one current at submit
+// time.
+// A new block aborts the work of every job before valid_from; workers check
+// it once per scan batch.
+typedef struct {
+    job_slot_buffer_t buffers[2];
+    job_history_entry_t history[JOB_HISTORY_SIZE];
+    volatile uint32_t published;         // publishes so far, 0 before the first
+    volatile uint32_t writing;           // a task is publishing
+    volatile uint32_t retries;           // copies repeated because a publish overtook them
+
+    volatile uint32_t valid_from;        // oldest generation worth hashing, 0 before any abort
+    volatile uint32_t aborts;            // new blocks signalled
+    volatile uint32_t abort_us;          // micros() at the notify of the last abort
+    volatile uint32_t abort_latency_us;  // that notify to the last worker stopping
+    volatile uint32_t max_abort_latency_us;
+} job_slot_t;
+
+void job_slot_init(job_slot_t *slot);
+// Publishes the job in state as the current one; generation is the nonce
+// space generation its units are claimed under. A clean_jobs job, or the one
+// an abort was signalled for, retires all earlier ones and returns true.
+// Waits for a publish in progress.
+bool job_slot_publish(job_slot_t *slot, const StratumState *state, uint32_t generation);
+// Retires every job published so far, for a new pool session
+void job_slot_retire_all(job_slot_t *slot);
+// The id of the job published under generation, for submitting its shares;
+// false once it is aborted, retired or JOB_HISTORY_SIZE newer jobs replaced it
+bool job_slot_lookup(job_slot_t *slot, uint32_t generation, char *job_id, size_t size);
+// New block at notify_us: work and shares of every job before generation
+// are worthless. Signalled from the first fields of the notify, before the
+// rest is decoded and published. Returns the valid_from it replaced.
+uint32_t job_slot_abort(job_slot_t *slot, uint32_t generation, uint32_t notify_us);
+// The notify of the last abort was refused: earlier jobs are worth hashing
+// again from valid_from, the value job_slot_abort returned
+void job_slot_abort_cancel(job_slot_t *slot, uint32_t valid_from);
+// True when an abort made the work of generation worthless; one atomic
+// load, for every scan batch
+bool job_slot_aborted(const job_slot_t *slot, uint32_t generation);
+// A worker stopped hashing at now_us because of the last abort
+void job_slot_note_abort(job_slot_t *slot, uint32_t now_us);
+// Changes with every publish: a snapshot whose published differs is stale.
+// One atomic load, cheap enough for every nonce batch.
+uint32_t job_slot_published(const job_slot_t *slot);
+// Consistent copy of the current job into out; false before the first publish
+bool job_slot_read(job_slot_t *slot, job_snapshot_t *out);
+// Only the current job id, NUL-terminated; empty before the first publish
+void job_slot_read_id(job_slot_t *slot, char *job_id, size_t size);
+
+// Published by the pool connection for every accepted mining.notify and
+// read by the mining workers
+extern job_slot_t mining_job_slot;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
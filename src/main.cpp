@@ -4,7 +4,9 @@
 #include "configs.h"
 #include "webconfig.h"
 #include "sha256_optimized.h"
+#include "sha256_backend.h"
 #include "mining_utils.h"
+#include "nonce_space.h"
 #include "pool_connection.h"
 #include "mining_worker.h"
 #include "esp_task_wdt.h"
@@ -95,6 +97,11 @@ void displayConfiguration() {
     }
 }
 
+// One mining worker per core, at most two
+static int miningWorkerCount() {
+    return min((int)ESP.getChipCores(), 2);
+}
+
 bool runBenchmarks() {
     if (VERBOSE) {
         Serial.println("Running system benchmarks...");
@@ -104,6 +111,17 @@ bool runBenchmarks() {
     sha256_benchmark_t benchmark;
     sha256_esp32_benchmark(&benchmark);
 
+    // Self-test the registered kernels and plan one per worker, so the SHA
+    // engine is driven by a single worker instead of contended by all
+    int num_workers = miningWorkerCount();
+    if (sha256_backend_select_workers(num_workers) == 0) {
+        Serial.println("SHA-256 backend: none (falling back to specialized)");
+    }
+    for (int i = 0; i < num_workers; i++) {
+        const sha256_backend_t* backend = sha256_backend_for_worker(i);
+        Serial.printf("SHA-256 backend for Worker[%d]: %s\n", i, backend ? backend->name : "specialized");
+    }
+
     if (VERBOSE) {
         Serial.printf("SHA-256 Performance: %u H/s (optimized)\n", benchmark.optimized_hps);
 
@@ -132,12 +150,14 @@ bool startMiningTasks() {
     }
 
     // Auto-detect number of cores and start mining workers (max 2)
-    int num_workers = min((int)ESP.getChipCores(), 2);
+    int num_workers = miningWorkerCount();
     if (num_workers == 1) {
         Serial.println("Single-core ESP32 detected, starting 1 worker task.");
     } else {
         Serial.printf("%d-core ESP32 detected, starting %d worker tasks.\n", num_workers, num_workers);
     }
+    // A job switch completes once every worker hashes the new job
+    nonce_space_set_workers(&mining_nonce_space, num_workers);
     char worker_names[num_workers][16];
     TaskHandle_t worker_handles[num_workers];
 
@@ -154,8 +174,9 @@ bool startMiningTasks() {
 
         if (res == pdPASS) {
             if (VERBOSE) {
-                Serial.printf("Started modular %s successfully on core %d\n",
-                             worker_names[i], i % 2);
+                const sha256_backend_t* backend = sha256_backend_for_worker(i);
+                Serial.printf("Started modular %s successfully on core %d (%s)\n",
+                             worker_names[i], i % 2, backend ? backend->name : "specialized");
             }
         } else {
             Serial.printf("Failed to start %s!\n", worker_names[i]);
@@ -163,6 +184,19 @@ bool startMiningTasks() {
         }
     }
 
+    // Header preparation below the workers' priority: it runs while they
+    // yield between scan batches, never in place of a batch
+    TaskHandle_t prep_handle;
+    BaseType_t prep_res = xTaskCreate(runWorkPrep, "WorkPrep", WORK_PREP_STACK_SIZE, NULL, 1, &prep_handle);
+    if (prep_res == pdPASS) {
+        if (VERBOSE) {
+            Serial.println("Work prep task started successfully");
+        }
+    } else {
+        Serial.println("Failed to start work prep task!");
+        return false;
+    }
+
     // Start monitor task
     TaskHandle_t monitor_handle;
     BaseType_t monitor_res = xTaskCreate(runMonitor, "Monitor", MONITOR_STACK_SIZE, NULL, 1, &monitor_handle);
@@ -2,6 +2,10 @@
 #include "configs.h"
 #include "pool_connection.h"
 #include "sha256_optimized.h"
+#include "sha256_shani.h"
+#ifndef UNIT_TEST
+#include "esp_task_wdt.h"
+#endif
 
 // Global statistics variables
 volatile unsigned long hashes = 0;
@@ -104,6 +108,13 @@ int to_byte_array(const char *in, size_t in_size, uint8_t *out) {
     }
 }
 
+// Decodes exactly len bytes; to_byte_array runs to the end of the string
+static void hex_to_bytes(const char *in, size_t len, uint8_t *out) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (hex(in[i * 2]) << 4) | hex(in[i * 2 + 1]);
+    }
+}
+
 // Adaptive difficulty implementation
 void initAdaptiveDifficulty() {
     last_share_time = millis();
@@ -162,58 +173,79 @@ uint8_t getCurrentDifficultyLevel() {
     return current_difficulty_level;
 }
 
+static void finishMerkleRoot(sha256_opt_ctx_t* ctx, const uint8_t (*merkle_branch)[32], int merkle_count,
+                             uint8_t* merkle_root);
+
+void fillJobHeader(uint8_t* header, uint32_t nonce, const StratumJob* job, const uint8_t* merkle_root) {
+    // Version, ntime, nbits and nonce are little endian words; prevhash is
+    // kept in header order and the merkle root is reversed into it
+    *(uint32_t*)(header + 0) = job->version;
+    memcpy(header + 4, job->prevhash, 32);
+    setBlockHeaderMerkleRoot(header, merkle_root);
+    *(uint32_t*)(header + 68) = job->ntime;
+    *(uint32_t*)(header + 72) = job->nbits;
+    *(uint32_t*)(header + 76) = nonce;
+}
+
 // Stratum mining functions implementation
-bool buildBlockHeader(uint8_t* header, uint32_t nonce, const String& extranonce2) {
-    StratumState* state = PoolConnection::getStratumState();
-    if (!state || state->current_job.job_id.isEmpty()) {
+bool buildBlockHeader(uint8_t* header, uint32_t nonce, const job_snapshot_t* snapshot, const uint8_t* extranonce2,
+                      size_t extranonce2_len) {
+    if (!snapshot || snapshot->job.job_id[0] == '\0') {
         return false;
     }
+    const StratumJob& job = snapshot->job;
+
+    // Coinbase hashed straight from the decoded parts
+    sha256_opt_ctx_t ctx;
+    sha256_esp32_init(&ctx);
+    ctx.use_hardware = false;
+    sha256_esp32_update(&ctx, job.coinb1, job.coinb1_len);
+    sha256_esp32_update(&ctx, snapshot->extranonce1, snapshot->extranonce1_len);
+    sha256_esp32_update(&ctx, extranonce2, extranonce2_len);
+    sha256_esp32_update(&ctx, job.coinb2, job.coinb2_len);
+
+    uint8_t merkle_root[32];
+    finishMerkleRoot(&ctx, job.merkle_branch, job.merkle_count, merkle_root);
+    fillJobHeader(header, nonce, &job, merkle_root);
+    return true;
+}
 
-    // Calculate merkle root
-    String merkleRoot = calculateMerkleRoot(
-        state->current_job.coinb1,
-        state->current_job.coinb2,
-        state->extranonce1,
-        extranonce2,
-        state->current_job.merkle_branch,
-        state->current_job.merkle_count
-    );
-
-    // Build block header (80 bytes)
-    memset(header, 0, 80);
-
-    // Version (4 bytes) - little endian
-    uint32_t version = strtoul(state->current_job.version.c_str(), NULL, 16);
-    *(uint32_t*)(header + 0) = version;
-
-    // Previous hash (32 bytes) - reverse byte order for little endian
-    if (state->current_job.prevhash.length() >= 64) {
-        for (int i = 0; i < 32; i++) {
-            String byte_str = state->current_job.prevhash.substring((31-i)*2, (31-i)*2 + 2);
-            header[4 + i] = strtoul(byte_str.c_str(), NULL, 16);
-        }
+bool buildJobHeader(uint8_t* header, uint32_t nonce, const StratumJob* job, const CoinbaseMidstate* coinbase,
+                    const uint8_t* extranonce2, size_t extranonce2_len) {
+    if (!job || job->job_id[0] == '\0' || !coinbase || !coinbase->valid) {
+        return false;
     }
 
-    // Merkle root (32 bytes) - reverse byte order for little endian
-    if (merkleRoot.length() >= 64) {
-        for (int i = 0; i < 32; i++) {
-            String byte_str = merkleRoot.substring((31-i)*2, (31-i)*2 + 2);
-            header[36 + i] = strtoul(byte_str.c_str(), NULL, 16);
-        }
+    uint8_t merkle_root[32];
+    coinbaseMerkleRoot(coinbase, extranonce2, extranonce2_len, merkle_root);
+    fillJobHeader(header, nonce, job, merkle_root);
+    return true;
+}
+
+void setBlockHeaderMerkleRoot(uint8_t* header, const uint8_t* merkle_root) {
+    for (int i = 0; i < 32; i++) {
+        header[36 + i] = merkle_root[31 - i];
     }
+}
 
-    // Timestamp (4 bytes) - little endian
-    uint32_t ntime = strtoul(state->current_job.ntime.c_str(), NULL, 16);
-    *(uint32_t*)(header + 68) = ntime;
+void setBlockHeaderVersionBits(uint8_t* header, uint32_t mask, uint32_t version_bits) {
+    uint32_t version = *(uint32_t*)(header + 0);
+    *(uint32_t*)(header + 0) = (version & ~mask) | (version_bits & mask);
+}
 
-    // Bits/difficulty (4 bytes) - little endian
-    uint32_t bits = strtoul(state->current_job.nbits.c_str(), NULL, 16);
-    *(uint32_t*)(header + 72) = bits;
+void setBlockHeaderNtime(uint8_t* header, uint32_t ntime) {
+    *(uint32_t*)(header + 68) = ntime;
+}
 
-    // Nonce (4 bytes) - little endian
-    *(uint32_t*)(header + 76) = nonce;
+uint32_t rolledNtime(uint32_t job_ntime, uint32_t ntime_roll, uint32_t elapsed_s) {
+    if (elapsed_s > NTIME_CLOCK_WINDOW_S) elapsed_s = NTIME_CLOCK_WINDOW_S;
+    return job_ntime + ntime_roll * (NTIME_CLOCK_WINDOW_S + 1) + elapsed_s;
+}
 
-    return true;
+static sha256d_64_fn merkleNodeHash() {
+    static sha256d_64_fn node_hash = NULL;
+    if (!node_hash) node_hash = sha256d_64_select();
+    return node_hash;
 }
 
 String calculateMerkleRoot(const String& coinb1, const String& coinb2, const String& extranonce1, const String& extranonce2, const String merkle_branch[], int merkle_count) {
@@ -229,7 +261,8 @@ String calculateMerkleRoot(const String& coinb1, const String& coinb2, const Str
     sha256_esp32_hash(coinbase_bytes, coinbase.length()/2, hash1);
     sha256_esp32_hash(hash1, 32, hash2);
 
-    // Apply merkle branch
+    // Apply merkle branch; nodes are hashed by the fastest available kernel
+    sha256d_64_fn merkle_node_hash = merkleNodeHash();
     for (int i = 0; i < merkle_count; i++) {
         if (merkle_branch[i].length() >= 64) {
             uint8_t branch_bytes[32];
@@ -243,8 +276,7 @@ String calculateMerkleRoot(const String& coinb1, const String& coinb2, const Str
             memcpy(combined, hash2, 32);
             memcpy(combined + 32, branch_bytes, 32);
 
-            sha256_esp32_hash(combined, 64, hash1);
-            sha256_esp32_hash(hash1, 32, hash2);
+            merkle_node_hash(combined, hash2);
         }
     }
 
@@ -259,6 +291,66 @@ String calculateMerkleRoot(const String& coinb1, const String& coinb2, const Str
     return result;
 }
 
+bool initCoinbaseMidstate(CoinbaseMidstate* cache, const StratumJob* job, const uint8_t* extranonce1,
+                          size_t extranonce1_len) {
+    if (!cache) return false;
+    cache->valid = false;
+    if (!job || extranonce1_len > MAX_EXTRANONCE1_BYTES) return false;
+
+    // Compress coinb1 || extranonce1 block by block; only the partial last
+    // block is kept as bytes
+    sha256_opt_ctx_t ctx;
+    sha256_esp32_init(&ctx);
+    ctx.use_hardware = false;
+    sha256_esp32_update(&ctx, job->coinb1, job->coinb1_len);
+    sha256_esp32_update(&ctx, extranonce1, extranonce1_len);
+    memcpy(cache->midstate, ctx.state, sizeof(cache->midstate));
+    memcpy(cache->prefix_tail, ctx.buffer, ctx.buffer_len);
+    cache->prefix_tail_len = ctx.buffer_len;
+    cache->prefix_len = ctx.total_len;
+
+    cache->coinb2_len = job->coinb2_len;
+    memcpy(cache->coinb2, job->coinb2, job->coinb2_len);
+    cache->merkle_count = job->merkle_count;
+    memcpy(cache->merkle_branch, job->merkle_branch, job->merkle_count * 32);
+
+    cache->valid = true;
+    return true;
+}
+
+void coinbaseMerkleRoot(const CoinbaseMidstate* cache, const uint8_t* extranonce2, size_t extranonce2_len,
+                        uint8_t* merkle_root) {
+    // Resume the coinbase hash from the prefix midstate
+    sha256_opt_ctx_t ctx;
+    ctx.use_hardware = false;
+    memcpy(ctx.state, cache->midstate, sizeof(ctx.state));
+    memcpy(ctx.buffer, cache->prefix_tail, cache->prefix_tail_len);
+    ctx.buffer_len = cache->prefix_tail_len;
+    ctx.total_len = cache->prefix_len;
+    sha256_esp32_update(&ctx, extranonce2, extranonce2_len);
+    sha256_esp32_update(&ctx, cache->coinb2, cache->coinb2_len);
+    finishMerkleRoot(&ctx, cache->merkle_branch, cache->merkle_count, merkle_root);
+}
+
+// Completes the coinbase double hash in ctx and walks the branches
+static void finishMerkleRoot(sha256_opt_ctx_t* ctx, const uint8_t (*merkle_branch)[32], int merkle_count,
+                             uint8_t* merkle_root) {
+    uint8_t hash1[32];
+    sha256_esp32_final(ctx, hash1);
+    sha256_esp32_init(ctx);
+    ctx->use_hardware = false;
+    sha256_esp32_update(ctx, hash1, 32);
+    sha256_esp32_final(ctx, merkle_root);
+
+    sha256d_64_fn merkle_node_hash = merkleNodeHash();
+    uint8_t combined[64];
+    for (int i = 0; i < merkle_count; i++) {
+        memcpy(combined, merkle_root, 32);
+        memcpy(combined + 32, merkle_branch[i], 32);
+        merkle_node_hash(combined, merkle_root);
+    }
+}
+
 bool checkStratumTarget(const uint8_t* hash, uint32_t difficulty) {
     // Simple difficulty check - count leading zeros
     uint8_t required_zeros = 0;
@@ -291,9 +383,8 @@ void initMidstateCache(MidstateCache* cache) {
     if (!cache) return;
     cache->valid = false;
     cache->tail_len = 0;
-    cache->job_id = "";
-    memset(cache->midstate, 0, 32);
-    memset(cache->midstate2, 0, 32);
+    cache->job_id[0] = '\0';
+    memset(cache->midstate, 0, sizeof(cache->midstate));
     memset(cache->tail_data, 0, 16);
 }
 
@@ -302,65 +393,58 @@ void updateMidstateCache(MidstateCache* cache, const uint8_t* header) {
     
     sha256_compute_midstate(header, 64, cache->midstate);
     
-    uint8_t second_hash[32];
-    sha256_esp32_hash(header + 64, 16, second_hash);
-    memcpy(cache->midstate2, second_hash, 32);
-    
     memcpy(cache->tail_data, header + 64, 16);
     cache->tail_len = 16;
+    sha256d_job_init(&cache->job, cache->midstate, header);
     cache->valid = true;
 }
 
-bool buildBlockHeaderMidstate(uint8_t* header, uint8_t* midstate, uint8_t* tail_data, uint32_t nonce, const String& extranonce2) {
-    StratumState* state = PoolConnection::getStratumState();
-    if (!state || state->current_job.job_id.isEmpty()) {
+void updateMidstateCacheTail(MidstateCache* cache, const uint8_t* header) {
+    if (!cache || !header || !cache->valid) return;
+
+    memcpy(cache->tail_data, header + 64, 16);
+    sha256d_job_init(&cache->job, cache->midstate, header);
+}
+
+bool buildBlockHeaderMidstate(uint8_t* header, uint32_t* midstate, uint8_t* tail_data, uint32_t nonce,
+                              const job_snapshot_t* snapshot, const String& extranonce2) {
+    uint8_t extranonce2_bytes[32];
+    size_t extranonce2_len = extranonce2.length() / 2;
+    if (extranonce2_len > sizeof(extranonce2_bytes)) return false;
+    hex_to_bytes(extranonce2.c_str(), extranonce2_len, extranonce2_bytes);
+
+    if (!buildBlockHeader(header, nonce, snapshot, extranonce2_bytes, extranonce2_len)) {
         return false;
     }
-    
-    String merkleRoot = calculateMerkleRoot(
-        state->current_job.coinb1,
-        state->current_job.coinb2,
-        state->extranonce1,
-        extranonce2,
-        state->current_job.merkle_branch,
-        state->current_job.merkle_count
-    );
-    
-    memset(header, 0, 80);
-    
-    uint32_t version = strtoul(state->current_job.version.c_str(), NULL, 16);
-    *(uint32_t*)(header + 0) = version;
-    
-    if (state->current_job.prevhash.length() >= 64) {
-        for (int i = 0; i < 32; i++) {
-            String byte_str = state->current_job.prevhash.substring((31-i)*2, (31-i)*2 + 2);
-            header[4 + i] = strtoul(byte_str.c_str(), NULL, 16);
-        }
-    }
-    
-    if (merkleRoot.length() >= 64) {
-        for (int i = 0; i < 32; i++) {
-            String byte_str = merkleRoot.substring((31-i)*2, (31-i)*2 + 2);
-            header[36 + i] = strtoul(byte_str.c_str(), NULL, 16);
-        }
-    }
-    
-    uint32_t ntime = strtoul(state->current_job.ntime.c_str(), NULL, 16);
-    *(uint32_t*)(header + 68) = ntime;
-    
-    uint32_t bits = strtoul(state->current_job.nbits.c_str(), NULL, 16);
-    *(uint32_t*)(header + 72) = bits;
-    
-    *(uint32_t*)(header + 76) = nonce;
-    
+
     if (midstate && tail_data) {
         sha256_compute_midstate(header, 64, midstate);
-        
-        uint8_t second_hash[32];
-        sha256_esp32_hash(header + 64, 16, second_hash);
-        
         memcpy(tail_data, header + 64, 16);
     }
-    
+
     return true;
-}
\ No newline at end of file
+}
+
+uint32_t scanBatch(const scan_loop_t* loop, uint32_t nonce, uint32_t count, bool* aborted) {
+    uint32_t hits[SCAN_MAX_HITS];
+    size_t found = loop->scan(loop->job, nonce, count, loop->target, hits, SCAN_MAX_HITS);
+
+    // A full hit buffer ends the batch early; resume after the last hit
+    uint32_t scanned = (found == SCAN_MAX_HITS) ? hits[found - 1] - nonce + 1 : count;
+    __atomic_fetch_add(&hashes, scanned, __ATOMIC_RELAXED);
+    sha256_backend_add_hashes(loop->backend, scanned);
+
+    for (size_t i = 0; i < found; i++) {
+        loop->on_hit(loop->ctx, hits[i]);
+    }
+
+    // Reset watchdog and check for new jobs once per batch
+    esp_task_wdt_reset();
+    vTaskDelay(1);
+    if (loop->poll) loop->poll(loop->ctx);
+
+    // A new block makes the rest of the unit worthless; every worker sees it
+    // within one scan batch
+    *aborted = job_slot_aborted(&mining_job_slot, loop->generation);
+    return scanned;
+}
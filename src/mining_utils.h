@@ -1,17 +1,21 @@
 #ifndef MINING_UTILS_H
 #define MINING_UTILS_H
 
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
 #include <Arduino.h>
+#endif
 #include <stdint.h>
+#include "sha256_optimized.h"
+#include "sha256_backend.h"
+#include "pool_connection.h"
+#include "job_slot.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Forward declarations
-void sha256_esp32_hash(const uint8_t *data, size_t len, uint8_t *hash);
-void sha256_compute_midstate(const uint8_t *data, uint32_t len, uint8_t *midstate);
-
 // Hash validation functions
 bool checkHalfShare(unsigned char* hash);
 bool checkShare(unsigned char* hash);
@@ -26,9 +30,13 @@ uint8_t getCurrentDifficultyLevel();
 uint8_t hex(char ch);
 int to_byte_array(const char *in, size_t in_size, uint8_t *out);
 
-// Stratum mining functions
-bool buildBlockHeader(uint8_t* header, uint32_t nonce, const String& extranonce2);
-bool buildBlockHeaderMidstate(uint8_t* header, uint8_t* midstate, uint8_t* tail_data, uint32_t nonce, const String& extranonce2);
+// Stratum mining functions. Headers come from a job snapshot (job_slot_read),
+// never from the state the pool task rewrites, and extranonce2 as bytes;
+// nothing on this path allocates.
+bool buildBlockHeader(uint8_t* header, uint32_t nonce, const job_snapshot_t* snapshot, const uint8_t* extranonce2,
+                      size_t extranonce2_len);
+bool buildBlockHeaderMidstate(uint8_t* header, uint32_t* midstate, uint8_t* tail_data, uint32_t nonce,
+                              const job_snapshot_t* snapshot, const String& extranonce2);
 String calculateMerkleRoot(const String& coinb1, const String& coinb2, const String& extranonce1, const String& extranonce2, const String merkle_branch[], int merkle_count);
 bool checkStratumTarget(const uint8_t* hash, uint32_t difficulty);
 
@@ -44,20 +52,85 @@ extern volatile uint8_t current_difficulty_level;
 
 // Constants
 #define NONCE_BATCH_SIZE 256
+#define SCAN_BATCH_SIZE (NONCE_BATCH_SIZE * 16)  // Nonces per sha256d_scan call
+#define SCAN_MAX_HITS 64                          // Candidate buffer per scan call
 #define JSON_BUFFER_SIZE 2048
 
 // Midstate cache for optimization
 typedef struct {
     bool valid;
-    uint8_t midstate[32];
-    uint8_t midstate2[32];
+    uint32_t midstate[8];   // compression state after the first 64 header bytes
     uint8_t tail_data[16];
     size_t tail_len;
-    String job_id;
+    sha256d_job_t job;      // nonce-specialized kernel state for this header
+    char job_id[MAX_JOB_ID_LEN + 1];
 } MidstateCache;
 
 void initMidstateCache(MidstateCache* cache);
 void updateMidstateCache(MidstateCache* cache, const uint8_t* header);
+// updateMidstateCache for a header whose first 64 bytes are unchanged (a
+// rolled ntime): keeps the midstate, rebuilds only the kernel state
+void updateMidstateCacheTail(MidstateCache* cache, const uint8_t* header);
+
+// Coinbase split at extranonce2, prepared once per job: the whole 64-byte
+// blocks of coinb1 || extranonce1 are compressed into a midstate, and the
+// remaining prefix bytes, coinb2 and the merkle branches are copied from the
+// job, so the cache stays whole when a notify replaces the job. A merkle
+// root for a new extranonce2 then costs the coinbase tail blocks plus the
+// branch walk.
+typedef struct {
+    bool valid;
+    uint32_t midstate[8];
+    uint8_t prefix_tail[64];    // prefix bytes after the compressed blocks
+    uint32_t prefix_tail_len;
+    uint64_t prefix_len;        // coinb1 || extranonce1 length in bytes
+    uint8_t coinb2[MAX_COINB2_BYTES];
+    uint32_t coinb2_len;
+    uint8_t merkle_branch[MAX_MERKLE_BRANCHES][32];
+    int merkle_count;
+} CoinbaseMidstate;
+
+// Decoded jobs always fit; false only without a job or for an extranonce1
+// past MAX_EXTRANONCE1_BYTES
+bool initCoinbaseMidstate(CoinbaseMidstate* cache, const StratumJob* job, const uint8_t* extranonce1,
+                          size_t extranonce1_len);
+// Merkle root in raw hash byte order for one extranonce2
+void coinbaseMerkleRoot(const CoinbaseMidstate* cache, const uint8_t* extranonce2, size_t extranonce2_len,
+                        uint8_t* merkle_root);
+// buildBlockHeader of job with the merkle root from its prepared coinbase
+bool buildJobHeader(uint8_t* header, uint32_t nonce, const StratumJob* job, const CoinbaseMidstate* coinbase,
+                    const uint8_t* extranonce2, size_t extranonce2_len);
+// The header of job for a known merkle root (raw hash byte order)
+void fillJobHeader(uint8_t* header, uint32_t nonce, const StratumJob* job, const uint8_t* merkle_root);
+// Writes a merkle root given in raw hash byte order into the header
+void setBlockHeaderMerkleRoot(uint8_t* header, const uint8_t* merkle_root);
+// Replaces the header version bits under mask with version_bits (BIP310
+// version rolling); the rest of the header is untouched
+void setBlockHeaderVersionBits(uint8_t* header, uint32_t mask, uint32_t version_bits);
+// Replaces the header ntime; only the second SHA-256 block changes
+void setBlockHeaderNtime(uint8_t* header, uint32_t ntime);
+// ntime of a header in ntime pass ntime_roll, elapsed_s seconds after the
+// job's mining.notify: passes and clock seconds never give the same ntime
+uint32_t rolledNtime(uint32_t job_ntime, uint32_t ntime_roll, uint32_t elapsed_s);
+
+// The hash loop over one claimed unit, as a worker runs it
+typedef struct {
+    sha256d_scan_fn scan;                       // the worker's backend kernel
+    const sha256_backend_t* backend;            // credited with the hashes, NULL for none
+    const sha256d_job_t* job;
+    const sha256d_target_t* target;
+    uint32_t generation;                        // job of the unit, watched for an abort
+    void (*on_hit)(void* ctx, uint32_t nonce);  // share checks of a candidate
+    void (*poll)(void* ctx);                    // reads the pool between batches, NULL on all but worker 0
+    void* ctx;
+} scan_loop_t;
+
+// One batch of the loop: scans up to count nonces from nonce, credits the
+// nonces hashed to hashes and the backend, hands each candidate to on_hit,
+// then resets the watchdog, yields, polls and checks mining_job_slot. A
+// full candidate buffer ends the batch early. Returns the nonces scanned;
+// *aborted once a new block made the rest of the unit worthless.
+uint32_t scanBatch(const scan_loop_t* loop, uint32_t nonce, uint32_t count, bool* aborted);
 
 #ifdef __cplusplus
 }
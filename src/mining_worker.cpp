@@ -2,22 +2,49 @@
 #include "mining_utils.h"
 #include "pool_connection.h"
 #include "sha256_optimized.h"
+#include "sha256_backend.h"
+#include "work_prep.h"
+#include "share_filter.h"
 #include "configs.h"
 #include "esp_task_wdt.h"
 #include <ArduinoJson.h>
 
+static worker_job_state_t worker_job_states[SHA256_MAX_WORKERS];
+
+// Worker 0 reads the pool between scan batches; zero timeout keeps the
+// poll from stalling the hash loop
+static void pollPool(void* ctx) {
+    String message = PoolConnection::readResponse(0);
+    if (message.length() > 0) {
+        PoolConnection::processStratumMessage(message);
+    }
+}
+
 // MiningWorker implementation
 MiningWorker::MiningWorker(const char* name) {
     strlcpy(worker_name, name, sizeof(worker_name));
     worker_id = worker_name[7] - '0';
-    current_nonce_start = 0;
-    current_nonce_end = 0;
+    memset(&current_unit, 0, sizeof(current_unit));
+    work_generation = 0;
+    work_extranonce2 = 0;
+    work_version_bits = 0;
+    work_ntime = 0;
+    job_ntime = 0;
+    job_received_ms = 0;
+    coinbase_generation = 0;
+    job_state = &worker_job_states[worker_id];
+    memset(job_state, 0, sizeof(*job_state));
+    started_generation = 0;
+    nonce_chunk_init(&chunk, NONCE_RANGE_SIZE);
+    backend = sha256_backend_for_worker(worker_id);
+    scan_fn = backend ? backend->scan : sha256d_scan;
     initMidstateCache(&midstate_cache);
 }
 
 bool MiningWorker::initialize() {
     if (DEBUG) {
-        Serial.printf("\nInitializing %s on core %d\n", worker_name, xPortGetCoreID());
+        Serial.printf("\nInitializing %s on core %d, backend %s\n", worker_name, xPortGetCoreID(),
+                      backend ? backend->name : "specialized");
     }
 
     // Stagger worker startup to avoid resource conflicts
@@ -62,20 +89,32 @@ void MiningWorker::mineLoop() {
             }
         }
 
-        // Set mining range for this worker
-        current_nonce_start = worker_id * NONCE_RANGE_SIZE;
-        current_nonce_end = current_nonce_start + NONCE_RANGE_SIZE;
+        // Claim the next unit no other worker has had in this job, sized so
+        // that a job switch waits at most about JOB_SWITCH_TARGET_MS for us
+        if (!nonce_space_claim(&mining_nonce_space, chunk.size, &current_unit)) {
+            // Whole (extranonce2, version, nonce) space of the job handed out; only a
+            // new mining.notify brings more work
+            if (worker_id == 0) {
+                String message = PoolConnection::readResponse(1000);
+                if (message.length() > 0) {
+                    PoolConnection::processStratumMessage(message);
+                }
+            }
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
 
         if (VERBOSE) {
-            Serial.printf("%s: Mining job %s, range %u - %u\n", worker_name,
-                         PoolConnection::getCurrentJobId().c_str(), current_nonce_start, current_nonce_end);
+            Serial.printf("%s: Mining job %s, extranonce2 %llu, version bits %08x, range %u + %u\n", worker_name,
+                         PoolConnection::getCurrentJobId().c_str(), (unsigned long long)current_unit.extranonce2,
+                         current_unit.version_bits, current_unit.nonce_start, current_unit.nonce_count);
         }
 
         // Update adaptive difficulty
         updateAdaptiveDifficulty();
 
         // Process mining range
-        if (processMiningRange(current_nonce_start, current_nonce_end)) {
+        if (processMiningRange(current_unit)) {
             Serial.printf("%s: Completed mining cycle\n", worker_name);
         }
 
@@ -84,112 +123,214 @@ void MiningWorker::mineLoop() {
     }
 }
 
-bool MiningWorker::processMiningRange(uint32_t start_nonce, uint32_t end_nonce) {
+bool MiningWorker::processMiningRange(const nonce_unit_t& unit) {
     // Check if we have a valid Stratum job
     if (!PoolConnection::hasValidJob()) {
         if (DEBUG) Serial.printf("%s: No valid job available\n", worker_name);
         return false;
     }
 
-    // Generate extranonce2 for this worker
-    char extranonce2[9];
-    snprintf(extranonce2, sizeof(extranonce2), "%08x", worker_id);
-    String extranonce2_str = String(extranonce2);
-    
-    StratumState* state = PoolConnection::getStratumState();
-    bool job_changed = !midstate_cache.valid || 
-                       midstate_cache.job_id != state->current_job.job_id;
-    
-    if (job_changed) {
-        uint8_t block_header[80];
-        if (!buildBlockHeader(block_header, 0, extranonce2_str)) {
-            if (DEBUG) Serial.printf("%s: Failed to build block header\n", worker_name);
+    // extranonce2 of this unit in the pool's extranonce2_size: bytes for the
+    // coinbase, hex for mining.submit
+    uint8_t extranonce2_bytes[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+    size_t extranonce2_len = nonce_space_extranonce2_bytes(&mining_nonce_space, unit.extranonce2,
+                                                           extranonce2_bytes, sizeof(extranonce2_bytes));
+    char extranonce2[2 * NONCE_SPACE_MAX_EXTRANONCE2_SIZE + 1];
+    nonce_space_format_extranonce2(&mining_nonce_space, unit.extranonce2, extranonce2, sizeof(extranonce2));
+
+    // Claimed just before a new block arrived. Worker 0 keeps reading the
+    // pool meanwhile: the notify that ends the abort only comes that way.
+    if (job_slot_aborted(&mining_job_slot, unit.generation)) {
+        if (worker_id == 0) {
+            String message = PoolConnection::readResponse(100);
+            if (message.length() > 0) {
+                PoolConnection::processStratumMessage(message);
+            }
+        }
+        return false;
+    }
+
+    // A job published since the last unit is copied once, without locks
+    job_snapshot_t& snapshot = job_state->snapshot;
+    if (snapshot.published != job_slot_published(&mining_job_slot)) {
+        job_slot_read(&mining_job_slot, &snapshot);
+    }
+
+    bool job_changed = !midstate_cache.valid || work_generation != unit.generation;
+    bool extranonce2_changed = job_changed || work_extranonce2 != unit.extranonce2;
+    bool header_changed = extranonce2_changed || work_version_bits != unit.version_bits;
+
+    prepared_header_t& prepared = job_state->prepared;
+    if (header_changed && work_prep_take(&mining_work_prep, &unit, &prepared)) {
+        // Built by the prep task when the job arrived or ahead of the cursor
+        memcpy(work_header, prepared.header, sizeof(work_header));
+        midstate_cache = prepared.cache;
+        job_ntime = prepared.job_ntime;
+        job_received_ms = prepared.received_ms;
+        work_ntime = rolledNtime(job_ntime, unit.ntime_roll, 0);
+    } else if (header_changed) {
+        // A unit of a replaced job; its header can no longer be built
+        if (snapshot.generation != unit.generation) {
+            if (DEBUG) Serial.printf("%s: Dropping unit of replaced job\n", worker_name);
             return false;
         }
-        updateMidstateCache(&midstate_cache, block_header);
-        midstate_cache.job_id = state->current_job.job_id;
-        
+        const StratumJob& job = snapshot.job;
+
+        // The coinbase prefix is compressed once per job, so each extranonce2
+        // only hashes the coinbase tail
+        if (coinbase_generation != unit.generation) {
+            initCoinbaseMidstate(&job_state->coinbase, &job, snapshot.extranonce1, snapshot.extranonce1_len);
+            coinbase_generation = unit.generation;
+        }
+        if (job_changed) {
+            job_ntime = job.ntime;
+            job_received_ms = job.received_ms;
+        }
+        if (extranonce2_changed) {
+            if (!buildJobHeader(work_header, 0, &job, &job_state->coinbase, extranonce2_bytes, extranonce2_len)) {
+                if (DEBUG) Serial.printf("%s: Failed to build block header\n", worker_name);
+                return false;
+            }
+        }
+
+        // A new version only changes the first header block: no coinbase or
+        // merkle work, just a new midstate
+        work_ntime = rolledNtime(job_ntime, unit.ntime_roll, 0);
+        setBlockHeaderVersionBits(work_header, snapshot.version_mask, unit.version_bits);
+        setBlockHeaderNtime(work_header, work_ntime);
+        updateMidstateCache(&midstate_cache, work_header);
+        strncpy(midstate_cache.job_id, job.job_id, MAX_JOB_ID_LEN);
+        midstate_cache.job_id[MAX_JOB_ID_LEN] = '\0';
+    }
+    if (header_changed) {
+        work_generation = unit.generation;
+        work_extranonce2 = unit.extranonce2;
+        work_version_bits = unit.version_bits;
+
         if (VERBOSE) {
-            Serial.printf("%s: Midstate updated for job %s\n", worker_name, 
-                         midstate_cache.job_id.c_str());
+            Serial.printf("%s: Midstate updated for job %s, extranonce2 %s, version bits %08x\n", worker_name,
+                         midstate_cache.job_id, extranonce2, unit.version_bits);
         }
     }
 
-    // Create tail data with nonce at position 12 (offset in 64-byte block after midstate)
-    uint8_t mining_tail[16];
-    
-    for(uint32_t nonce = start_nonce; nonce < end_nonce; nonce++) {
-        // Build mining tail: ntime(4) + bits(4) + nonce(4) + padding(4)
-        memcpy(mining_tail, midstate_cache.tail_data, 12);  // ntime + bits
-        *(uint32_t*)(mining_tail + 12) = nonce;
-        
-        // Use optimized midstate SHA-256 (first half of double hash)
-        uint8_t hash_result[32];
-        sha256_bitcoin_hash_fast(midstate_cache.midstate, midstate_cache.midstate2,
-                                  mining_tail, 16, hash_result);
-        
-        // Fast reject: check first 2 bytes for quick rejection
-        if (!sha256_check_fast_reject(hash_result, 2)) {
-            // Not even a half-share, continue
-            __atomic_fetch_add(&hashes, 1, __ATOMIC_RELAXED);
-            
-            // Reset watchdog periodically
-            if ((nonce % 65536) == 0) {
-                esp_task_wdt_reset();
-            }
-            continue;
+    // ntime follows the wall clock since the job's mining.notify within the
+    // unit's ntime pass. A new ntime only changes the second block: same
+    // midstate.
+    uint32_t ntime = rolledNtime(job_ntime, unit.ntime_roll, (millis() - job_received_ms) / 1000);
+    if (work_ntime != ntime) {
+        setBlockHeaderNtime(work_header, ntime);
+        updateMidstateCacheTail(&midstate_cache, work_header);
+        work_ntime = ntime;
+    }
+
+    // Candidates need hash[31] == 0, which every share check below requires
+    sha256d_target_t target;
+    sha256d_target_init(&target, 1);
+
+    if (started_generation != unit.generation) {
+        nonce_space_note_start(&mining_nonce_space, worker_id, unit.generation, micros());
+        started_generation = unit.generation;
+        // Worker 0 has handled the notify on this stack by now
+        if (DEBUG) {
+            Serial.printf("%s: %u bytes of stack never used\n", worker_name,
+                          (unsigned)uxTaskGetStackHighWaterMark(NULL));
         }
-        
-        // Check results using real Stratum difficulty
-        uint32_t pool_difficulty = PoolConnection::getCurrentDifficulty();
-        
-        if(checkStratumTarget(hash_result, pool_difficulty)) {
-            if (VERBOSE) {
-                Serial.printf("%s: VALID SHARE! nonce: %u, difficulty: %u\n", worker_name, nonce, pool_difficulty);
-            }
-            shares++;
-            
-            // Submit share to pool with proper Stratum format
-            StratumState* st = PoolConnection::getStratumState();
-            String ntime_str = st->current_job.ntime;
-            PoolConnection::submitStratumShare(nonce, extranonce2_str, ntime_str);
-        } else if(checkShare(hash_result)) {
-            // Local share for statistics (easier difficulty)
+    }
+
+    // Only worker 0 should check for new jobs to prevent mutex contention
+    ScanHitContext hit_context = {this, &unit, extranonce2};
+    scan_loop_t loop;
+    loop.scan = scan_fn;
+    loop.backend = backend;
+    loop.job = &midstate_cache.job;
+    loop.target = &target;
+    loop.generation = unit.generation;
+    loop.on_hit = onScanHit;
+    loop.poll = (worker_id == 0) ? pollPool : NULL;
+    loop.ctx = &hit_context;
+
+    // Counted by remaining nonces: the last unit of a header ends at 2^32
+    uint32_t nonce = unit.nonce_start;
+    uint32_t remaining = unit.nonce_count;
+    unsigned long range_start = micros();
+    while (remaining > 0) {
+        uint32_t count = (remaining < SCAN_BATCH_SIZE) ? remaining : SCAN_BATCH_SIZE;
+        bool aborted;
+        uint32_t scanned = scanBatch(&loop, nonce, count, &aborted);
+        nonce += scanned;
+        remaining -= scanned;
+
+        if (aborted) {
+            job_slot_note_abort(&mining_job_slot, micros());
             if (VERBOSE) {
-                Serial.printf("%s: Half-share found, nonce: %u\n", worker_name, nonce);
+                Serial.printf("%s: New block, abandoning %u nonces\n", worker_name, remaining);
             }
-            halfshares++;
+            break;
         }
-        
-        __atomic_fetch_add(&hashes, 1, __ATOMIC_RELAXED);
 
-        // Reset watchdog periodically and check for new jobs
-        if ((nonce % (NONCE_BATCH_SIZE * 16)) == 0) {
-            esp_task_wdt_reset();
-            vTaskDelay(1);
-
-            // Only worker 0 should check for new jobs to prevent mutex contention
-            if (worker_id == 0) {
-                String message = PoolConnection::readResponse(10);
-                if (message.length() > 0) {
-                    PoolConnection::processStratumMessage(message);
-                }
-            }
-
-            // Show progress for debugging
-            if ((nonce % 65536) == 0 && VERBOSE) {
-                Serial.printf("%s: Processed %u hashes, job: %s\n", worker_name,
-                             nonce - start_nonce, PoolConnection::getCurrentJobId().c_str());
-            }
+        // Show progress for debugging
+        uint32_t processed = unit.nonce_count - remaining;
+        if (VERBOSE && (processed % 65536) < scanned) {
+            Serial.printf("%s: Processed %u hashes, job: %s\n", worker_name,
+                         processed, PoolConnection::getCurrentJobId().c_str());
         }
     }
 
+    // The next claim takes about JOB_SWITCH_TARGET_MS at the rate just seen
+    nonce_chunk_update(&chunk, unit.nonce_count - remaining, micros() - range_start, JOB_SWITCH_TARGET_MS);
     return true;
 }
 
+void MiningWorker::onScanHit(void* ctx, uint32_t nonce) {
+    ScanHitContext* hit = (ScanHitContext*)ctx;
+    hit->worker->processCandidate(*hit->unit, nonce, hit->extranonce2);
+}
+
+void MiningWorker::processCandidate(const nonce_unit_t& unit, uint32_t nonce, const char* extranonce2) {
+    uint8_t hash_result[32];
+    sha256d_job_hash(&midstate_cache.job, nonce, hash_result);
+
+    // Check results using real Stratum difficulty
+    uint32_t pool_difficulty = PoolConnection::getCurrentDifficulty();
+
+    if(checkStratumTarget(hash_result, pool_difficulty)) {
+        if (VERBOSE) {
+            Serial.printf("%s: VALID SHARE! nonce: %u, difficulty: %u\n", worker_name, nonce, pool_difficulty);
+        }
+        shares++;
+
+        // Submitted for the unit's job with the header fields it was hashed
+        // with, even if a newer job arrived meanwhile
+        StratumShare share;
+        share.job = unit.generation;
+        share.nonce = nonce;
+        share.ntime = work_ntime;
+        share.version_bits = unit.version_bits;
+        strncpy(share.extranonce2, extranonce2, sizeof(share.extranonce2) - 1);
+        share.extranonce2[sizeof(share.extranonce2) - 1] = '\0';
+
+        // A rescanned range finds the same share again; the pool would only
+        // reject it
+        if (!share_filter_insert(&mining_share_filter, &share)) {
+            if (VERBOSE) Serial.printf("%s: Duplicate share suppressed, nonce: %u\n", worker_name, nonce);
+            return;
+        }
+        PoolConnection::submitStratumShare(share);
+    } else if(checkShare(hash_result)) {
+        // Local share for statistics (easier difficulty)
+        if (VERBOSE) {
+            Serial.printf("%s: Half-share found, nonce: %u\n", worker_name, nonce);
+        }
+        halfshares++;
+    }
+}
+
 String MiningWorker::getStats() {
     String stats = String(worker_name) + ": ";
-    stats += "Range " + String(current_nonce_start) + "-" + String(current_nonce_end);
+    stats += "Extranonce2 " + String((unsigned long)current_unit.extranonce2);
+    stats += " version bits " + String(current_unit.version_bits);
+    stats += " range " + String(current_unit.nonce_start) + "+" + String(current_unit.nonce_count);
+    stats += ", next claim " + String(chunk.size);
     return stats;
 }
 
@@ -206,6 +347,16 @@ void runOptimizedWorker(void *name) {
     worker.mineLoop();
 }
 
+// Prepares headers for the workers in the time they leave the CPU
+void runWorkPrep(void *name) {
+    while (true) {
+        if (!work_prep_run(&mining_work_prep, &mining_nonce_space, &mining_job_slot)) {
+            esp_task_wdt_reset();
+            vTaskDelay(pdMS_TO_TICKS(WORK_PREP_POLL_MS));
+        }
+    }
+}
+
 // MiningMonitor implementation
 void MiningMonitor::start() {
     if (DEBUG) {
@@ -242,6 +393,44 @@ void MiningMonitor::updateDisplay() {
             }
         }
 
+        if (VERBOSE) {
+            // Per-backend share of the total, to compare worker assignments
+            static unsigned long last_backend_hashes[SHA256_MAX_BACKENDS];
+            for (size_t i = 0; i < sha256_backend_count(); i++) {
+                const sha256_backend_t* backend = sha256_backend_get(i);
+                unsigned long total = sha256_backend_hashes(backend);
+                if (total == 0) continue;
+                float rate = (interval > 100) ? (total - last_backend_hashes[i]) / (float)interval : 0;
+                Serial.printf("    %-12s %.2f KH/s, %lu hashes\n", backend->name, rate, total);
+                last_backend_hashes[i] = total;
+            }
+        }
+
+        if (VERBOSE) {
+            nonce_space_stats_t work;
+            nonce_space_get_stats(&mining_nonce_space, &work);
+            Serial.printf("    work units %llu, extranonce2 %llu (%u rolls), version %08x (%u rolls), ntime pass %u (%u rolls)\n",
+                          (unsigned long long)work.units_issued, (unsigned long long)work.extranonce2,
+                          work.extranonce2_rolls, work.version_bits, work.version_rolls,
+                          work.ntime_roll, work.ntime_rolls);
+            Serial.printf("    duplicate work: %u overlapping claims, %u repeated headers\n",
+                          work.overlapping_claims, work.repeated_headers);
+            Serial.printf("    job switch: first hash %.1f ms, all %u workers %.1f ms, worst %.1f ms\n",
+                          work.first_hash_us / 1000.0f, work.workers_joined, work.switch_us / 1000.0f,
+                          work.max_switch_us / 1000.0f);
+            Serial.printf("    new blocks %u: workers stopped %.1f ms after notify, worst %.1f ms\n",
+                          mining_job_slot.aborts, mining_job_slot.abort_latency_us / 1000.0f,
+                          mining_job_slot.max_abort_latency_us / 1000.0f);
+            Serial.printf("    shares: stale dropped %u, duplicates suppressed %u of %u\n",
+                          PoolConnection::getStaleShares(), mining_share_filter.suppressed,
+                          mining_share_filter.checked);
+            Serial.printf("    headers prepared %u, taken %u, built by workers %u\n",
+                          mining_work_prep.prepared, mining_work_prep.taken, mining_work_prep.missed);
+            Serial.printf("    reused across notifies: coinbases %u, merkle roots %u, midstates %u\n",
+                          mining_work_prep.coinbases_reused, mining_work_prep.roots_reused,
+                          mining_work_prep.midstates_reused);
+        }
+
         last_hashes = hashes;
         last_report = now;
     }
@@ -256,12 +445,39 @@ String MiningMonitor::getStatistics() {
     stats += "  Total Hashes: " + String(hashes) + "\n";
     stats += "  Shares Found: " + String(shares) + "\n";
     stats += "  Half-Shares: " + String(halfshares) + "\n";
+    stats += "  Stale Shares Dropped: " + String(PoolConnection::getStaleShares()) + "\n";
+    stats += "  Duplicate Shares Suppressed: " + String(mining_share_filter.suppressed) + " of " +
+             String(mining_share_filter.checked) + "\n";
     stats += "  Average Rate: " + String(avg_rate, 2) + " KH/s\n";
+    for (size_t i = 0; i < sha256_backend_count(); i++) {
+        const sha256_backend_t* backend = sha256_backend_get(i);
+        unsigned long backend_total = sha256_backend_hashes(backend);
+        if (backend_total == 0) continue;
+        float backend_rate = (uptime > 0) ? (backend_total * 1.0) / uptime / 1000.0 : 0;
+        stats += "    " + String(backend->name) + ": " + String(backend_rate, 2) + " KH/s\n";
+    }
     stats += "  Temperature: " + String(temperatureRead(), 1) + "°C\n";
     stats += "  Local Difficulty Level: " + String(getCurrentDifficultyLevel()) + "\n";
     stats += "  Stratum Difficulty: " + String(PoolConnection::getCurrentDifficulty()) + "\n";
     stats += "  Current Job: " + PoolConnection::getCurrentJobId() + "\n";
 
+    // Work handed out for the current job
+    nonce_space_stats_t work;
+    nonce_space_get_stats(&mining_nonce_space, &work);
+    stats += "  Work Units: " + String((unsigned long)work.units_issued) + "\n";
+    stats += "  Extranonce2 Rolls: " + String(work.extranonce2_rolls) + "\n";
+    stats += "  Version Rolls: " + String(work.version_rolls) + "\n";
+    stats += "  Ntime Rolls: " + String(work.ntime_rolls) + "\n";
+    stats += "  Job Switch: first hash " + String(work.first_hash_us / 1000) + " ms, all workers " +
+             String(work.switch_us / 1000) + " ms, worst " + String(work.max_switch_us / 1000) + " ms\n";
+    stats += "  New Block Aborts: " + String(mining_job_slot.aborts) + ", stopped " +
+             String(mining_job_slot.abort_latency_us / 1000) + " ms after notify, worst " +
+             String(mining_job_slot.max_abort_latency_us / 1000) + " ms\n";
+    stats += "  Prepared Headers: " + String(mining_work_prep.prepared) + ", taken " +
+             String(mining_work_prep.taken) + ", built by workers " + String(mining_work_prep.missed) + "\n";
+    stats += "  Reused Across Notifies: coinbases " + String(mining_work_prep.coinbases_reused) + ", merkle roots " +
+             String(mining_work_prep.roots_reused) + ", midstates " + String(mining_work_prep.midstates_reused) + "\n";
+
     unsigned long time_since_share = millis() - last_share_time;
     stats += "  Time Since Last Share: " + String(time_since_share / 1000) + "s\n";
 
@@ -5,19 +5,54 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "mining_utils.h"
+#include "sha256_backend.h"
+#include "nonce_space.h"
+#include "job_slot.h"
+#include "work_prep.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// What a worker builds headers from, about 4.5 KB: static storage, one per
+// worker, so the worker's task stack only holds the hash loop
+typedef struct {
+    job_snapshot_t snapshot;       // current job as last copied from mining_job_slot
+    CoinbaseMidstate coinbase;     // coinbase prefix of the snapshot's job
+    prepared_header_t prepared;    // header last copied from mining_work_prep
+} worker_job_state_t;
+
 // Mining worker management
 class MiningWorker {
 private:
     char worker_name[16];
     int worker_id;
-    uint32_t current_nonce_start;
-    uint32_t current_nonce_end;
+    nonce_unit_t current_unit;
+    nonce_chunk_tuner_t chunk;     // claim size for JOB_SWITCH_TARGET_MS at this worker's rate
+    uint32_t started_generation;   // last job this worker reported hashing
+    uint32_t work_generation;      // job the cached header was built for
+    uint64_t work_extranonce2;     // extranonce2 of the cached header
+    uint32_t work_version_bits;    // rolled version bits of the cached header
+    uint32_t work_ntime;           // rolled ntime of the cached header
+    uint32_t job_ntime;            // ntime of the job as notified
+    unsigned long job_received_ms; // when the job was notified, for ntime rolling
+    uint32_t coinbase_generation;  // job the coinbase in job_state was prepared for
+    worker_job_state_t* job_state; // this worker's entry of worker_job_states
+    uint8_t work_header[80];       // header of the current extranonce2, version bits applied
     MidstateCache midstate_cache;
+    const sha256_backend_t* backend;
+    sha256d_scan_fn scan_fn;
+
+    // Recompute the full digest of a scan hit of unit and run the share checks
+    void processCandidate(const nonce_unit_t& unit, uint32_t nonce, const char* extranonce2);
+
+    // What scanBatch passes back for each hit of a unit
+    struct ScanHitContext {
+        MiningWorker* worker;
+        const nonce_unit_t* unit;
+        const char* extranonce2;
+    };
+    static void onScanHit(void* ctx, uint32_t nonce);
 
 public:
     // Constructor
@@ -29,8 +64,8 @@ public:
     // Main mining loop
     void mineLoop();
 
-    // Process mining range
-    bool processMiningRange(uint32_t start_nonce, uint32_t end_nonce);
+    // Hash one work unit claimed from the shared nonce space
+    bool processMiningRange(const nonce_unit_t& unit);
 
     // Get worker statistics
     String getStats();
@@ -45,6 +80,7 @@ public:
 // Task functions for FreeRTOS
 void runOptimizedWorker(void *name);
 void runMonitor(void *name);
+void runWorkPrep(void *name);
 
 // Monitor functions
 class MiningMonitor {
@@ -0,0 +1,327 @@
+#include "nonce_space.h"
+#include "configs.h"
+
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
+#include <Arduino.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+nonce_space_t mining_nonce_space = {0, NONCE_RANGE_SIZE, 1, 0, {}};
+
+void nonce_space_init(nonce_space_t *space, uint32_t unit_size) {
+    memset(space, 0, sizeof(*space));
+    space->unit_size = unit_size ? unit_size : 1;
+    space->workers = 1;
+}
+
+void nonce_space_set_workers(nonce_space_t *space, uint32_t workers) {
+    if (workers < 1) workers = 1;
+    if (workers > NONCE_SPACE_MAX_WORKERS) workers = NONCE_SPACE_MAX_WORKERS;
+    space->workers = workers;
+}
+
+uint32_t nonce_space_next_generation(const nonce_space_t *space) {
+    uint32_t generation = __atomic_load_n(&space->generation, __ATOMIC_RELAXED) + 1;
+    return generation ? generation : 1;
+}
+
+void nonce_space_begin_job(nonce_space_t *space, int extranonce2_size, uint32_t version_mask,
+                           uint32_t ntime_roll_limit, uint32_t now_us) {
+    uint32_t generation = nonce_space_next_generation(space);
+    nonce_space_job_t *job = &space->jobs[generation & 1];
+
+    // Grace period: a claimer stalled since two jobs ago may still be inside
+    // this slot; it backs out on its generation check, so this only waits out
+    // a few instructions of another task
+    while (__atomic_load_n(&job->claimers, __ATOMIC_SEQ_CST) != 0) {
+        delay(1);
+    }
+
+    if (extranonce2_size <= 0) extranonce2_size = NONCE_SPACE_DEFAULT_EXTRANONCE2_SIZE;
+    if (extranonce2_size > NONCE_SPACE_MAX_EXTRANONCE2_SIZE) extranonce2_size = NONCE_SPACE_MAX_EXTRANONCE2_SIZE;
+
+    // Roll the lowest bits of the mask; 2^16 versions already outlast any
+    // job at these hash rates
+    uint32_t rolled_mask = 0;
+    uint32_t version_shift = 0;
+    for (uint32_t bit = 1; bit != 0 && version_shift < NONCE_SPACE_MAX_VERSION_BITS; bit <<= 1) {
+        if (version_mask & bit) {
+            rolled_mask |= bit;
+            version_shift++;
+        }
+    }
+
+    // Capped below 2^32 headers so position never wraps; at 1 MH/s that is
+    // still over 500 million years of work per job, so ntime only rolls here
+    // for short extranonce2 without version rolling. Atomic because a claimer
+    // two generations behind may still read this slot before it backs out.
+    uint32_t extranonce2_bits = (extranonce2_size >= 4) ? 32 : extranonce2_size * 8;
+    uint64_t limit = ((uint64_t)ntime_roll_limit + 1) << (extranonce2_bits + version_shift);
+    if (limit > 0xFFFFFFFFULL) limit = 0xFFFFFFFFULL;
+    __atomic_store_n(&job->extranonce2_size, extranonce2_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->extranonce2_bits, extranonce2_bits, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->version_mask, rolled_mask, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->version_shift, version_shift, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->header_limit, limit, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&job->position, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->units_issued, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->nonces_issued, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->version_rolls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->extranonce2_rolls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->ntime_rolls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->exhausted, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->claimed_end, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->claimed_nonces, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->overlapping_claims, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->repeated_headers, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->started_us, now_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->joined_mask, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->first_hash_us, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&job->switch_us, 0, __ATOMIC_RELAXED);
+
+    // Publish: a worker that sees the new generation sees the reset slot.
+    // Sequentially consistent with the claimers handshake, so a claimer that
+    // enters the old slot after the next grace period sees this generation.
+    __atomic_store_n(&space->generation, generation, __ATOMIC_SEQ_CST);
+}
+
+// Spreads the low bits of index over the set bits of mask, lowest first
+static uint32_t scatter_version_bits(uint32_t index, uint32_t mask) {
+    uint32_t bits = 0;
+    for (uint32_t bit = 1; bit != 0 && index != 0; bit <<= 1) {
+        if (mask & bit) {
+            if (index & 1) bits |= bit;
+            index >>= 1;
+        }
+    }
+    return bits;
+}
+
+// The index within mask of bits, inverse of scatter_version_bits
+static uint32_t gather_version_bits(uint32_t bits, uint32_t mask) {
+    uint32_t index = 0;
+    uint32_t shift = 0;
+    for (uint32_t bit = 1; bit != 0; bit <<= 1) {
+        if (mask & bit) {
+            if (bits & bit) index |= 1u << shift;
+            shift++;
+        }
+    }
+    return index;
+}
+
+uint32_t nonce_space_generation(const nonce_space_t *space) {
+    return __atomic_load_n(&space->generation, __ATOMIC_ACQUIRE);
+}
+
+// Splits header index header of job into the unit's header fields
+static void decode_header(const nonce_space_job_t *job, uint32_t generation, uint64_t header, nonce_unit_t *unit) {
+    uint32_t shift = __atomic_load_n(&job->version_shift, __ATOMIC_RELAXED);
+    uint32_t extranonce2_bits = __atomic_load_n(&job->extranonce2_bits, __ATOMIC_RELAXED);
+    uint32_t version_index = (uint32_t)(header & ((1ULL << shift) - 1));
+    unit->generation = generation;
+    unit->header = (uint32_t)header;
+    unit->extranonce2 = (header >> shift) & ((1ULL << extranonce2_bits) - 1);
+    unit->version_bits = scatter_version_bits(version_index, __atomic_load_n(&job->version_mask, __ATOMIC_RELAXED));
+    unit->ntime_roll = (uint32_t)(header >> (shift + extranonce2_bits));
+}
+
+uint64_t nonce_space_cursor(const nonce_space_t *space, uint32_t generation) {
+    if (generation == 0 || nonce_space_generation(space) != generation) return 0;
+    return __atomic_load_n(&space->jobs[generation & 1].position, __ATOMIC_RELAXED);
+}
+
+// The header index whose fields unit carries, inverse of decode_header
+static uint64_t encode_header(const nonce_space_job_t *job, const nonce_unit_t *unit) {
+    uint32_t shift = __atomic_load_n(&job->version_shift, __ATOMIC_RELAXED);
+    uint32_t extranonce2_bits = __atomic_load_n(&job->extranonce2_bits, __ATOMIC_RELAXED);
+    uint32_t version_index = gather_version_bits(unit->version_bits, __atomic_load_n(&job->version_mask, __ATOMIC_RELAXED));
+    return ((uint64_t)unit->ntime_roll << (shift + extranonce2_bits)) | (unit->extranonce2 << shift) | version_index;
+}
+
+// Checks the claim [start, end) of unit against the ranges claimed before it
+static void record_claim(nonce_space_job_t *job, const nonce_unit_t *unit, uint64_t start, uint64_t end) {
+    // The end first: every nonce counted below lies under claimed_end
+    uint64_t furthest = __atomic_load_n(&job->claimed_end, __ATOMIC_SEQ_CST);
+    while (end > furthest &&
+           !__atomic_compare_exchange_n(&job->claimed_end, &furthest, end, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+    uint64_t recorded = __atomic_add_fetch(&job->claimed_nonces, end - start, __ATOMIC_SEQ_CST);
+    if (recorded > __atomic_load_n(&job->claimed_end, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&job->overlapping_claims, 1, __ATOMIC_RELAXED);
+    }
+
+    // Two header indexes giving the same fields would hash the same headers
+    if (unit->nonce_start == 0 && encode_header(job, unit) != unit->header) {
+        __atomic_fetch_add(&job->repeated_headers, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool nonce_space_header_unit(const nonce_space_t *space, uint32_t generation, uint32_t header,
+                             nonce_unit_t *unit) {
+    if (generation == 0 || nonce_space_generation(space) != generation) return false;
+    const nonce_space_job_t *job = &space->jobs[generation & 1];
+    if (header >= __atomic_load_n(&job->header_limit, __ATOMIC_RELAXED)) return false;
+    decode_header(job, generation, header, unit);
+    unit->nonce_start = 0;
+    unit->nonce_count = 0;
+    // Read before the slot could be reset for a later job; a generation
+    // bumped meanwhile means the fields may be torn
+    return nonce_space_generation(space) == generation;
+}
+
+bool nonce_space_next(nonce_space_t *space, nonce_unit_t *unit) {
+    return nonce_space_claim(space, space->unit_size, unit);
+}
+
+bool nonce_space_claim(nonce_space_t *space, uint32_t count, nonce_unit_t *unit) {
+    if (count == 0) count = 1;
+    while (true) {
+        uint32_t generation = __atomic_load_n(&space->generation, __ATOMIC_ACQUIRE);
+        if (generation == 0) return false;
+        nonce_space_job_t *job = &space->jobs[generation & 1];
+
+        // Enter the slot, then confirm it still holds our generation; once
+        // in, nonce_space_begin_job will not reset it under us
+        __atomic_fetch_add(&job->claimers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&space->generation, __ATOMIC_SEQ_CST) != generation) {
+            __atomic_fetch_sub(&job->claimers, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        uint64_t limit = __atomic_load_n(&job->header_limit, __ATOMIC_RELAXED);
+        uint64_t position = __atomic_load_n(&job->position, __ATOMIC_RELAXED);
+        uint64_t end;
+        do {
+            uint64_t header = position >> 32;
+            if (header >= limit) {
+                __atomic_fetch_add(&job->exhausted, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_sub(&job->claimers, 1, __ATOMIC_RELEASE);
+                return false;
+            }
+            uint64_t boundary = (header + 1) << 32;
+            end = position + count;
+            if (end > boundary) end = boundary;
+        } while (!__atomic_compare_exchange_n(&job->position, &position, end, true,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        decode_header(job, generation, position >> 32, unit);
+        unit->nonce_start = (uint32_t)position;
+        unit->nonce_count = (uint32_t)(end - position);
+
+        __atomic_fetch_add(&job->units_issued, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&job->nonces_issued, end - position, __ATOMIC_RELEASE);
+        record_claim(job, unit, position, end);
+        if (unit->nonce_start == 0 && unit->version_bits != 0) {
+            __atomic_fetch_add(&job->version_rolls, 1, __ATOMIC_RELAXED);
+        } else if (unit->nonce_start == 0 && unit->extranonce2 > 0) {
+            __atomic_fetch_add(&job->extranonce2_rolls, 1, __ATOMIC_RELAXED);
+        } else if (unit->nonce_start == 0 && unit->ntime_roll > 0) {
+            __atomic_fetch_add(&job->ntime_rolls, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_sub(&job->claimers, 1, __ATOMIC_RELEASE);
+        return true;
+    }
+}
+
+void nonce_space_note_start(nonce_space_t *space, uint32_t worker, uint32_t generation, uint32_t now_us) {
+    if (generation == 0 || worker >= NONCE_SPACE_MAX_WORKERS) return;
+    nonce_space_job_t *job = &space->jobs[generation & 1];
+
+    uint32_t bit = 1u << worker;
+    uint32_t all = (space->workers >= 32) ? 0xFFFFFFFFu : (1u << space->workers) - 1;
+    uint32_t joined = __atomic_fetch_or(&job->joined_mask, bit, __ATOMIC_RELAXED);
+    if (joined & bit) return;
+    if (nonce_space_generation(space) != generation) return;
+    uint32_t latency = now_us - __atomic_load_n(&job->started_us, __ATOMIC_RELAXED);
+    if (latency == 0) latency = 1;
+    if (joined == 0) __atomic_store_n(&job->first_hash_us, latency, __ATOMIC_RELAXED);
+
+    // Only the worker whose bit completes the mask records the switch, and
+    // only while its generation is still the published one
+    if (((joined | bit) & all) != all) return;
+    __atomic_store_n(&job->switch_us, latency, __ATOMIC_RELAXED);
+    uint32_t worst = __atomic_load_n(&space->max_switch_us, __ATOMIC_RELAXED);
+    while (latency > worst &&
+           !__atomic_compare_exchange_n(&space->max_switch_us, &worst, latency, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void nonce_chunk_init(nonce_chunk_tuner_t *tuner, uint32_t size) {
+    tuner->size = size < NONCE_CHUNK_MIN ? NONCE_CHUNK_MIN : size;
+    tuner->hps = 0;
+}
+
+uint32_t nonce_chunk_update(nonce_chunk_tuner_t *tuner, uint32_t hashed, uint32_t elapsed_us, uint32_t target_ms) {
+    if (hashed == 0 || elapsed_us == 0) return tuner->size;
+
+    // Rate over this claim, smoothed 1/4 so one preempted claim does not
+    // halve the next one
+    uint32_t sample = (uint32_t)((uint64_t)hashed * 1000000ULL / elapsed_us);
+    tuner->hps = tuner->hps ? (uint32_t)(((uint64_t)tuner->hps * 3 + sample) / 4) : sample;
+
+    uint64_t size = (uint64_t)tuner->hps * target_ms / 1000;
+    size -= size % NONCE_CHUNK_MIN;
+    if (size < NONCE_CHUNK_MIN) size = NONCE_CHUNK_MIN;
+    if (size > NONCE_CHUNK_MAX) size = NONCE_CHUNK_MAX;
+    tuner->size = (uint32_t)size;
+    return tuner->size;
+}
+
+size_t nonce_space_extranonce2_bytes(const nonce_space_t *space, uint64_t extranonce2, uint8_t *out,
+                                     size_t out_size) {
+    uint32_t generation = nonce_space_generation(space);
+    int size = generation ? __atomic_load_n(&space->jobs[generation & 1].extranonce2_size, __ATOMIC_RELAXED)
+                          : NONCE_SPACE_DEFAULT_EXTRANONCE2_SIZE;
+    if ((size_t)size > out_size) return 0;
+    for (int i = 0; i < size; i++) {
+        int shift = size - 1 - i;
+        out[i] = (shift < 8) ? (uint8_t)(extranonce2 >> (shift * 8)) : 0;
+    }
+    return size;
+}
+
+void nonce_space_format_extranonce2(const nonce_space_t *space, uint64_t extranonce2, char *out, size_t out_size) {
+    uint8_t bytes[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+    size_t size = nonce_space_extranonce2_bytes(space, extranonce2, bytes, sizeof(bytes));
+    size_t pos = 0;
+    for (size_t i = 0; i < size && pos + 2 < out_size; i++) {
+        snprintf(out + pos, out_size - pos, "%02x", bytes[i]);
+        pos += 2;
+    }
+    if (out_size) out[pos < out_size ? pos : out_size - 1] = '\0';
+}
+
+void nonce_space_get_stats(const nonce_space_t *space, nonce_space_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->generation = nonce_space_generation(space);
+    if (stats->generation == 0) return;
+    const nonce_space_job_t *job = &space->jobs[stats->generation & 1];
+
+    stats->units_issued = __atomic_load_n(&job->units_issued, __ATOMIC_RELAXED);
+    stats->nonces_issued = __atomic_load_n(&job->nonces_issued, __ATOMIC_ACQUIRE);
+    uint64_t position = __atomic_load_n(&job->position, __ATOMIC_ACQUIRE);
+    uint64_t header = position >> 32;
+    uint32_t shift = __atomic_load_n(&job->version_shift, __ATOMIC_RELAXED);
+    uint32_t extranonce2_bits = __atomic_load_n(&job->extranonce2_bits, __ATOMIC_RELAXED);
+    stats->extranonce2 = (header >> shift) & ((1ULL << extranonce2_bits) - 1);
+    stats->version_bits = scatter_version_bits((uint32_t)(header & ((1ULL << shift) - 1)),
+                                               __atomic_load_n(&job->version_mask, __ATOMIC_RELAXED));
+    stats->ntime_roll = (uint32_t)(header >> (shift + extranonce2_bits));
+    stats->version_rolls = __atomic_load_n(&job->version_rolls, __ATOMIC_RELAXED);
+    stats->ntime_rolls = __atomic_load_n(&job->ntime_rolls, __ATOMIC_RELAXED);
+    stats->extranonce2_rolls = __atomic_load_n(&job->extranonce2_rolls, __ATOMIC_RELAXED);
+    stats->exhausted = __atomic_load_n(&job->exhausted, __ATOMIC_RELAXED);
+    stats->overlapping_claims = __atomic_load_n(&job->overlapping_claims, __ATOMIC_RELAXED);
+    stats->repeated_headers = __atomic_load_n(&job->repeated_headers, __ATOMIC_RELAXED);
+    stats->workers_joined = __builtin_popcount(__atomic_load_n(&job->joined_mask, __ATOMIC_RELAXED));
+    stats->first_hash_us = __atomic_load_n(&job->first_hash_us, __ATOMIC_RELAXED);
+    stats->switch_us = __atomic_load_n(&job->switch_us, __ATOMIC_RELAXED);
+    stats->max_switch_us = __atomic_load_n(&space->max_switch_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,172 @@
+#ifndef NONCE_SPACE_H
+#define NONCE_SPACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NONCE_SPACE_DEFAULT_EXTRANONCE2_SIZE 4   // bytes, when the pool sent none
+#define NONCE_SPACE_MAX_EXTRANONCE2_SIZE 16      // bytes
+#define NONCE_SPACE_MAX_WORKERS 32               // bits of the joined mask
+#define NONCE_SPACE_MAX_VERSION_BITS 16          // rolled version bits, lowest of the mask
+#define NONCE_CHUNK_MIN 4096                     // one scan batch
+#define NONCE_CHUNK_MAX (1u << 24)
+
+// One piece of work: nonces [nonce_start, nonce_start + nonce_count) of the
+// header built with extranonce2, version_bits and ntime_roll, for the job of
+// generation
+typedef struct {
+    uint32_t generation;                // job handle; shares of the unit are submitted for it
+    uint32_t header;                    // header index in the job's nonce space
+    uint64_t extranonce2;
+    uint32_t version_bits;              // rolled bits, inside the job's version mask
+    uint32_t ntime_roll;                // ntime pass, see rolledNtime()
+    uint32_t nonce_start;
+    uint32_t nonce_count;
+} nonce_unit_t;
+
+// Work of one job as a single 64-bit position: a header index in the high
+// word, nonce in the low word. The header index is, from the top, an ntime
+// roll, extranonce2 in extranonce2_bits and a version index in the lowest
+// version_shift bits, scattered into version_mask (BIP310 version rolling) to
+// give the header's version bits. Units are claimed by compare-and-swap on
+// position and never cross a header boundary, so the units of a job are
+// disjoint, a whole 32-bit nonce space is handed out before the version
+// rolls, and every allowed version is used before extranonce2 rolls: a new
+// version only needs a new header midstate, a new extranonce2 also a coinbase
+// hash and merkle walk. ntime rolls last, once every extranonce2 is used.
+typedef struct {
+    volatile uint64_t position;         // next unclaimed (header, nonce)
+    volatile uint32_t claimers;         // nonce_space_claim calls inside this slot
+    uint64_t header_limit;              // number of header indexes
+    int extranonce2_size;               // bytes
+    uint32_t extranonce2_bits;          // header index bits of extranonce2, at most 32
+    uint32_t version_mask;              // bits rolled, 0 without version rolling
+    uint32_t version_shift;             // popcount of version_mask
+
+    volatile uint64_t units_issued;
+    volatile uint64_t nonces_issued;
+    volatile uint32_t version_rolls;
+    volatile uint32_t extranonce2_rolls;
+    volatile uint32_t ntime_rolls;
+    volatile uint32_t exhausted;        // claims refused at the end of the space
+
+    // Duplicate work checks, kept apart from the cursor: every claim also
+    // records its own range here. Disjoint ranges below claimed_end add up
+    // to at most claimed_end, so a range handed out twice pushes
+    // claimed_nonces past it. A header is checked once, at its first claim,
+    // by mapping its (extranonce2, version, ntime) back to a header index.
+    volatile uint64_t claimed_end;      // furthest position a claim reached
+    volatile uint64_t claimed_nonces;   // nonces of the claims recorded so far
+    volatile uint32_t overlapping_claims; // claims that found claimed_nonces past claimed_end
+    volatile uint32_t repeated_headers; // headers whose fields map to another header index
+
+    // Job switch latency: from the job's start time (its mining.notify) to
+    // the first and the last worker starting to hash it (nonce_space_note_start)
+    uint32_t started_us;
+    volatile uint32_t joined_mask;
+    volatile uint32_t first_hash_us;    // 0 until the first worker joined
+    volatile uint32_t switch_us;        // 0 until every worker has joined
+} nonce_space_job_t;
+
+// The running job lives in jobs[generation & 1]; nonce_space_begin_job resets
+// the other slot once no claim is inside it and then publishes it by bumping
+// generation. A claim that raced the switch finishes in the old job, so its
+// unit is stale but never counted against the new one.
+typedef struct {
+    volatile uint32_t generation;       // 0 until the first job
+    uint32_t unit_size;                 // nonces per unit of nonce_space_next
+    uint32_t workers;                   // workers that must join before a switch is complete
+    volatile uint32_t max_switch_us;    // worst completed switch so far
+    nonce_space_job_t jobs[2];
+} nonce_space_t;
+
+typedef struct {
+    uint32_t generation;
+    uint64_t extranonce2;               // extranonce2 being handed out
+    uint32_t version_bits;              // version bits being handed out
+    uint32_t ntime_roll;                // ntime roll being handed out
+    uint64_t units_issued;
+    uint64_t nonces_issued;
+    uint32_t version_rolls;
+    uint32_t extranonce2_rolls;
+    uint32_t ntime_rolls;
+    uint32_t exhausted;
+    uint32_t overlapping_claims;        // claims overlapping an earlier one; 0 unless work is duplicated
+    uint32_t repeated_headers;          // headers hashed twice under another index; 0 unless work is duplicated
+    uint32_t workers_joined;            // workers hashing this job
+    uint32_t first_hash_us;             // notify to the first worker hashing, 0 before it
+    uint32_t switch_us;                 // this job's switch latency, 0 while workers are missing
+    uint32_t max_switch_us;
+} nonce_space_stats_t;
+
+// Per-worker claim size: sized from the worker's own hash rate so one claim
+// takes about target_ms, which bounds how long a worker keeps hashing a
+// replaced job. Faster workers claim more per trip to the shared cursor.
+typedef struct {
+    uint32_t size;                      // nonces of the next claim
+    uint32_t hps;                       // smoothed hash rate, 0 before the first sample
+} nonce_chunk_tuner_t;
+
+void nonce_space_init(nonce_space_t *space, uint32_t unit_size);
+void nonce_space_set_workers(nonce_space_t *space, uint32_t workers);
+// Starts a job at now_us, the time its mining.notify arrived: new generation,
+// position back to (0, 0).
+// extranonce2_size is StratumState::extranonce2_size; <= 0 means the pool
+// gave none. version_mask is the negotiated version-rolling mask, 0 when the
+// pool allows none; at most NONCE_SPACE_MAX_VERSION_BITS of its lowest bits
+// are rolled. ntime_roll_limit is the most ntime passes after the first,
+// each started once the rest of the space is used, 0 for none.
+void nonce_space_begin_job(nonce_space_t *space, int extranonce2_size, uint32_t version_mask,
+                           uint32_t ntime_roll_limit, uint32_t now_us);
+// Claims up to count nonces of the current job (less at the end of a
+// header); false once the job's whole (ntime, extranonce2, version, nonce)
+// space is handed out, or before the first job
+bool nonce_space_claim(nonce_space_t *space, uint32_t count, nonce_unit_t *unit);
+// nonce_space_claim of unit_size nonces
+bool nonce_space_next(nonce_space_t *space, nonce_unit_t *unit);
+// Worker is about to hash its first unit of generation; the last of the
+// workers to do so completes the job switch
+void nonce_space_note_start(nonce_space_t *space, uint32_t worker, uint32_t generation, uint32_t now_us);
+uint32_t nonce_space_generation(const nonce_space_t *space);
+// Generation the next nonce_space_begin_job starts, for publishing a job
+// under it before any unit of it can be claimed
+uint32_t nonce_space_next_generation(const nonce_space_t *space);
+// Claim cursor of generation as (header index << 32) | nonce, 0 once it is
+// replaced
+uint64_t nonce_space_cursor(const nonce_space_t *space, uint32_t generation);
+// The header fields of header index header in generation, as a claim there
+// would give them, with an empty nonce range; false for a replaced
+// generation or past the end of the space
+bool nonce_space_header_unit(const nonce_space_t *space, uint32_t generation, uint32_t header,
+                             nonce_unit_t *unit);
+
+// extranonce2 as the big-endian bytes of the job's extranonce2_size, the
+// form hashed into the coinbase; returns the byte count, 0 if out is short
+size_t nonce_space_extranonce2_bytes(const nonce_space_t *space, uint64_t extranonce2, uint8_t *out,
+                                     size_t out_size);
+// Lower-case hex of extranonce2 padded to the job's extranonce2_size, the
+// form mining.submit expects; out needs 2 * size + 1 bytes
+void nonce_space_format_extranonce2(const nonce_space_t *space, uint64_t extranonce2, char *out, size_t out_size);
+
+// Counters of the current job
+void nonce_space_get_stats(const nonce_space_t *space, nonce_space_stats_t *stats);
+
+void nonce_chunk_init(nonce_chunk_tuner_t *tuner, uint32_t size);
+// Feeds one finished claim (hashed nonces in elapsed_us) and returns the
+// next claim size: target_ms of work at the smoothed rate, a multiple of
+// NONCE_CHUNK_MIN within [NONCE_CHUNK_MIN, NONCE_CHUNK_MAX]
+uint32_t nonce_chunk_update(nonce_chunk_tuner_t *tuner, uint32_t hashed, uint32_t elapsed_us, uint32_t target_ms);
+
+// Shared by all mining workers; the pool connection starts a job on it for
+// every accepted mining.notify
+extern nonce_space_t mining_nonce_space;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,15 +1,121 @@
 #include "pool_connection.h"
 #include "configs.h"
 #include "webconfig.h"
+#include "nonce_space.h"
+#include "job_slot.h"
+#include "share_filter.h"
+#ifndef UNIT_TEST
 #include "esp_task_wdt.h"
+#endif
 #include <ArduinoJson.h>
 
 // Static member definitions
 WiFiClient* PoolConnection::shared_pool_client = nullptr;
 SemaphoreHandle_t PoolConnection::pool_mutex = nullptr;
 unsigned long PoolConnection::last_pool_activity = 0;
-static StratumState stratum_state = {false, false, "", 0, 1, "", {"", "", "", "", {}, 0, "", "", "", false}};
+static StratumState stratum_state = {false, false, {}, 0, 0, 1, "", {}, false, 0};
 static uint32_t message_id = 1;
+static volatile uint32_t stale_shares = 0;
+
+// Bounded hex decoder for pool fields: the byte count, or -1 for odd
+// length, a non-hex digit or more than out_size bytes
+static int decodeHex(const char* hex_str, uint8_t* out, size_t out_size) {
+    if (!hex_str) return -1;
+    size_t len = strlen(hex_str);
+    if (len % 2 != 0 || len / 2 > out_size) return -1;
+    for (size_t i = 0; i < len / 2; i++) {
+        uint8_t byte = 0;
+        for (int j = 0; j < 2; j++) {
+            char ch = hex_str[i * 2 + j];
+            uint8_t nibble;
+            if (ch >= '0' && ch <= '9') nibble = ch - '0';
+            else if (ch >= 'a' && ch <= 'f') nibble = ch - 'a' + 10;
+            else if (ch >= 'A' && ch <= 'F') nibble = ch - 'A' + 10;
+            else return -1;
+            byte = (byte << 4) | nibble;
+        }
+        out[i] = byte;
+    }
+    return (int)(len / 2);
+}
+
+static const char* skipSpace(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+// Copies the JSON string at p into out; the position after it, or NULL if it
+// is not a plain string of fewer than out_size bytes. Ids and hex fields
+// carry no escapes.
+static const char* scanString(const char* p, char* out, size_t out_size) {
+    if (*p != '"') return NULL;
+    size_t len = 0;
+    for (p++; *p != '"'; p++) {
+        if (*p == '\0' || *p == '\\' || len + 1 >= out_size) return NULL;
+        out[len++] = *p;
+    }
+    out[len] = '\0';
+    return p + 1;
+}
+
+// The position after the params value at p: a string, a flat array of
+// strings (the merkle branches) or a literal; NULL if it runs off the line
+static const char* skipValue(const char* p) {
+    if (*p == '"') {
+        p = strchr(p + 1, '"');
+        return p ? p + 1 : NULL;
+    }
+    if (*p == '[') {
+        bool in_string = false;
+        for (p++; *p != '\0'; p++) {
+            if (*p == '"') in_string = !in_string;
+            else if (*p == ']' && !in_string) return p + 1;
+        }
+        return NULL;
+    }
+    while (*p != '\0' && *p != ',' && *p != ']') p++;
+    return *p ? p : NULL;
+}
+
+// New block fast path: job id, prevhash (header order) and clean_jobs of a
+// mining.notify line, read without parsing the rest; false for any other
+// message. Only a hint: the full decode still decides whether the job is
+// accepted.
+static bool peekNotify(const char* message, char* job_id, size_t job_id_size, uint8_t* prevhash,
+                       bool* clean_jobs) {
+    if (!strstr(message, "\"mining.notify\"")) return false;
+    const char* p = strstr(message, "\"params\"");
+    if (!p) return false;
+    p = skipSpace(p + 8);
+    if (*p != ':') return false;
+    p = skipSpace(p + 1);
+    if (*p != '[') return false;
+
+    char prevhash_hex[65] = "";
+    *clean_jobs = false;
+    for (int index = 0;; index++) {
+        p = skipSpace(p + 1);
+        if (index == 0) {
+            p = scanString(p, job_id, job_id_size);
+        } else if (index == 1) {
+            p = scanString(p, prevhash_hex, sizeof(prevhash_hex));
+        } else {
+            if (index == 8) *clean_jobs = strncmp(p, "true", 4) == 0;
+            p = skipValue(p);
+        }
+        if (!p) return false;
+        p = skipSpace(p);
+        if (*p == ']') break;
+        if (*p != ',') return false;
+    }
+
+    uint8_t bytes[32];
+    if (decodeHex(prevhash_hex, bytes, sizeof(bytes)) != 32) return false;
+    for (int i = 0; i < 32; i++) {
+        prevhash[i] = bytes[31 - i];
+    }
+    return true;
+}
 
 bool PoolConnection::initialize() {
     // Create mutex for thread-safe access
@@ -207,16 +313,26 @@ bool PoolConnection::performStratumHandshake() {
     // Reset stratum state
     stratum_state.subscribed = false;
     stratum_state.authorized = false;
-    stratum_state.extranonce1 = "";
+    stratum_state.extranonce1_len = 0;
     stratum_state.extranonce2_size = 0;
     stratum_state.difficulty = 1;
     stratum_state.session_id = "";
+    stratum_state.version_rolling = false;
+    stratum_state.version_mask = 0;
     message_id = 1;
+    // Shares of the old session's jobs would carry the wrong extranonce1
+    job_slot_retire_all(&mining_job_slot);
+    share_filter_clear(&mining_share_filter);
 
     if (VERBOSE) {
         Serial.println("Pool: Starting Stratum handshake...");
     }
 
+    // Step 0: Negotiate version rolling; mining continues without it
+    if (!configureVersionRolling()) {
+        if (VERBOSE) Serial.println("Pool: Version rolling not available");
+    }
+
     // Step 1: Subscribe
     if (!subscribeToPool()) {
         if (DEBUG) Serial.println("Pool: Subscribe failed");
@@ -236,6 +352,66 @@ bool PoolConnection::performStratumHandshake() {
     return true;
 }
 
+bool PoolConnection::configureVersionRolling() {
+    if (VERSION_ROLLING_MASK == 0) return false;
+
+    uint32_t configure_id = message_id++;
+    char configure_message[256];
+    snprintf(configure_message, sizeof(configure_message),
+             "{\"id\": %u, \"method\": \"mining.configure\", \"params\": [[\"version-rolling\"], "
+             "{\"version-rolling.mask\": \"%08x\", \"version-rolling.min-bit-count\": %d}]}\n",
+             configure_id, (uint32_t)VERSION_ROLLING_MASK, VERSION_ROLLING_MIN_BITS);
+
+    if (!sendMessage(configure_message)) {
+        return false;
+    }
+
+    // Pools without BIP310 answer with an error or not at all; anything else
+    // arriving meanwhile is handled as usual
+    unsigned long start = millis();
+    while (millis() - start < VERSION_ROLLING_TIMEOUT_MS) {
+        String response = readResponse(VERSION_ROLLING_TIMEOUT_MS - (millis() - start));
+        if (response.length() == 0) break;
+
+        StaticJsonDocument<512> doc;
+        DeserializationError error = deserializeJson(doc, response);
+        if (error) {
+            if (DEBUG) Serial.printf("Pool: JSON parse error in configure: %s\n", error.c_str());
+            return false;
+        }
+
+        if (doc["id"].isNull() || doc["id"].as<uint32_t>() != configure_id) {
+            processStratumMessage(response);
+            continue;
+        }
+
+        if (doc.containsKey("error") && !doc["error"].isNull()) {
+            if (DEBUG) Serial.printf("Pool: Configure error: %s\n", doc["error"].as<String>().c_str());
+            return false;
+        }
+
+        JsonObject result = doc["result"];
+        if (result.isNull() || !result["version-rolling"].as<bool>()) {
+            return false;
+        }
+
+        // Only bits both sides allow are rolled
+        String pool_mask = result["version-rolling.mask"].as<String>();
+        uint32_t mask = (uint32_t)strtoul(pool_mask.c_str(), NULL, 16) & VERSION_ROLLING_MASK;
+        if (mask == 0) return false;
+
+        stratum_state.version_rolling = true;
+        stratum_state.version_mask = mask;
+        if (VERBOSE) {
+            Serial.printf("Pool: Version rolling enabled, mask %08x\n", mask);
+        }
+        return true;
+    }
+
+    if (DEBUG) Serial.println("Pool: No response to configure");
+    return false;
+}
+
 bool PoolConnection::subscribeToPool() {
     char subscribe_message[256];
     snprintf(subscribe_message, sizeof(subscribe_message),
@@ -271,13 +447,19 @@ bool PoolConnection::subscribeToPool() {
     if (doc.containsKey("result") && doc["result"].is<JsonArray>()) {
         JsonArray result = doc["result"];
         if (result.size() >= 3) {
-            stratum_state.extranonce1 = result[1].as<String>();
+            const char* extranonce1 = result[1].as<const char*>();
+            int extranonce1_len = decodeHex(extranonce1, stratum_state.extranonce1, MAX_EXTRANONCE1_BYTES);
+            if (extranonce1_len < 0) {
+                if (DEBUG) Serial.println("Pool: Invalid extranonce1");
+                return false;
+            }
+            stratum_state.extranonce1_len = extranonce1_len;
             stratum_state.extranonce2_size = result[2].as<int>();
             stratum_state.subscribed = true;
 
             if (VERBOSE) {
                 Serial.printf("Pool: Subscribed - extranonce1: %s, extranonce2_size: %d\n",
-                             stratum_state.extranonce1.c_str(), stratum_state.extranonce2_size);
+                             extranonce1, stratum_state.extranonce2_size);
             }
         }
     }
@@ -329,11 +511,30 @@ bool PoolConnection::authorizeWorker() {
 
 bool PoolConnection::processStratumMessage(const String& message) {
     if (message.length() == 0) return false;
-
-    StaticJsonDocument<2048> doc;
+    uint32_t received_us = micros();
+
+    // A new block makes all current work stale: workers are told to stop
+    // before the notify is parsed and decoded
+    char job_id[MAX_JOB_ID_LEN + 1];
+    uint8_t prevhash[32];
+    bool clean_jobs;
+    bool aborted = false;
+    uint32_t valid_from = 0;  // before the abort, restored if the notify is refused
+    if (peekNotify(message.c_str(), job_id, sizeof(job_id), prevhash, &clean_jobs) &&
+        stratum_state.current_job.job_id[0] != '\0' &&
+        (clean_jobs || memcmp(prevhash, stratum_state.current_job.prevhash, 32) != 0)) {
+        valid_from = job_slot_abort(&mining_job_slot, nonce_space_next_generation(&mining_nonce_space), received_us);
+        aborted = true;
+        if (VERBOSE) Serial.printf("Pool: New block with job %s, aborting work\n", job_id);
+    }
+
+    // Sized for a mining.notify at the job bounds; on the heap, where it is
+    // released before the next message, not on the worker's stack
+    DynamicJsonDocument doc(STRATUM_JSON_SIZE);
     DeserializationError error = deserializeJson(doc, message);
     if (error) {
         if (DEBUG) Serial.printf("Pool: JSON parse error: %s\n", error.c_str());
+        if (aborted) job_slot_abort_cancel(&mining_job_slot, valid_from);
         return false;
     }
 
@@ -342,9 +543,20 @@ bool PoolConnection::processStratumMessage(const String& message) {
         String method = doc["method"].as<String>();
 
         if (method == "mining.notify") {
-            if (doc.containsKey("params")) {
-                return handleMiningNotify(doc["params"].as<String>());
+            bool accepted = false;
+            if (!doc["params"].is<JsonArray>()) {
+                if (DEBUG) Serial.println("Pool: mining.notify params not an array");
+            } else {
+                // Decoded straight from this document: no second parse
+                accepted = handleMiningNotify(doc["params"].as<JsonArray>(), received_us);
+            }
+            // No new job to switch to: the current one is mined on rather
+            // than every worker idling until the next notify
+            if (!accepted && aborted) {
+                job_slot_abort_cancel(&mining_job_slot, valid_from);
+                if (VERBOSE) Serial.printf("Pool: Job %s refused, resuming work\n", job_id);
             }
+            return accepted;
         } else if (method == "mining.set_difficulty") {
             if (doc.containsKey("params") && doc["params"].is<JsonArray>()) {
                 JsonArray params = doc["params"];
@@ -355,80 +567,167 @@ bool PoolConnection::processStratumMessage(const String& message) {
                     }
                 }
             }
+        } else if (method == "mining.set_version_mask") {
+            // Takes effect with the next mining.notify
+            if (stratum_state.version_rolling && doc["params"].is<JsonArray>()) {
+                JsonArray params = doc["params"];
+                if (params.size() > 0) {
+                    String mask = params[0].as<String>();
+                    stratum_state.version_mask = (uint32_t)strtoul(mask.c_str(), NULL, 16) & VERSION_ROLLING_MASK;
+                    if (VERBOSE) {
+                        Serial.printf("Pool: Version mask set to %08x\n", stratum_state.version_mask);
+                    }
+                }
+            }
         }
     }
 
     return true;
 }
 
-bool PoolConnection::handleMiningNotify(const String& params) {
-    StaticJsonDocument<2048> doc;
-    DeserializationError error = deserializeJson(doc, params);
-    if (error) {
-        if (DEBUG) Serial.printf("Pool: JSON parse error in mining.notify: %s\n", error.c_str());
+// Parts of job that differ from prev; pools often resend a job with only a
+// new ntime or job id
+static uint8_t jobChanges(const StratumJob& job, const StratumJob& prev) {
+    if (prev.job_id[0] == '\0') return JOB_CHANGED_ALL;
+    uint8_t changes = 0;
+    if (memcmp(job.prevhash, prev.prevhash, 32) != 0) changes |= JOB_CHANGED_PREVHASH;
+    if (job.coinb1_len != prev.coinb1_len || job.coinb2_len != prev.coinb2_len ||
+        memcmp(job.coinb1, prev.coinb1, job.coinb1_len) != 0 || memcmp(job.coinb2, prev.coinb2, job.coinb2_len) != 0) {
+        changes |= JOB_CHANGED_COINBASE;
+    }
+    if (job.merkle_count != prev.merkle_count ||
+        memcmp(job.merkle_branch, prev.merkle_branch, job.merkle_count * 32) != 0) {
+        changes |= JOB_CHANGED_MERKLE;
+    }
+    if (job.version != prev.version || job.nbits != prev.nbits) changes |= JOB_CHANGED_HEADER;
+    if (job.ntime != prev.ntime) changes |= JOB_CHANGED_NTIME;
+    return changes;
+}
+
+bool PoolConnection::handleMiningNotify(JsonArray job_params, uint32_t received_us) {
+    if (job_params.size() < 8) {
+        if (DEBUG) Serial.println("Pool: mining.notify insufficient parameters");
         return false;
     }
 
-    if (!doc.is<JsonArray>()) {
-        if (DEBUG) Serial.println("Pool: mining.notify params not an array");
+    // Decode into a scratch job so a refused notify leaves the current one
+    // intact; static to keep its ~2 KB off the caller's stack
+    static StratumJob job;
+    memset(&job, 0, sizeof(job));
+
+    const char* job_id = job_params[0].as<const char*>();
+    if (!job_id || strlen(job_id) == 0 || strlen(job_id) > MAX_JOB_ID_LEN) {
+        if (DEBUG) Serial.println("Pool: mining.notify invalid job id");
         return false;
     }
+    strncpy(job.job_id, job_id, MAX_JOB_ID_LEN);
 
-    JsonArray job_params = doc.as<JsonArray>();
-    if (job_params.size() < 8) {
-        if (DEBUG) Serial.println("Pool: mining.notify insufficient parameters");
+    uint8_t prevhash[32];
+    if (decodeHex(job_params[1].as<const char*>(), prevhash, sizeof(prevhash)) != 32) {
+        if (DEBUG) Serial.println("Pool: mining.notify invalid prevhash");
         return false;
     }
+    for (int i = 0; i < 32; i++) {
+        job.prevhash[i] = prevhash[31 - i];
+    }
 
-    // Parse job parameters
-    stratum_state.current_job.job_id = job_params[0].as<String>();
-    stratum_state.current_job.prevhash = job_params[1].as<String>();
-    stratum_state.current_job.coinb1 = job_params[2].as<String>();
-    stratum_state.current_job.coinb2 = job_params[3].as<String>();
+    int coinb1_len = decodeHex(job_params[2].as<const char*>(), job.coinb1, MAX_COINB1_BYTES);
+    int coinb2_len = decodeHex(job_params[3].as<const char*>(), job.coinb2, MAX_COINB2_BYTES);
+    if (coinb1_len < 0 || coinb2_len < 0) {
+        if (DEBUG) Serial.println("Pool: mining.notify coinbase invalid or too large");
+        return false;
+    }
+    job.coinb1_len = coinb1_len;
+    job.coinb2_len = coinb2_len;
 
     // Parse merkle branch
     if (job_params[4].is<JsonArray>()) {
         JsonArray merkle = job_params[4];
-        stratum_state.current_job.merkle_count = min((int)merkle.size(), 16);
-        for (int i = 0; i < stratum_state.current_job.merkle_count; i++) {
-            stratum_state.current_job.merkle_branch[i] = merkle[i].as<String>();
+        if (merkle.size() > MAX_MERKLE_BRANCHES) {
+            if (DEBUG) Serial.printf("Pool: mining.notify has %d merkle branches\n", (int)merkle.size());
+            return false;
+        }
+        job.merkle_count = merkle.size();
+        for (int i = 0; i < job.merkle_count; i++) {
+            if (decodeHex(merkle[i].as<const char*>(), job.merkle_branch[i], 32) != 32) {
+                if (DEBUG) Serial.println("Pool: mining.notify invalid merkle branch");
+                return false;
+            }
         }
     }
 
-    stratum_state.current_job.version = job_params[5].as<String>();
-    stratum_state.current_job.nbits = job_params[6].as<String>();
-    stratum_state.current_job.ntime = job_params[7].as<String>();
+    const char* version = job_params[5].as<const char*>();
+    const char* nbits = job_params[6].as<const char*>();
+    const char* ntime = job_params[7].as<const char*>();
+    if (!version || !nbits || !ntime) {
+        if (DEBUG) Serial.println("Pool: mining.notify missing header fields");
+        return false;
+    }
+    job.version = strtoul(version, NULL, 16);
+    job.nbits = strtoul(nbits, NULL, 16);
+    job.ntime = strtoul(ntime, NULL, 16);
 
     if (job_params.size() > 8) {
-        stratum_state.current_job.clean_jobs = job_params[8].as<bool>();
+        job.clean_jobs = job_params[8].as<bool>();
     }
+    job.received_ms = millis();
+    job.changes = jobChanges(job, stratum_state.current_job);
+    stratum_state.current_job = job;
+
+    // Workers copy the job from the slot; it is published before the nonce
+    // space starts, so no unit of the job is claimed without it. Shares of
+    // jobs still in the history stay deduplicated until they are retired.
+    if (job_slot_publish(&mining_job_slot, &stratum_state, nonce_space_next_generation(&mining_nonce_space))) {
+        share_filter_clear(&mining_share_filter);
+    }
+
+    // Workers claim (ntime, extranonce2, version, nonce) units of the new job
+    // from zero. The prep task builds its first header from the slot; this
+    // task may be a mining worker's.
+    nonce_space_begin_job(&mining_nonce_space, stratum_state.extranonce2_size,
+                          stratum_state.version_rolling ? stratum_state.version_mask : 0,
+                          NTIME_ROLL_PASSES, received_us);
 
     if (VERBOSE) {
-        Serial.printf("Pool: New job %s received, difficulty %u\n",
-                     stratum_state.current_job.job_id.c_str(), stratum_state.difficulty);
+        Serial.printf("Pool: New job %s received, difficulty %u, changes %02x\n",
+                     stratum_state.current_job.job_id, stratum_state.difficulty, stratum_state.current_job.changes);
     }
 
     return true;
 }
 
-bool PoolConnection::submitStratumShare(uint32_t nonce, const String& extranonce2, const String& ntime) {
-    if (!stratum_state.subscribed || !stratum_state.authorized || stratum_state.current_job.job_id.isEmpty()) {
+bool PoolConnection::submitStratumShare(const StratumShare& share) {
+    if (!stratum_state.subscribed || !stratum_state.authorized) {
         if (DEBUG) Serial.println("Pool: Cannot submit share - not ready");
         return false;
     }
 
+    // The id of the job the share was hashed for, which may be older than
+    // the current one; a retired job's share would only come back rejected
+    char job_id[MAX_JOB_ID_LEN + 1];
+    if (!job_slot_lookup(&mining_job_slot, share.job, job_id, sizeof(job_id))) {
+        __atomic_fetch_add(&stale_shares, 1, __ATOMIC_RELAXED);
+        if (VERBOSE) Serial.printf("Pool: Dropped share of retired job, nonce: %08x\n", share.nonce);
+        return false;
+    }
+
+    // With version rolling the rolled bits go out as the sixth parameter
+    char version_param[16] = "";
+    if (stratum_state.version_rolling) {
+        snprintf(version_param, sizeof(version_param), ", \"%08x\"", share.version_bits);
+    }
+
     char share_message[512];
     snprintf(share_message, sizeof(share_message),
-             "{\"id\": %u, \"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%08x\"]}\n",
-             message_id++, config.btc_address, stratum_state.current_job.job_id.c_str(),
-             extranonce2.c_str(), ntime.c_str(), nonce);
+             "{\"id\": %u, \"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%08x\", \"%08x\"%s]}\n",
+             message_id++, config.btc_address, job_id, share.extranonce2, share.ntime, share.nonce, version_param);
 
     if (!sendMessage(share_message)) {
         return false;
     }
 
     if (VERBOSE) {
-        Serial.printf("Pool: Submitted share - nonce: %08x\n", nonce);
+        Serial.printf("Pool: Submitted share for job %s - nonce: %08x\n", job_id, share.nonce);
     }
 
     return true;
@@ -439,13 +738,21 @@ StratumState* PoolConnection::getStratumState() {
 }
 
 bool PoolConnection::hasValidJob() {
-    return stratum_state.subscribed && stratum_state.authorized && !stratum_state.current_job.job_id.isEmpty();
+    return stratum_state.subscribed && stratum_state.authorized && stratum_state.current_job.job_id[0] != '\0';
 }
 
 String PoolConnection::getCurrentJobId() {
-    return stratum_state.current_job.job_id;
+    // Called from every task, so read through the slot rather than from the
+    // job a notify may be replacing
+    char job_id[MAX_JOB_ID_LEN + 1];
+    job_slot_read_id(&mining_job_slot, job_id, sizeof(job_id));
+    return String(job_id);
 }
 
 uint32_t PoolConnection::getCurrentDifficulty() {
     return stratum_state.difficulty;
+}
+
+uint32_t PoolConnection::getStaleShares() {
+    return __atomic_load_n(&stale_shares, __ATOMIC_RELAXED);
 }
\ No newline at end of file
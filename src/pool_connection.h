@@ -1,10 +1,16 @@
 #ifndef POOL_CONNECTION_H
 #define POOL_CONNECTION_H
 
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
 #include <Arduino.h>
 #include <WiFi.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#endif
+#include <ArduinoJson.h>
+#include "nonce_space.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,28 +19,62 @@ extern "C" {
 // Connection constants
 #define CONNECTION_TIMEOUT 300000 // 5 minutes
 
-// Stratum protocol structures
+// Job bounds; a mining.notify beyond them is refused rather than truncated
+#define MAX_JOB_ID_LEN 64
+#define MAX_EXTRANONCE1_BYTES 16
+#define MAX_COINB1_BYTES 256
+#define MAX_COINB2_BYTES 512
+#define MAX_MERKLE_BRANCHES 32     // 2^32 transactions per block
+#define STRATUM_JSON_SIZE 6144     // JSON document for a mining.notify at these bounds
+
+// StratumJob::changes, parts that differ from the job it replaced
+#define JOB_CHANGED_PREVHASH 0x01
+#define JOB_CHANGED_COINBASE 0x02  // coinb1 or coinb2
+#define JOB_CHANGED_MERKLE 0x04
+#define JOB_CHANGED_HEADER 0x08    // version or nbits
+#define JOB_CHANGED_NTIME 0x10
+#define JOB_CHANGED_ALL 0x1f
+
+// Stratum job, decoded once from mining.notify into bytes and words so that
+// building headers from it needs no parsing and no heap
 struct StratumJob {
-    String job_id;
-    String prevhash;
-    String coinb1;
-    String coinb2;
-    String merkle_branch[16];
+    char job_id[MAX_JOB_ID_LEN + 1];
+    uint8_t prevhash[32];          // in header byte order
+    uint8_t coinb1[MAX_COINB1_BYTES];
+    uint16_t coinb1_len;
+    uint8_t coinb2[MAX_COINB2_BYTES];
+    uint16_t coinb2_len;
+    uint8_t merkle_branch[MAX_MERKLE_BRANCHES][32];
     int merkle_count;
-    String version;
-    String nbits;
-    String ntime;
+    uint32_t version;
+    uint32_t nbits;
+    uint32_t ntime;
     bool clean_jobs;
+    unsigned long received_ms;  // millis() at mining.notify, where ntime rolling starts
+    uint8_t changes;            // JOB_CHANGED_* against the previous job
+};
+
+// A share as it was hashed: the job it belongs to and the rolled header
+// fields, so it goes out for that job whatever was notified since
+struct StratumShare {
+    uint32_t job;                  // job handle: generation of the work unit
+    uint32_t nonce;
+    uint32_t ntime;                // as rolled
+    uint32_t version_bits;         // rolled bits, 0 without version rolling
+    char extranonce2[2 * NONCE_SPACE_MAX_EXTRANONCE2_SIZE + 1];  // hex, as mining.submit expects
 };
 
 struct StratumState {
     bool subscribed;
     bool authorized;
-    String extranonce1;
+    uint8_t extranonce1[MAX_EXTRANONCE1_BYTES];
+    int extranonce1_len;
     int extranonce2_size;
     uint32_t difficulty;
     String session_id;
-    StratumJob current_job;
+    StratumJob current_job;   // owned by the task handling pool messages; workers read mining_job_slot
+    bool version_rolling;     // pool accepted BIP310 version rolling
+    uint32_t version_mask;    // header version bits miners may change, 0 without rolling
 };
 
 // Pool connection management
@@ -68,17 +108,25 @@ public:
 
     // Stratum protocol functions
     static bool performStratumHandshake();
+    static bool configureVersionRolling();
     static bool subscribeToPool();
     static bool authorizeWorker();
     static bool processStratumMessage(const String& message);
-    static bool handleMiningNotify(const String& params);
-    static bool submitStratumShare(uint32_t nonce, const String& extranonce2, const String& ntime);
+    // params of a mining.notify already parsed by processStratumMessage;
+    // received_us is micros() when the notify line arrived, where job switch
+    // latencies start
+    static bool handleMiningNotify(JsonArray job_params, uint32_t received_us);
+    // Submits share for its own job; false, without a round-trip, when that
+    // job is retired (clean_jobs, a new session) or no longer remembered
+    static bool submitStratumShare(const StratumShare& share);
 
     // Get current Stratum state
     static StratumState* getStratumState();
     static bool hasValidJob();
     static String getCurrentJobId();
     static uint32_t getCurrentDifficulty();
+    // Shares dropped because their job was retired
+    static uint32_t getStaleShares();
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,211 @@
+#include "sha256_avx2.h"
+
+#if SHA256_HAVE_AVX2
+
+#include <immintrin.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define VADD(a, b) _mm256_add_epi32((a), (b))
+#define VXOR(a, b) _mm256_xor_si256((a), (b))
+#define VAND(a, b) _mm256_and_si256((a), (b))
+#define VOR(a, b) _mm256_or_si256((a), (b))
+#define VSET(x) _mm256_set1_epi32((int)(x))
+#define VROR(x, n) VOR(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define VSHR(x, n) _mm256_srli_epi32((x), (n))
+
+#define VCH(x, y, z) VXOR(VAND((x), VXOR((y), (z))), (z))
+#define VMAJ(x, y, z) VOR(VAND((x), (y)), VAND((z), VOR((x), (y))))
+#define VEP0(x) VXOR(VXOR(VROR(x, 2), VROR(x, 13)), VROR(x, 22))
+#define VEP1(x) VXOR(VXOR(VROR(x, 6), VROR(x, 11)), VROR(x, 25))
+#define VSIG0(x) VXOR(VXOR(VROR(x, 7), VROR(x, 18)), VSHR(x, 3))
+#define VSIG1(x) VXOR(VXOR(VROR(x, 17), VROR(x, 19)), VSHR(x, 10))
+
+// Scalar versions for the broadcast constants
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SIG0(x) (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+
+// One round with kw = K[i] + W[i]; the caller rotates the variable roles
+#define VROUND(a, b, c, d, e, f, g, h, kw) do { \
+    __m256i t1 = VADD(VADD(h, VEP1(e)), VADD(VCH(e, f, g), (kw))); \
+    __m256i t2 = VADD(VEP0(a), VMAJ(a, b, c)); \
+    d = VADD(d, t1); \
+    h = VADD(t1, t2); \
+} while (0)
+
+// T1-only round: the new a (written to h) is never read before the H7 check
+#define VROUND_E(a, b, c, d, e, f, g, h, kw) do { \
+    __m256i t1 = VADD(VADD(h, VEP1(e)), VADD(VCH(e, f, g), (kw))); \
+    d = VADD(d, t1); \
+} while (0)
+
+#define VROUND8(i, W) do { \
+    VROUND(a, b, c, d, e, f, g, h, VADD(VSET(sha256_k[(i) + 0]), (W)[(i) + 0])); \
+    VROUND(h, a, b, c, d, e, f, g, VADD(VSET(sha256_k[(i) + 1]), (W)[(i) + 1])); \
+    VROUND(g, h, a, b, c, d, e, f, VADD(VSET(sha256_k[(i) + 2]), (W)[(i) + 2])); \
+    VROUND(f, g, h, a, b, c, d, e, VADD(VSET(sha256_k[(i) + 3]), (W)[(i) + 3])); \
+    VROUND(e, f, g, h, a, b, c, d, VADD(VSET(sha256_k[(i) + 4]), (W)[(i) + 4])); \
+    VROUND(d, e, f, g, h, a, b, c, VADD(VSET(sha256_k[(i) + 5]), (W)[(i) + 5])); \
+    VROUND(c, d, e, f, g, h, a, b, VADD(VSET(sha256_k[(i) + 6]), (W)[(i) + 6])); \
+    VROUND(b, c, d, e, f, g, h, a, VADD(VSET(sha256_k[(i) + 7]), (W)[(i) + 7])); \
+} while (0)
+
+#define VSCHED(W, i) \
+    (W)[i] = VADD(VADD(VSIG1((W)[(i) - 2]), (W)[(i) - 7]), VADD(VSIG0((W)[(i) - 15]), (W)[(i) - 16]))
+
+bool sha256_avx2_available(void) {
+    static int available = -1;
+    if (available < 0) {
+        __builtin_cpu_init();
+        available = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return available == 1;
+}
+
+// Returns a lane bitmask of nonces whose H7 passes the target filter
+AVX2_TARGET static inline uint32_t sha256d_avx2_8way(const sha256d_job_t *job, __m256i n, uint32_t h7_mask) {
+    __m256i W[64];
+    __m256i a, b, c, d, e, f, g, h;
+
+    // First block: tail words, nonce, padding (see sha256d_job_init)
+    W[16] = VSET(job->w16);
+    W[17] = VSET(job->w17);
+    W[18] = VADD(VSET(job->w18_part), VSIG0(n));
+    W[19] = VADD(VSET(job->w19_part), n);
+    W[20] = VADD(VSIG1(W[18]), VSET(0x80000000));
+    W[21] = VSIG1(W[19]);
+    W[22] = VADD(VSIG1(W[20]), VSET(0x00000280));
+    W[23] = VADD(VSIG1(W[21]), W[16]);
+    W[24] = VADD(VSIG1(W[22]), W[17]);
+    W[25] = VADD(VSIG1(W[23]), W[18]);
+    W[26] = VADD(VSIG1(W[24]), W[19]);
+    W[27] = VADD(VSIG1(W[25]), W[20]);
+    W[28] = VADD(VSIG1(W[26]), W[21]);
+    W[29] = VADD(VSIG1(W[27]), W[22]);
+    W[30] = VADD(VADD(VSIG1(W[28]), W[23]), VSET(SIG0(0x00000280u)));
+    W[31] = VADD(VADD(VSIG1(W[29]), W[24]), VADD(VSIG0(W[16]), VSET(0x00000280)));
+    W[32] = VADD(VADD(VSIG1(W[30]), W[25]), VADD(VSIG0(W[17]), W[16]));
+    for (int i = 33; i < 64; i++) VSCHED(W, i);
+
+    __m256i t1 = VADD(VSET(job->r3_t1), n);
+    a = VADD(t1, VSET(job->r3_t2));
+    b = VSET(job->state3[0]); c = VSET(job->state3[1]); d = VSET(job->state3[2]);
+    e = VADD(VSET(job->state3[3]), t1);
+    f = VSET(job->state3[4]); g = VSET(job->state3[5]); h = VSET(job->state3[6]);
+
+    // Rounds 4..15 only see constant message words
+    VROUND(a, b, c, d, e, f, g, h, VSET(sha256_k[4] + 0x80000000));
+    VROUND(h, a, b, c, d, e, f, g, VSET(sha256_k[5]));
+    VROUND(g, h, a, b, c, d, e, f, VSET(sha256_k[6]));
+    VROUND(f, g, h, a, b, c, d, e, VSET(sha256_k[7]));
+    VROUND(e, f, g, h, a, b, c, d, VSET(sha256_k[8]));
+    VROUND(d, e, f, g, h, a, b, c, VSET(sha256_k[9]));
+    VROUND(c, d, e, f, g, h, a, b, VSET(sha256_k[10]));
+    VROUND(b, c, d, e, f, g, h, a, VSET(sha256_k[11]));
+    VROUND(a, b, c, d, e, f, g, h, VSET(sha256_k[12]));
+    VROUND(h, a, b, c, d, e, f, g, VSET(sha256_k[13]));
+    VROUND(g, h, a, b, c, d, e, f, VSET(sha256_k[14]));
+    VROUND(f, g, h, a, b, c, d, e, VSET(sha256_k[15] + 0x00000280));
+    // Twelve rounds leave the roles rotated by four; rename back so the
+    // unrolled groups below start from a
+    {
+        __m256i ta = e, tb = f, tc = g, td = h;
+        e = a; f = b; g = c; h = d;
+        a = ta; b = tb; c = tc; d = td;
+    }
+    for (int i = 16; i < 64; i += 8) VROUND8(i, W);
+
+    // First digest becomes the second block message W0..W7
+    W[0] = VADD(a, VSET(job->midstate[0]));
+    W[1] = VADD(b, VSET(job->midstate[1]));
+    W[2] = VADD(c, VSET(job->midstate[2]));
+    W[3] = VADD(d, VSET(job->midstate[3]));
+    W[4] = VADD(e, VSET(job->midstate[4]));
+    W[5] = VADD(f, VSET(job->midstate[5]));
+    W[6] = VADD(g, VSET(job->midstate[6]));
+    W[7] = VADD(h, VSET(job->midstate[7]));
+
+    // Second block: W8 = 0x80000000, W9..W14 = 0, W15 = 256
+    W[16] = VADD(VSIG0(W[1]), W[0]);
+    W[17] = VADD(VSET(0x00A00000), VADD(VSIG0(W[2]), W[1]));  // SIG1(256) = 0x00A00000
+    W[18] = VADD(VSIG1(W[16]), VADD(VSIG0(W[3]), W[2]));
+    W[19] = VADD(VSIG1(W[17]), VADD(VSIG0(W[4]), W[3]));
+    W[20] = VADD(VSIG1(W[18]), VADD(VSIG0(W[5]), W[4]));
+    W[21] = VADD(VSIG1(W[19]), VADD(VSIG0(W[6]), W[5]));
+    W[22] = VADD(VADD(VSIG1(W[20]), VSET(0x00000100)), VADD(VSIG0(W[7]), W[6]));
+    W[23] = VADD(VADD(VSIG1(W[21]), W[16]), VADD(VSET(SIG0(0x80000000)), W[7]));
+    W[24] = VADD(VADD(VSIG1(W[22]), W[17]), VSET(0x80000000));
+    W[25] = VADD(VSIG1(W[23]), W[18]);
+    W[26] = VADD(VSIG1(W[24]), W[19]);
+    W[27] = VADD(VSIG1(W[25]), W[20]);
+    W[28] = VADD(VSIG1(W[26]), W[21]);
+    W[29] = VADD(VSIG1(W[27]), W[22]);
+    W[30] = VADD(VADD(VSIG1(W[28]), W[23]), VSET(SIG0(0x00000100u)));
+    W[31] = VADD(VADD(VSIG1(W[29]), W[24]), VADD(VSIG0(W[16]), VSET(0x00000100)));
+    for (int i = 32; i < 61; i++) VSCHED(W, i);
+
+    a = VSET(sha256_h0[0]); b = VSET(sha256_h0[1]); c = VSET(sha256_h0[2]); d = VSET(sha256_h0[3]);
+    e = VSET(sha256_h0[4]); f = VSET(sha256_h0[5]); g = VSET(sha256_h0[6]); h = VSET(sha256_h0[7]);
+
+    VROUND8(0, W);
+    VROUND(a, b, c, d, e, f, g, h, VSET(sha256_k[8] + 0x80000000));
+    VROUND(h, a, b, c, d, e, f, g, VSET(sha256_k[9]));
+    VROUND(g, h, a, b, c, d, e, f, VSET(sha256_k[10]));
+    VROUND(f, g, h, a, b, c, d, e, VSET(sha256_k[11]));
+    VROUND(e, f, g, h, a, b, c, d, VSET(sha256_k[12]));
+    VROUND(d, e, f, g, h, a, b, c, VSET(sha256_k[13]));
+    VROUND(c, d, e, f, g, h, a, b, VSET(sha256_k[14]));
+    VROUND(b, c, d, e, f, g, h, a, VSET(sha256_k[15] + 0x00000100));
+    VROUND8(16, W);
+    VROUND8(24, W);
+    VROUND8(32, W);
+    VROUND8(40, W);
+    VROUND8(48, W);
+    // Round 56 in full, then T1-only rounds 57..60. Final H7 is e after
+    // round 60, which the role rotation leaves in h.
+    VROUND(a, b, c, d, e, f, g, h, VADD(VSET(sha256_k[56]), W[56]));
+    VROUND_E(h, a, b, c, d, e, f, g, VADD(VSET(sha256_k[57]), W[57]));
+    VROUND_E(g, h, a, b, c, d, e, f, VADD(VSET(sha256_k[58]), W[58]));
+    VROUND_E(f, g, h, a, b, c, d, e, VADD(VSET(sha256_k[59]), W[59]));
+    VROUND_E(e, f, g, h, a, b, c, d, VADD(VSET(sha256_k[60]), W[60]));
+
+    __m256i h7 = VADD(h, VSET(sha256_h0[7]));
+    __m256i rejected = VAND(h7, VSET(h7_mask));
+    __m256i hit = _mm256_cmpeq_epi32(rejected, _mm256_setzero_si256());
+    return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+}
+
+AVX2_TARGET size_t sha256d_scan_avx2(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                                     const sha256d_target_t *target, uint32_t *hits, size_t max_hits) {
+    const __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t found = 0;
+    uint32_t i = 0;
+
+    for (; i + 8 <= count && found < max_hits; i += 8) {
+        uint32_t base = nonce_start + i;
+        __m256i n = _mm256_shuffle_epi8(VADD(VSET(base), lane_offsets), bswap);
+        uint32_t lanes = sha256d_avx2_8way(job, n, target->h7_mask);
+        while (lanes && found < max_hits) {
+            int lane = __builtin_ctz(lanes);
+            hits[found++] = base + lane;
+            lanes &= lanes - 1;
+        }
+    }
+
+    // Remainder (count not a multiple of 8) goes through the scalar kernel
+    if (i < count && found < max_hits) {
+        found += sha256d_scan(job, nonce_start + i, count - i, target, hits + found, max_hits - found);
+    }
+    return found;
+}
+
+#endif
+
+sha256d_scan_fn sha256d_scan_select(void) {
+#if SHA256_HAVE_AVX2
+    if (sha256_avx2_available()) return sha256d_scan_avx2;
+#endif
+    return sha256d_scan;
+}
@@ -0,0 +1,36 @@
+#ifndef SHA256_AVX2_H
+#define SHA256_AVX2_H
+
+#include "sha256_optimized.h"
+
+// AVX2 kernels exist only in x86 host builds (test harness, host miner)
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HAVE_AVX2 1
+#else
+#define SHA256_HAVE_AVX2 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if SHA256_HAVE_AVX2
+// CPUID check for AVX2 (and OS YMM state support)
+bool sha256_avx2_available(void);
+
+// 8-lane double SHA-256 scan: eight consecutive nonces per iteration, one per
+// 32-bit lane, with the per-job precompute broadcast across lanes. Same
+// contract as sha256d_scan; must only be called when sha256_avx2_available().
+size_t sha256d_scan_avx2(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                         const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+#endif
+
+// Fastest scan kernel this CPU supports: sha256d_scan_avx2 when CPUID reports
+// AVX2, otherwise the scalar sha256d_scan (always the case on the ESP32)
+sha256d_scan_fn sha256d_scan_select(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
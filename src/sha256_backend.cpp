@@ -0,0 +1,329 @@
+#include "sha256_backend.h"
+#include "sha256_avx2.h"
+#include "sha256_shani.h"
+#include "configs.h"
+
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
+#include <Arduino.h>
+#include <Preferences.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+static const sha256_backend_t *backends[SHA256_MAX_BACKENDS];
+static size_t backend_count = 0;
+static const sha256_backend_t *worker_backends[SHA256_MAX_WORKERS];
+static size_t worker_count = 0;      // workers given a backend
+static size_t plan_workers = 0;      // workers the last selection planned for
+static volatile unsigned long backend_hashes[SHA256_MAX_BACKENDS];
+static Preferences backend_prefs;
+
+// Self-test vectors: real block headers (genesis, 100000, 125552), wire order
+static const uint8_t SELF_TEST_HEADERS[3][80] = {
+    {
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e,
+        0x67, 0x76, 0x8f, 0x61, 0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa,
+        0x4b, 0x1e, 0x5e, 0x4a, 0x29, 0xab, 0x5f, 0x49, 0xff, 0xff, 0x00, 0x1d, 0x1d, 0xac, 0x2b, 0x7c,
+    },
+    {
+        0x01, 0x00, 0x00, 0x00, 0x50, 0x12, 0x01, 0x19, 0x17, 0x2a, 0x61, 0x04, 0x21, 0xa6, 0xc3, 0x01,
+        0x1d, 0xd3, 0x30, 0xd9, 0xdf, 0x07, 0xb6, 0x36, 0x16, 0xc2, 0xcc, 0x1f, 0x1c, 0xd0, 0x02, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x66, 0x57, 0xa9, 0x25, 0x2a, 0xac, 0xd5, 0xc0, 0xb2, 0x94, 0x09, 0x96,
+        0xec, 0xff, 0x95, 0x22, 0x28, 0xc3, 0x06, 0x7c, 0xc3, 0x8d, 0x48, 0x85, 0xef, 0xb5, 0xa4, 0xac,
+        0x42, 0x47, 0xe9, 0xf3, 0x37, 0x22, 0x1b, 0x4d, 0x4c, 0x86, 0x04, 0x1b, 0x0f, 0x2b, 0x57, 0x10,
+    },
+    {
+        0x01, 0x00, 0x00, 0x00, 0x81, 0xcd, 0x02, 0xab, 0x7e, 0x56, 0x9e, 0x8b, 0xcd, 0x93, 0x17, 0xe2,
+        0xfe, 0x99, 0xf2, 0xde, 0x44, 0xd4, 0x9a, 0xb2, 0xb8, 0x85, 0x1b, 0xa4, 0xa3, 0x08, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0xe3, 0x20, 0xb6, 0xc2, 0xff, 0xfc, 0x8d, 0x75, 0x04, 0x23, 0xdb, 0x8b,
+        0x1e, 0xb9, 0x42, 0xae, 0x71, 0x0e, 0x95, 0x1e, 0xd7, 0x97, 0xf7, 0xaf, 0xfc, 0x88, 0x92, 0xb0,
+        0xf1, 0xfc, 0x12, 0x2b, 0xc7, 0xf5, 0xd7, 0x4d, 0xf2, 0xb9, 0x44, 0x1a, 0x42, 0xa1, 0x46, 0x95,
+    },
+};
+
+#define SELF_TEST_WINDOW 256    // nonces checked against the reference hash per header
+#define SELF_TEST_MAX_HITS 16
+
+static void self_test_job(int index, sha256d_job_t *job) {
+    uint32_t midstate[8];
+    sha256_compute_midstate(SELF_TEST_HEADERS[index], 64, midstate);
+    sha256d_job_init(job, midstate, SELF_TEST_HEADERS[index]);
+}
+
+bool sha256_backend_register(const sha256_backend_t *backend) {
+    if (!backend || !backend->name || !backend->scan) return false;
+    if (sha256_backend_find(backend->name)) return false;
+    if (backend_count >= SHA256_MAX_BACKENDS) return false;
+    backends[backend_count++] = backend;
+    return true;
+}
+
+void sha256_backend_register_builtin(void) {
+    static const sha256_backend_t builtin[] = {
+#if USE_HW_SHA256
+        {"hardware", sha256d_scan_hw, NULL, "sha_engine"},
+#endif
+        {"generic", sha256d_scan_generic, NULL, NULL},
+        {"specialized", sha256d_scan, NULL, NULL},
+#if SHA256_HAVE_AVX2
+        {"avx2", sha256d_scan_avx2, sha256_avx2_available, NULL},
+#endif
+#if SHA256_HAVE_SHANI
+        {"shani", sha256d_scan_shani, sha256_shani_available, NULL},
+#endif
+    };
+    for (size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++) {
+        sha256_backend_register(&builtin[i]);
+    }
+}
+
+size_t sha256_backend_count(void) {
+    return backend_count;
+}
+
+const sha256_backend_t *sha256_backend_get(size_t index) {
+    return (index < backend_count) ? backends[index] : NULL;
+}
+
+const sha256_backend_t *sha256_backend_find(const char *name) {
+    if (!name) return NULL;
+    for (size_t i = 0; i < backend_count; i++) {
+        if (strcmp(backends[i]->name, name) == 0) return backends[i];
+    }
+    return NULL;
+}
+
+bool sha256_backend_self_test(const sha256_backend_t *backend) {
+    if (!backend || !backend->scan) return false;
+
+    for (int i = 0; i < 3; i++) {
+        sha256d_job_t job;
+        self_test_job(i, &job);
+        uint32_t real_nonce;
+        memcpy(&real_nonce, SELF_TEST_HEADERS[i] + 76, 4);
+
+        // Winning nonce at 32 zero bits, from an unaligned start
+        sha256d_target_t target;
+        sha256d_target_init(&target, 4);
+        uint32_t hits[SELF_TEST_MAX_HITS];
+        size_t found = backend->scan(&job, real_nonce - 37, 64, &target, hits, SELF_TEST_MAX_HITS);
+        if (found != 1 || hits[0] != real_nonce) return false;
+
+        // 1-zero-byte hits must match the reference double hash exactly
+        sha256d_target_init(&target, 1);
+        uint32_t start = real_nonce - SELF_TEST_WINDOW / 2;
+        found = backend->scan(&job, start, SELF_TEST_WINDOW, &target, hits, SELF_TEST_MAX_HITS);
+
+        uint8_t header[80];
+        uint8_t hash[32];
+        memcpy(header, SELF_TEST_HEADERS[i], 80);
+        size_t expected = 0;
+        for (uint32_t n = 0; n < SELF_TEST_WINDOW && expected < SELF_TEST_MAX_HITS; n++) {
+            uint32_t nonce = start + n;
+            memcpy(header + 76, &nonce, 4);
+            sha256_esp32_bitcoin_hash(header, hash);
+            if (hash[31] == 0) {
+                if (expected >= found || hits[expected] != nonce) return false;
+                expected++;
+            }
+        }
+        if (expected != found) return false;
+    }
+    return true;
+}
+
+uint32_t sha256_backend_probe(const sha256_backend_t *backend) {
+    if (!backend || !backend->scan) return 0;
+
+    sha256d_job_t job;
+    self_test_job(0, &job);
+    sha256d_target_t target;
+    sha256d_target_init(&target, 4);
+    uint32_t hits[SELF_TEST_MAX_HITS];
+
+    // Short warmup so caches and lazily initialized state do not count
+    backend->scan(&job, 0, SHA256_BACKEND_PROBE_NONCES / 16, &target, hits, SELF_TEST_MAX_HITS);
+
+    unsigned long start = micros();
+    backend->scan(&job, 0, SHA256_BACKEND_PROBE_NONCES, &target, hits, SELF_TEST_MAX_HITS);
+    unsigned long elapsed = micros() - start;
+    if (elapsed == 0) elapsed = 1;
+    return (uint32_t)((uint64_t)SHA256_BACKEND_PROBE_NONCES * 1000000ULL / elapsed);
+}
+
+static bool backend_usable(const sha256_backend_t *backend) {
+    return !backend->available || backend->available();
+}
+
+static bool resource_taken(const char *resource, const sha256_backend_t *const assignment[], size_t assigned) {
+    if (!resource) return false;
+    for (size_t i = 0; i < assigned; i++) {
+        if (assignment[i]->resource && strcmp(assignment[i]->resource, resource) == 0) return true;
+    }
+    return false;
+}
+
+size_t sha256_backend_assign(const sha256_backend_t *const candidates[], const uint32_t rates[],
+                             size_t count, const sha256_backend_t *assignment[], size_t workers) {
+    size_t assigned = 0;
+    for (size_t w = 0; w < workers; w++) {
+        const sha256_backend_t *best = NULL;
+        uint32_t best_hps = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (rates[i] == 0 || resource_taken(candidates[i]->resource, assignment, assigned)) continue;
+            // On a tie keep the software kernel and leave the peripheral free
+            bool better = rates[i] > best_hps ||
+                          (rates[i] == best_hps && best && best->resource && !candidates[i]->resource);
+            if (!best || better) {
+                best = candidates[i];
+                best_hps = rates[i];
+            }
+        }
+        if (!best) break;
+        assignment[assigned++] = best;
+    }
+    for (size_t w = assigned; w < workers; w++) assignment[w] = NULL;
+    return assigned;
+}
+
+static void plan_key(size_t worker, char *key, size_t size) {
+    // Worker 0 keeps the plain "name" key: it is always the fastest backend
+    if (worker == 0) {
+        snprintf(key, size, "name");
+    } else {
+        snprintf(key, size, "name%u", (unsigned)worker);
+    }
+}
+
+// Restores the cached plan if it was made by this firmware for as many
+// workers and every backend in it still passes the self-test. An empty name
+// is a worker the plan left without a backend.
+static bool load_cached_plan(size_t workers) {
+    String cached_version = backend_prefs.getString("version", "");
+    if (cached_version != MINER_VERSION || backend_prefs.getInt("workers", 0) != (int)workers) return false;
+
+    const sha256_backend_t *plan[SHA256_MAX_WORKERS];
+    size_t assigned = 0;
+    for (size_t w = 0; w < workers; w++) {
+        char key[16];
+        plan_key(w, key, sizeof(key));
+        String name = backend_prefs.getString(key, "");
+        if (w > 0 && name.length() == 0) {
+            plan[w] = NULL;
+            continue;
+        }
+        plan[w] = sha256_backend_find(name.c_str());
+        if (!plan[w] || !backend_usable(plan[w])) return false;
+        assigned++;
+
+        bool tested = false;
+        for (size_t i = 0; i < w; i++) tested = tested || plan[i] == plan[w];
+        if (!tested && !sha256_backend_self_test(plan[w])) return false;
+    }
+
+    for (size_t w = 0; w < workers; w++) {
+        worker_backends[w] = plan[w];
+        if (VERBOSE) {
+            Serial.printf("  Worker[%u] %-12s cached for %s, probe skipped\n", (unsigned)w,
+                          plan[w] ? plan[w]->name : "-", MINER_VERSION);
+        }
+    }
+    worker_count = assigned;
+    plan_workers = workers;
+    return true;
+}
+
+size_t sha256_backend_select_workers(size_t workers) {
+    sha256_backend_register_builtin();
+    if (workers > SHA256_MAX_WORKERS) workers = SHA256_MAX_WORKERS;
+    if (workers == 0) workers = 1;
+
+    backend_prefs.begin(SHA256_BACKEND_PREFS_NAMESPACE, false);
+    if (load_cached_plan(workers)) {
+        backend_prefs.end();
+        return worker_count;
+    }
+
+    uint32_t rates[SHA256_MAX_BACKENDS];
+    uint32_t best_software_hps = 0;
+    for (size_t i = 0; i < backend_count; i++) {
+        const sha256_backend_t *backend = backends[i];
+        rates[i] = 0;
+        if (!backend_usable(backend)) {
+            if (VERBOSE) Serial.printf("  %-12s not supported\n", backend->name);
+            continue;
+        }
+        if (!sha256_backend_self_test(backend)) {
+            Serial.printf("  %-12s self-test FAILED\n", backend->name);
+            continue;
+        }
+        rates[i] = sha256_backend_probe(backend);
+        if (VERBOSE) Serial.printf("  %-12s %u H/s\n", backend->name, rates[i]);
+        if (!backend->resource && rates[i] > best_software_hps) best_software_hps = rates[i];
+    }
+
+    worker_count = sha256_backend_assign(backends, rates, backend_count, worker_backends, workers);
+    plan_workers = workers;
+
+    if (worker_count > 0) {
+        // Keyed by the requested count, which is what the next boot asks for;
+        // workers left without a backend are cached as an empty name
+        backend_prefs.putString("version", MINER_VERSION);
+        backend_prefs.putInt("workers", (int)workers);
+        uint32_t planned_hps = 0;
+        for (size_t w = 0; w < workers; w++) {
+            char key[16];
+            plan_key(w, key, sizeof(key));
+            backend_prefs.putString(key, worker_backends[w] ? worker_backends[w]->name : "");
+            if (!worker_backends[w]) continue;
+            for (size_t i = 0; i < backend_count; i++) {
+                if (backends[i] == worker_backends[w]) planned_hps += rates[i];
+            }
+        }
+        if (VERBOSE && worker_count > 1) {
+            // Every worker on its own core, against all of them on the best
+            // software kernel; the peripheral cannot serve two cores at once
+            Serial.printf("  Per-worker plan: %u H/s estimated, %u H/s software only\n",
+                          planned_hps, best_software_hps * (uint32_t)worker_count);
+        }
+    } else {
+        Serial.println("SHA-256 backend: no kernel passed the self-test!");
+    }
+    backend_prefs.end();
+    return worker_count;
+}
+
+const sha256_backend_t *sha256_backend_select(void) {
+    sha256_backend_select_workers(1);
+    return sha256_backend_active();
+}
+
+const sha256_backend_t *sha256_backend_active(void) {
+    return worker_count > 0 ? worker_backends[0] : NULL;
+}
+
+const sha256_backend_t *sha256_backend_for_worker(size_t worker) {
+    // Never the active backend: it may drive the engine another worker holds
+    return worker < plan_workers ? worker_backends[worker] : NULL;
+}
+
+void sha256_backend_add_hashes(const sha256_backend_t *backend, uint32_t count) {
+    for (size_t i = 0; i < backend_count; i++) {
+        if (backends[i] == backend) {
+            __atomic_fetch_add(&backend_hashes[i], count, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+unsigned long sha256_backend_hashes(const sha256_backend_t *backend) {
+    for (size_t i = 0; i < backend_count; i++) {
+        if (backends[i] == backend) return __atomic_load_n(&backend_hashes[i], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
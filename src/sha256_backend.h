@@ -0,0 +1,76 @@
+#ifndef SHA256_BACKEND_H
+#define SHA256_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sha256_optimized.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_MAX_BACKENDS 8
+#define SHA256_MAX_WORKERS 4
+#define SHA256_BACKEND_PROBE_NONCES 4096   // nonces hashed by each throughput probe
+#define SHA256_BACKEND_PREFS_NAMESPACE "sha_backend"
+
+// A scan kernel the hot loop can run. available() is the runtime capability
+// check (CPUID on hosts); NULL means the kernel runs everywhere it is built.
+// resource names a single shared peripheral the kernel drives (the SHA
+// engine); backends with the same resource are never given to two workers.
+// NULL means a pure software kernel every core can run at once.
+typedef struct {
+    const char *name;
+    sha256d_scan_fn scan;
+    bool (*available)(void);
+    const char *resource;
+} sha256_backend_t;
+
+// Registry: kernels built into this binary are added by
+// sha256_backend_register_builtin(); more can be registered before selection.
+bool sha256_backend_register(const sha256_backend_t *backend);
+void sha256_backend_register_builtin(void);
+size_t sha256_backend_count(void);
+const sha256_backend_t *sha256_backend_get(size_t index);
+const sha256_backend_t *sha256_backend_find(const char *name);
+
+// Known-answer test on real block headers: each winning nonce must be
+// reported, and every hit of a 1-zero-byte scan must match the reference hash.
+bool sha256_backend_self_test(const sha256_backend_t *backend);
+// Hashes per second over SHA256_BACKEND_PROBE_NONCES nonces
+uint32_t sha256_backend_probe(const sha256_backend_t *backend);
+
+// Gives each of workers a backend from candidates with measured rates (0 =
+// unusable), maximizing the combined rate: each worker in turn takes the
+// fastest candidate whose resource no earlier worker holds, so one worker
+// drives the SHA engine while the others run the best software kernel.
+// Returns the number of workers assigned; the rest of assignment is NULL.
+size_t sha256_backend_assign(const sha256_backend_t *const candidates[], const uint32_t rates[],
+                             size_t count, const sha256_backend_t *assignment[], size_t workers);
+
+// Probes every backend that is available and passes the self-test, then
+// assigns one per worker (at most SHA256_MAX_WORKERS) and returns how many
+// got one. The plan, one entry per requested worker, is cached in Preferences
+// keyed by MINER_VERSION and the requested count; a later boot with the same
+// firmware only re-runs the self-test of the cached backends.
+// Only workers are kept apart on the SHA engine: with USE_HW_SHA256 the
+// merkle and coinbase hashing still goes through mbedtls, which takes the
+// engine whenever it is free.
+size_t sha256_backend_select_workers(size_t workers);
+// Single-worker plan: the fastest backend
+const sha256_backend_t *sha256_backend_select(void);
+// Worker 0's backend of the last selection (the fastest), NULL before that
+const sha256_backend_t *sha256_backend_active(void);
+// Backend planned for worker; NULL for a worker the plan gave none or beyond
+// it, which then runs sha256d_scan
+const sha256_backend_t *sha256_backend_for_worker(size_t worker);
+
+// Per-backend hash counters, fed by the workers after every scan batch
+void sha256_backend_add_hashes(const sha256_backend_t *backend, uint32_t count);
+unsigned long sha256_backend_hashes(const sha256_backend_t *backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
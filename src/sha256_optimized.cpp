@@ -1,13 +1,18 @@
 #include "sha256_optimized.h"
 #include "configs.h"
 #include <string.h>
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
 #include <Arduino.h>
+#endif
 
 #if USE_HW_SHA256
 #include <mbedtls/sha256.h>
 #endif
 
-static const uint32_t K[64] = {
+// constexpr so the round generator below can bake K[i] in as immediates
+constexpr uint32_t sha256_k[64] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
     0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -18,7 +23,7 @@ static const uint32_t K[64] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-static const uint32_t H0[8] = {
+const uint32_t sha256_h0[8] = {
     0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
 };
@@ -31,9 +36,150 @@ static const uint32_t H0[8] = {
 #define SIG0(x) (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
 #define SIG1(x) (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
 
-static void sha256_transform(uint32_t state[8], const uint8_t data[64]) {
-    uint32_t a, b, c, d, e, f, g, h, t1, t2;
-    uint32_t W[64];
+static inline uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+// Compile-time round generator. Every round is its own template instance, so
+// the 64 rounds are fully unrolled with K[i] as an immediate. The eight
+// working variables are never moved: round i reads role r from
+// s[(r - i) & 7] and writes the new a and e in place, and the schedule keeps
+// only the last 16 words (w[i & 15]). A block policy P states which of the 16
+// input words are fixed at compile time (padding and length); schedule words
+// built only from fixed words are folded into constants, so one generator
+// emits the generic transform, the header tail and the 32-byte second hash.
+// A policy can also mark schedule words 16+ as preset: the caller stores them
+// in the window (per-job precomputes) and the generator does not expand them.
+#define SHA256_INLINE inline __attribute__((always_inline))
+
+namespace {
+
+constexpr uint32_t ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+constexpr uint32_t sig0(uint32_t x) { return ror(x, 7) ^ ror(x, 18) ^ (x >> 3); }
+constexpr uint32_t sig1(uint32_t x) { return ror(x, 17) ^ ror(x, 19) ^ (x >> 10); }
+
+// Block policies: fixed(i) / word(i) for the 16 input words, preset(i) for
+// schedule words the caller provides
+struct GenericBlock {
+    static constexpr bool fixed(int) { return false; }
+    static constexpr uint32_t word(int) { return 0; }
+    static constexpr bool preset(int) { return false; }
+};
+
+// Header tail: merkle tail, ntime, nbits, nonce, then padding and 640 bits.
+// Rounds 0..3 and W16..W19 come from sha256d_job_t plus the nonce terms.
+struct HeaderTailBlock {
+    static constexpr bool fixed(int i) { return i >= 4; }
+    static constexpr uint32_t word(int i) { return i == 4 ? 0x80000000u : i == 15 ? 0x00000280u : 0; }
+    static constexpr bool preset(int i) { return i >= 16 && i < 20; }
+};
+
+// Second hash: the 8-word first digest, then padding and 256 bits
+struct DigestBlock {
+    static constexpr bool fixed(int i) { return i >= 8; }
+    static constexpr uint32_t word(int i) { return i == 8 ? 0x80000000u : i == 15 ? 0x00000100u : 0; }
+    static constexpr bool preset(int) { return false; }
+};
+
+// Schedule word I, known at compile time when every word it derives from is
+template <class P, int I, bool Input = (I < 16)>
+struct Word {
+    static constexpr bool known = P::fixed(I);
+    static constexpr uint32_t value = P::word(I);
+};
+
+template <class P, int I>
+struct Word<P, I, false> {
+    typedef Word<P, I - 2> W2;
+    typedef Word<P, I - 7> W7;
+    typedef Word<P, I - 15> W15;
+    typedef Word<P, I - 16> W16;
+    static constexpr bool known = W2::known && W7::known && W15::known && W16::known;
+    static constexpr uint32_t value = known ? sig1(W2::value) + W7::value + sig0(W15::value) + W16::value : 0;
+};
+
+template <class P, int I>
+SHA256_INLINE uint32_t sched_word(const uint32_t w[16]) {
+    if (Word<P, I>::known) return Word<P, I>::value;
+    return w[I & 15];
+}
+
+// Schedule step for round I: only words that are not known are stored
+template <class P, int I, bool Needed = (I >= 16 && !Word<P, I>::known && !P::preset(I))>
+struct Expand {
+    static SHA256_INLINE void run(uint32_t *) {}
+};
+
+template <class P, int I>
+struct Expand<P, I, true> {
+    static SHA256_INLINE void run(uint32_t w[16]) {
+        w[I & 15] = sig1(sched_word<P, I - 2>(w)) + sched_word<P, I - 7>(w) +
+                    sig0(sched_word<P, I - 15>(w)) + sched_word<P, I - 16>(w);
+    }
+};
+
+template <class P, int I>
+SHA256_INLINE void sha_round(uint32_t s[8], uint32_t w[16]) {
+    Expand<P, I>::run(w);
+    uint32_t a = s[(0 - I) & 7], b = s[(1 - I) & 7], c = s[(2 - I) & 7];
+    uint32_t e = s[(4 - I) & 7], f = s[(5 - I) & 7], g = s[(6 - I) & 7];
+    // K[I] + W[I] is a single immediate when the word is known
+    uint32_t kw = sha256_k[I] + sched_word<P, I>(w);
+    uint32_t t1 = s[(7 - I) & 7] + EP1(e) + CH(e, f, g) + kw;
+    s[(3 - I) & 7] += t1;
+    s[(7 - I) & 7] = t1 + EP0(a) + MAJ(a, b, c);
+}
+
+// Rounds Begin..End-1
+template <class P, int Begin, int End>
+struct Rounds {
+    static SHA256_INLINE void run(uint32_t s[8], uint32_t w[16]) {
+        sha_round<P, Begin>(s, w);
+        Rounds<P, Begin + 1, End>::run(s, w);
+    }
+};
+
+template <class P, int End>
+struct Rounds<P, End, End> {
+    static SHA256_INLINE void run(uint32_t *, uint32_t *) {}
+};
+
+// Working variable r (0 = a .. 7 = h) after rounds 0..I-1
+template <int I>
+SHA256_INLINE uint32_t role(const uint32_t s[8], int r) {
+    return s[(r - I) & 7];
+}
+
+} // namespace
+
+static void sha256_transform_words(uint32_t state[8], const uint32_t W[16]) {
+    uint32_t s[8];
+    uint32_t w[16];
+    for (int i = 0; i < 8; i++) s[i] = state[i];
+    for (int i = 0; i < 16; i++) w[i] = W[i];
+    Rounds<GenericBlock, 0, 64>::run(s, w);
+    for (int i = 0; i < 8; i++) state[i] += s[i];
+}
+
+// Full second hash of a first digest given as words
+static void sha256d_second_block(const uint32_t first[8], uint32_t out[8]) {
+    uint32_t s[8];
+    uint32_t w[16];
+    for (int i = 0; i < 8; i++) s[i] = sha256_h0[i];
+    for (int i = 0; i < 8; i++) w[i] = first[i];
+    Rounds<DigestBlock, 0, 64>::run(s, w);
+    for (int i = 0; i < 8; i++) out[i] = sha256_h0[i] + s[i];
+}
+
+void sha256_transform(uint32_t state[8], const uint8_t data[64]) {
+    uint32_t W[16];
     
     for (int i = 0; i < 16; i++) {
         W[i] = ((uint32_t)data[i * 4 + 0] << 24) | 
@@ -41,29 +187,14 @@ static void sha256_transform(uint32_t state[8], const uint8_t data[64]) {
                 ((uint32_t)data[i * 4 + 2] << 8) | 
                 ((uint32_t)data[i * 4 + 3]);
     }
-    for (int i = 16; i < 64; i++) {
-        W[i] = SIG1(W[i - 2]) + W[i - 7] + SIG0(W[i - 15]) + W[i - 16];
-    }
-    
-    a = state[0]; b = state[1]; c = state[2]; d = state[3];
-    e = state[4]; f = state[5]; g = state[6]; h = state[7];
-    
-    for (int i = 0; i < 64; i++) {
-        t1 = h + EP1(e) + CH(e, f, g) + K[i] + W[i];
-        t2 = EP0(a) + MAJ(a, b, c);
-        h = g; g = f; f = e; e = d + t1;
-        d = c; c = b; b = a; a = t1 + t2;
-    }
-    
-    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
-    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    sha256_transform_words(state, W);
 }
 
 void sha256_esp32_init(sha256_opt_ctx_t *ctx) {
     if (!ctx) return;
     ctx->use_hardware = USE_HW_SHA256;
     
-    for (int i = 0; i < 8; i++) ctx->state[i] = H0[i];
+    for (int i = 0; i < 8; i++) ctx->state[i] = sha256_h0[i];
     ctx->buffer_len = 0;
     ctx->total_len = 0;
 }
@@ -138,78 +269,202 @@ void sha256_esp32_bitcoin_hash(const uint8_t *block_header, uint8_t *hash) {
     sha256_esp32_double(block_header, 80, hash);
 }
 
-void sha256_compute_midstate(const uint8_t *data, uint32_t len, uint8_t *midstate) {
-    uint32_t state[8];
-    for (int i = 0; i < 8; i++) state[i] = H0[i];
-    
-    uint8_t buffer[64];
-    size_t offset = 0;
-    size_t remaining = len;
-    
-    while (remaining > 0) {
-        size_t to_copy = (remaining < 64) ? remaining : 64;
-        memcpy(buffer, data + offset, to_copy);
-        
-        if (to_copy < 64) {
-            buffer[to_copy] = 0x80;
-            if (to_copy < 56) {
-                for (size_t i = to_copy + 1; i < 56; i++) buffer[i] = 0;
-                uint64_t bits = len * 8;
-                for (int i = 0; i < 8; i++) {
-                    buffer[56 + i] = (bits >> (56 - i * 8)) & 0xFF;
-                }
-                sha256_transform(state, buffer);
-            }
-        } else {
-            sha256_transform(state, buffer);
-        }
-        
-        offset += to_copy;
-        remaining -= to_copy;
-    }
-    
-    for (int i = 0; i < 8; i++) {
-        midstate[i * 4 + 0] = (state[i] >> 24) & 0xFF;
-        midstate[i * 4 + 1] = (state[i] >> 16) & 0xFF;
-        midstate[i * 4 + 2] = (state[i] >> 8) & 0xFF;
-        midstate[i * 4 + 3] = (state[i]) & 0xFF;
+void sha256d_64(const uint8_t *data, uint8_t *hash) {
+    sha256_esp32_double(data, 64, hash);
+}
+
+void sha256_compute_midstate(const uint8_t *data, uint32_t len, uint32_t *midstate) {
+    for (int i = 0; i < 8; i++) midstate[i] = sha256_h0[i];
+    for (uint32_t offset = 0; offset + 64 <= len; offset += 64) {
+        sha256_transform(midstate, data + offset);
     }
 }
 
+// Double SHA-256 of prefix || tail where midstate is the raw compression state
+// after the 64-byte prefix. The tail block is compressed straight from the
+// midstate and the first digest feeds the second hash as words, so an 80-byte
+// header costs two compressions.
 void sha256_bitcoin_hash_fast(
-    const uint8_t *midstate,
-    const uint8_t *midstate2,
+    const uint32_t *midstate,
     const uint8_t *tail_data,
     size_t tail_len,
     uint8_t *hash_result
 ) {
-    uint8_t first_hash[32];
+    if (tail_len > 55) return;
+
     uint8_t block1[64];
-    memcpy(block1, midstate, 32);
-    memcpy(block1 + 32, tail_data, tail_len);
-    if (tail_len < 32) {
-        memset(block1 + 32 + tail_len, 0, 64 - 32 - tail_len);
-        block1[32 + tail_len] = 0x80;
-        uint64_t bits = 64 + tail_len;
-        for (int i = 0; i < 8; i++) {
-            block1[56 + i] = (bits >> (56 - i * 8)) & 0xFF;
+    memcpy(block1, tail_data, tail_len);
+    memset(block1 + tail_len, 0, 64 - tail_len);
+    block1[tail_len] = 0x80;
+    uint64_t bits = (64 + tail_len) * 8;
+    for (int i = 0; i < 8; i++) {
+        block1[56 + i] = (bits >> (56 - i * 8)) & 0xFF;
+    }
+
+    uint32_t state[8];
+    for (int i = 0; i < 8; i++) state[i] = midstate[i];
+    sha256_transform(state, block1);
+    sha256d_second_block(state, state);
+
+    for (int i = 0; i < 8; i++) store_be32(hash_result + i * 4, state[i]);
+}
+
+// Nonce-specialized first block. The header tail block is
+//   W0..W2 = merkle tail, ntime, nbits (per job)
+//   W3     = nonce
+//   W4     = 0x80000000, W5..W14 = 0, W15 = 640 (80-byte message length in bits)
+// so rounds 0..2, most of round 3 and the schedule terms built only from
+// W0..W2 and the padding words are computed once in sha256d_job_init.
+void sha256d_job_init(sha256d_job_t *job, const uint32_t *midstate, const uint8_t *header) {
+    if (!job || !midstate || !header) return;
+
+    memcpy(job->header, header, 80);
+    for (int i = 0; i < 8; i++) job->midstate[i] = midstate[i];
+    for (int i = 0; i < 3; i++) job->tail[i] = load_be32(header + 64 + i * 4);
+
+    uint32_t a = job->midstate[0], b = job->midstate[1], c = job->midstate[2], d = job->midstate[3];
+    uint32_t e = job->midstate[4], f = job->midstate[5], g = job->midstate[6], h = job->midstate[7];
+    uint32_t t1, t2;
+    for (int i = 0; i < 3; i++) {
+        t1 = h + EP1(e) + CH(e, f, g) + sha256_k[i] + job->tail[i];
+        t2 = EP0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    job->state3[0] = a; job->state3[1] = b; job->state3[2] = c; job->state3[3] = d;
+    job->state3[4] = e; job->state3[5] = f; job->state3[6] = g; job->state3[7] = h;
+
+    // Round 3 minus the nonce word
+    job->r3_t1 = h + EP1(e) + CH(e, f, g) + sha256_k[3];
+    job->r3_t2 = EP0(a) + MAJ(a, b, c);
+
+    // Schedule words 16..19 (W18 and W19 still need the nonce term added)
+    job->w16 = SIG0(job->tail[1]) + job->tail[0];
+    job->w17 = SIG1(0x00000280u) + SIG0(job->tail[2]) + job->tail[1];
+    job->w18_part = SIG1(job->w16) + job->tail[2];
+    job->w19_part = SIG1(job->w17) + SIG0(0x80000000);
+}
+
+static inline void sha256d_first_block(const sha256d_job_t *job, uint32_t nonce, uint32_t out[8]) {
+    uint32_t n = __builtin_bswap32(nonce);
+    uint32_t s[8];
+    uint32_t w[16];
+
+    // Round 3 with the nonce word; roles after four rounds start at s[4]
+    uint32_t t1 = job->r3_t1 + n;
+    s[4] = t1 + job->r3_t2; s[5] = job->state3[0]; s[6] = job->state3[1]; s[7] = job->state3[2];
+    s[0] = job->state3[3] + t1; s[1] = job->state3[4]; s[2] = job->state3[5]; s[3] = job->state3[6];
+
+    // W16..W19 in the window slots of W0..W3, which rounds 4+ no longer read
+    w[0] = job->w16;
+    w[1] = job->w17;
+    w[2] = job->w18_part + SIG0(n);
+    w[3] = job->w19_part + n;
+    Rounds<HeaderTailBlock, 4, 64>::run(s, w);
+
+    for (int i = 0; i < 8; i++) out[i] = job->midstate[i] + s[i];
+}
+
+void sha256d_job_hash(const sha256d_job_t *job, uint32_t nonce, uint8_t *hash_result) {
+    uint32_t state[8];
+    sha256d_first_block(job, nonce, state);
+    sha256d_second_block(state, state);
+
+    for (int i = 0; i < 8; i++) store_be32(hash_result + i * 4, state[i]);
+}
+
+// Second hash with fixed padding, cut short for the H7 check. The final H7
+// (hash bytes 28..31, the top of the little-endian block hash) is e after
+// round 60, and e at round t only needs a from round t-4, so the generator's
+// dead a-updates of rounds 57..60 are dropped and rounds 61..63 are not run.
+static inline bool sha256d_second_block_h7(const uint32_t first[8], uint32_t h7_mask) {
+    uint32_t s[8];
+    uint32_t w[16];
+    for (int i = 0; i < 8; i++) s[i] = sha256_h0[i];
+    for (int i = 0; i < 8; i++) w[i] = first[i];
+    Rounds<DigestBlock, 0, 61>::run(s, w);
+
+    return ((sha256_h0[7] + role<61>(s, 4)) & h7_mask) == 0;
+}
+
+void sha256d_target_init(sha256d_target_t *target, uint8_t zero_bytes) {
+    if (!target) return;
+    // hash[31] is the low byte of H7, hash[28] the high byte
+    target->h7_mask = (zero_bytes >= 4) ? 0xFFFFFFFF : ((1u << (zero_bytes * 8)) - 1);
+}
+
+bool sha256d_job_check(const sha256d_job_t *job, uint32_t nonce, uint8_t zero_bytes, uint8_t *hash_result) {
+    uint32_t first[8];
+    sha256d_first_block(job, nonce, first);
+
+    sha256d_target_t target;
+    sha256d_target_init(&target, zero_bytes);
+    if (!sha256d_second_block_h7(first, target.h7_mask)) {
+        return false;
+    }
+
+    // Candidate: produce the full digest
+    uint32_t state[8];
+    sha256d_second_block(first, state);
+
+    for (int i = 0; i < 8; i++) store_be32(hash_result + i * 4, state[i]);
+    return true;
+}
+
+size_t sha256d_scan(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                    const sha256d_target_t *target, uint32_t *hits, size_t max_hits) {
+    size_t found = 0;
+    uint32_t first[8];
+    for (uint32_t i = 0; i < count && found < max_hits; i++) {
+        uint32_t nonce = nonce_start + i;
+        sha256d_first_block(job, nonce, first);
+        if (sha256d_second_block_h7(first, target->h7_mask)) {
+            hits[found++] = nonce;
         }
     }
-    
-    sha256_esp32_hash(block1, 64, first_hash);
-    
-    uint8_t block2[64];
-    memcpy(block2, first_hash, 32);
-    memset(block2 + 32, 0, 32);
-    block2[32] = 0x80;
-    uint64_t bits = 32;
-    for (int i = 0; i < 8; i++) {
-        block2[56 + i] = (bits >> (56 - i * 8)) & 0xFF;
+    return found;
+}
+
+// Unspecialized backend: the generic midstate path (two full compressions
+// per nonce), kept as the portable reference the registry can fall back to.
+size_t sha256d_scan_generic(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                            const sha256d_target_t *target, uint32_t *hits, size_t max_hits) {
+    size_t found = 0;
+    uint8_t tail[16];
+    uint8_t hash[32];
+    memcpy(tail, job->header + 64, 16);
+    for (uint32_t i = 0; i < count && found < max_hits; i++) {
+        uint32_t nonce = nonce_start + i;
+        *(uint32_t*)(tail + 12) = nonce;
+        sha256_bitcoin_hash_fast(job->midstate, tail, 16, hash);
+        if ((load_be32(hash + 28) & target->h7_mask) == 0) {
+            hits[found++] = nonce;
+        }
     }
-    
-    sha256_esp32_hash(block2, 64, hash_result);
+    return found;
 }
 
+#if USE_HW_SHA256
+// The ESP32 accelerator cannot be seeded with a midstate, so this backend
+// hashes the full 80-byte header for every nonce.
+size_t sha256d_scan_hw(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                       const sha256d_target_t *target, uint32_t *hits, size_t max_hits) {
+    size_t found = 0;
+    uint8_t header[80];
+    uint8_t hash[32];
+    memcpy(header, job->header, 80);
+    for (uint32_t i = 0; i < count && found < max_hits; i++) {
+        uint32_t nonce = nonce_start + i;
+        *(uint32_t*)(header + 76) = nonce;
+        sha256_esp32_double(header, 80, hash);
+        if ((load_be32(hash + 28) & target->h7_mask) == 0) {
+            hits[found++] = nonce;
+        }
+    }
+    return found;
+}
+#endif
+
 bool sha256_check_fast_reject(const uint8_t *hash, uint8_t min_zeros) {
     if (min_zeros == 0) return true;
     
@@ -23,17 +23,73 @@ typedef struct {
     uint32_t optimized_hps;
 } sha256_benchmark_t;
 
+// SHA-256 round constants and initial hash value, shared with the SIMD kernels
+extern const uint32_t sha256_k[64];
+extern const uint32_t sha256_h0[8];
+
+// Single SHA-256 compression of one 64-byte block into state (no padding)
+void sha256_transform(uint32_t state[8], const uint8_t data[64]);
+
+// Per-job precomputation for the nonce-specialized double SHA-256 kernel.
+// Only the nonce changes between calls, so everything derived from the midstate
+// and the first 12 tail bytes (merkle tail, ntime, nbits) is computed once.
+typedef struct {
+    uint32_t midstate[8];   // state after the first 64 header bytes
+    uint32_t tail[3];       // header words 16..18 (merkle tail, ntime, nbits)
+    uint32_t state3[8];     // working variables after rounds 0..2
+    uint32_t r3_t1;         // round 3 T1 without the nonce word
+    uint32_t r3_t2;         // round 3 T2
+    uint32_t w16;           // schedule words that do not depend on the nonce
+    uint32_t w17;
+    uint32_t w18_part;      // W18 minus SIG0(nonce)
+    uint32_t w19_part;      // W19 minus nonce
+    uint8_t header[80];     // full header for backends that cannot start from a midstate
+} sha256d_job_t;
+
+// Candidate filter for the scan kernels: a nonce is a hit when
+// (H7 & h7_mask) == 0, i.e. the last hash bytes are zero.
+typedef struct {
+    uint32_t h7_mask;
+} sha256d_target_t;
+
+// Batched nonce scan implemented by every backend: hashes up to count nonces
+// from nonce_start and stores candidate nonces in hits. Scanning stops early
+// once max_hits candidates were found; the caller resumes after hits[max_hits-1].
+typedef size_t (*sha256d_scan_fn)(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                                  const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+
+// Double SHA-256 of one 64-byte merkle node (two concatenated child hashes)
+typedef void (*sha256d_64_fn)(const uint8_t *data, uint8_t *hash);
+
 void sha256_esp32_init(sha256_opt_ctx_t *ctx);
 void sha256_esp32_update(sha256_opt_ctx_t *ctx, const uint8_t *data, size_t len);
 void sha256_esp32_final(sha256_opt_ctx_t *ctx, uint8_t *hash);
 void sha256_esp32_hash(const uint8_t *data, size_t len, uint8_t *hash);
 void sha256_esp32_double(const uint8_t *data, size_t len, uint8_t *hash);
 void sha256_esp32_bitcoin_hash(const uint8_t *block_header, uint8_t *hash);
+void sha256d_64(const uint8_t *data, uint8_t *hash);
 void sha256_esp32_benchmark(sha256_benchmark_t *result);
 
-void sha256_compute_midstate(const uint8_t *data, uint32_t len, uint8_t *midstate);
-void sha256_bitcoin_hash_fast(const uint8_t *midstate, const uint8_t *midstate2,
-                               const uint8_t *tail_data, size_t tail_len, uint8_t *hash_result);
+// Midstate API: the state is kept as raw compression words, never re-serialized.
+// sha256_compute_midstate compresses the whole 64-byte blocks of data from the IV.
+void sha256_compute_midstate(const uint8_t *data, uint32_t len, uint32_t *midstate);
+void sha256_bitcoin_hash_fast(const uint32_t *midstate, const uint8_t *tail_data,
+                               size_t tail_len, uint8_t *hash_result);
+void sha256d_job_init(sha256d_job_t *job, const uint32_t *midstate, const uint8_t *header);
+void sha256d_job_hash(const sha256d_job_t *job, uint32_t nonce, uint8_t *hash_result);
+// Early-reject variant: only the H7 word of the second hash is computed unless
+// the last zero_bytes (max 4) hash bytes are zero. Returns false without
+// touching hash_result for rejected nonces, true with the full digest otherwise.
+bool sha256d_job_check(const sha256d_job_t *job, uint32_t nonce, uint8_t zero_bytes, uint8_t *hash_result);
+void sha256d_target_init(sha256d_target_t *target, uint8_t zero_bytes);
+size_t sha256d_scan(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                    const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+size_t sha256d_scan_generic(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                            const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+#if USE_HW_SHA256
+size_t sha256d_scan_hw(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                       const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+#endif
 bool sha256_check_fast_reject(const uint8_t *hash, uint8_t min_zeros);
 
 #ifdef __cplusplus
@@ -0,0 +1,193 @@
+#include "sha256_shani.h"
+
+#if SHA256_HAVE_SHANI
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SIG0(x) (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+
+bool sha256_shani_available(void) {
+    static int available = -1;
+    if (available < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        bool sse41 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1);
+        bool sha = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+        available = (sse41 && sha) ? 1 : 0;
+    }
+    return available == 1;
+}
+
+// The SHA instructions keep the working variables as ABEF / CDGH (A in the
+// top lane) and take the message as four schedule words per register, W[i]
+// in the low lane. w[q] holds W[4q..4q+3].
+
+// Expand w[first..15] from the four preceding quads
+SHANI_TARGET static inline void shani_schedule(__m128i w[16], int first) {
+    for (int q = first; q < 16; q++) {
+        __m128i t = _mm_sha256msg1_epu32(w[q - 4], w[q - 3]);
+        t = _mm_add_epi32(t, _mm_alignr_epi8(w[q - 1], w[q - 2], 4));
+        w[q] = _mm_sha256msg2_epu32(t, w[q - 1]);
+    }
+}
+
+// Rounds 4*first .. 4*last-1
+SHANI_TARGET static inline void shani_rounds(__m128i &abef, __m128i &cdgh, const __m128i w[16],
+                                             int first, int last) {
+    for (int q = first; q < last; q++) {
+        __m128i kw = _mm_add_epi32(w[q], _mm_loadu_si128((const __m128i *)&sha256_k[q * 4]));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, kw);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(kw, 0x0E));
+    }
+}
+
+SHANI_TARGET static inline void shani_load_state(const uint32_t state[8], __m128i &abef, __m128i &cdgh) {
+    __m128i dcba = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i hgfe = _mm_loadu_si128((const __m128i *)&state[4]);
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    abef = _mm_alignr_epi8(cdab, efgh, 8);
+    cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+}
+
+SHANI_TARGET static inline void shani_store_state(__m128i abef, __m128i cdgh, uint32_t state[8]) {
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+SHANI_TARGET static inline void shani_load_block(const uint8_t data[64], __m128i w[16]) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    for (int q = 0; q < 4; q++) {
+        w[q] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + q * 16)), bswap);
+    }
+}
+
+SHANI_TARGET static inline void shani_compress(__m128i &abef, __m128i &cdgh, __m128i w[16]) {
+    __m128i abef_in = abef, cdgh_in = cdgh;
+    shani_schedule(w, 4);
+    shani_rounds(abef, cdgh, w, 0, 16);
+    abef = _mm_add_epi32(abef, abef_in);
+    cdgh = _mm_add_epi32(cdgh, cdgh_in);
+}
+
+// Digest words back to big-endian bytes
+SHANI_TARGET static inline void shani_store_digest(__m128i abef, __m128i cdgh, uint8_t hash[32]) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    uint32_t state[8];
+    shani_store_state(abef, cdgh, state);
+    _mm_storeu_si128((__m128i *)hash, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&state[0]), bswap));
+    _mm_storeu_si128((__m128i *)(hash + 16), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&state[4]), bswap));
+}
+
+SHANI_TARGET void sha256_shani_transform(uint32_t state[8], const uint8_t data[64]) {
+    __m128i abef, cdgh, w[16];
+    shani_load_state(state, abef, cdgh);
+    shani_load_block(data, w);
+    shani_compress(abef, cdgh, w);
+    shani_store_state(abef, cdgh, state);
+}
+
+SHANI_TARGET void sha256d_64_shani(const uint8_t *data, uint8_t *hash) {
+    __m128i abef, cdgh, w[16];
+    shani_load_state(sha256_h0, abef, cdgh);
+    shani_load_block(data, w);
+    shani_compress(abef, cdgh, w);
+
+    // Padding block of a 64-byte message
+    w[0] = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    w[1] = _mm_setzero_si128();
+    w[2] = _mm_setzero_si128();
+    w[3] = _mm_set_epi32(0x00000200, 0, 0, 0);
+    shani_compress(abef, cdgh, w);
+
+    // Second hash over the 32-byte digest
+    uint32_t first[8];
+    shani_store_state(abef, cdgh, first);
+    w[0] = _mm_loadu_si128((const __m128i *)&first[0]);
+    w[1] = _mm_loadu_si128((const __m128i *)&first[4]);
+    w[2] = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    w[3] = _mm_set_epi32(0x00000100, 0, 0, 0);
+    shani_load_state(sha256_h0, abef, cdgh);
+    shani_compress(abef, cdgh, w);
+    shani_store_digest(abef, cdgh, hash);
+}
+
+// Per-nonce setup of the first block: the state after round 3 and W0..W19
+// come from the job precompute (see sha256d_job_init)
+SHANI_TARGET static inline void shani_first_block(const sha256d_job_t *job, uint32_t nonce,
+                                                  __m128i &abef, __m128i &cdgh, __m128i w[16]) {
+    uint32_t n = __builtin_bswap32(nonce);
+    uint32_t t1 = job->r3_t1 + n;
+    uint32_t state[8] = {
+        t1 + job->r3_t2, job->state3[0], job->state3[1], job->state3[2],
+        job->state3[3] + t1, job->state3[4], job->state3[5], job->state3[6]
+    };
+    shani_load_state(state, abef, cdgh);
+
+    w[0] = _mm_set_epi32((int)n, (int)job->tail[2], (int)job->tail[1], (int)job->tail[0]);
+    w[1] = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    w[2] = _mm_setzero_si128();
+    w[3] = _mm_set_epi32(0x00000280, 0, 0, 0);
+    w[4] = _mm_set_epi32((int)(job->w19_part + n), (int)(job->w18_part + SIG0(n)),
+                         (int)job->w17, (int)job->w16);
+    shani_schedule(w, 5);
+}
+
+// Finishes the first hash and sets up the second: message is the 32-byte
+// digest with fixed padding, state restarts from the IV
+SHANI_TARGET static inline void shani_second_block(const sha256d_job_t *job,
+                                                   __m128i &abef, __m128i &cdgh, __m128i w[16]) {
+    __m128i abef_in, cdgh_in;
+    shani_load_state(job->midstate, abef_in, cdgh_in);
+    uint32_t first[8];
+    shani_store_state(_mm_add_epi32(abef, abef_in), _mm_add_epi32(cdgh, cdgh_in), first);
+
+    w[0] = _mm_loadu_si128((const __m128i *)&first[0]);
+    w[1] = _mm_loadu_si128((const __m128i *)&first[4]);
+    w[2] = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    w[3] = _mm_set_epi32(0x00000100, 0, 0, 0);
+    shani_schedule(w, 4);
+    shani_load_state(sha256_h0, abef, cdgh);
+}
+
+// Final H7 word of one nonce. The second hash stops after round 60 since H7
+// is e after round 60.
+SHANI_TARGET static inline uint32_t sha256d_shani_h7(const sha256d_job_t *job, uint32_t nonce) {
+    __m128i abef, cdgh, w[16];
+    shani_first_block(job, nonce, abef, cdgh, w);
+    shani_rounds(abef, cdgh, w, 1, 16);
+
+    shani_second_block(job, abef, cdgh, w);
+    shani_rounds(abef, cdgh, w, 0, 15);
+
+    // Rounds 60 and 61 in one instruction; F of the result is e after round 60
+    __m128i kw = _mm_add_epi32(w[15], _mm_loadu_si128((const __m128i *)&sha256_k[60]));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, kw);
+    return (uint32_t)_mm_cvtsi128_si32(cdgh) + sha256_h0[7];
+}
+
+SHANI_TARGET size_t sha256d_scan_shani(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                                       const sha256d_target_t *target, uint32_t *hits, size_t max_hits) {
+    size_t found = 0;
+    for (uint32_t i = 0; i < count && found < max_hits; i++) {
+        uint32_t nonce = nonce_start + i;
+        if ((sha256d_shani_h7(job, nonce) & target->h7_mask) == 0) {
+            hits[found++] = nonce;
+        }
+    }
+    return found;
+}
+
+#endif
+
+sha256d_64_fn sha256d_64_select(void) {
+#if SHA256_HAVE_SHANI
+    if (sha256_shani_available()) return sha256d_64_shani;
+#endif
+    return sha256d_64;
+}
@@ -0,0 +1,37 @@
+#ifndef SHA256_SHANI_H
+#define SHA256_SHANI_H
+
+#include "sha256_optimized.h"
+
+// SHA extension kernels exist only in x86 host builds (test harness, host miner)
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HAVE_SHANI 1
+#else
+#define SHA256_HAVE_SHANI 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if SHA256_HAVE_SHANI
+// CPUID check for the SHA extensions (sha256rnds2, sha256msg1/2) and SSE4.1
+bool sha256_shani_available(void);
+
+// Same contracts as sha256_transform, sha256d_scan and sha256d_64; must only
+// be called when sha256_shani_available().
+void sha256_shani_transform(uint32_t state[8], const uint8_t data[64]);
+size_t sha256d_scan_shani(const sha256d_job_t *job, uint32_t nonce_start, uint32_t count,
+                          const sha256d_target_t *target, uint32_t *hits, size_t max_hits);
+void sha256d_64_shani(const uint8_t *data, uint8_t *hash);
+#endif
+
+// Merkle node hasher for calculateMerkleRoot: sha256d_64_shani when CPUID
+// reports the SHA extensions, otherwise the portable sha256d_64
+sha256d_64_fn sha256d_64_select(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#include "share_filter.h"
+
+#include <string.h>
+
+share_filter_t mining_share_filter;
+
+void share_filter_init(share_filter_t *filter) {
+    memset(filter, 0, sizeof(*filter));
+}
+
+void share_filter_clear(share_filter_t *filter) {
+    for (int i = 0; i < SHARE_FILTER_SLOTS; i++) {
+        __atomic_store_n(&filter->keys[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t mix(uint64_t hash, uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((word >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// FNV-1a over the fields the pool identifies a share by
+static uint64_t share_key(const StratumShare *share) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = mix(hash, share->job);
+    hash = mix(hash, share->nonce);
+    hash = mix(hash, share->ntime);
+    hash = mix(hash, share->version_bits);
+    for (const char *c = share->extranonce2; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001b3ULL;
+    }
+    // Spread the last bytes into the low bits the slot index comes from
+    hash ^= hash >> 29;
+    return hash ? hash : 1;
+}
+
+bool share_filter_insert(share_filter_t *filter, const StratumShare *share) {
+    __atomic_fetch_add(&filter->checked, 1, __ATOMIC_RELAXED);
+    uint64_t key = share_key(share);
+    for (uint32_t probe = 0; probe < SHARE_FILTER_PROBES; probe++) {
+        volatile uint64_t *slot = &filter->keys[(key + probe) & (SHARE_FILTER_SLOTS - 1)];
+        uint64_t current = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (current == 0 &&
+            __atomic_compare_exchange_n(slot, &current, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+        // Empty slot taken meanwhile: current is now its key
+        if (current == key) {
+            __atomic_fetch_add(&filter->suppressed, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+    __atomic_fetch_add(&filter->unchecked, 1, __ATOMIC_RELAXED);
+    return true;
+}
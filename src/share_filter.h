@@ -0,0 +1,43 @@
+#ifndef SHARE_FILTER_H
+#define SHARE_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pool_connection.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHARE_FILTER_SLOTS 256           // power of two, shares remembered per block
+#define SHARE_FILTER_PROBES 16           // slots tried before a share goes through unchecked
+
+// Shares already submitted, so a nonce found twice (a rescanned range) is not
+// sent again only to be rejected. An open-addressing set of 64-bit hashes of
+// (job, extranonce2, ntime, version bits, nonce), inserted by compare-and-swap
+// from any worker; two distinct shares colliding on all 64 bits is not a
+// practical concern. Kept across jobs while their shares can still be
+// submitted; cleared when clean_jobs, a new block or a new session retires
+// them.
+typedef struct {
+    volatile uint64_t keys[SHARE_FILTER_SLOTS];  // 0 when empty
+    volatile uint32_t checked;           // shares looked up
+    volatile uint32_t suppressed;        // duplicates kept from the pool
+    volatile uint32_t unchecked;         // let through because their probe run was full
+} share_filter_t;
+
+void share_filter_init(share_filter_t *filter);
+// Forgets every share; counters are kept
+void share_filter_clear(share_filter_t *filter);
+// Records share; false if it was recorded before, and the caller drops it
+bool share_filter_insert(share_filter_t *filter, const StratumShare *share);
+
+// Checked by the mining workers before submitting, cleared by the pool
+// connection whenever it retires the job history
+extern share_filter_t mining_share_filter;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+#include "work_prep.h"
+#include "configs.h"
+
+#ifdef UNIT_TEST
+#include "arduino_stubs.h"
+#else
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+
+work_prep_t mining_work_prep;
+
+void work_prep_init(work_prep_t *prep) {
+    memset(prep, 0, sizeof(*prep));
+}
+
+// Builds header index into prep->scratch; the coinbase hash and merkle walk
+// only run when extranonce2 differs from the previous prepared header
+static bool prepare_header(work_prep_t *prep, const nonce_space_t *space, uint32_t header_index) {
+    nonce_unit_t unit;
+    if (!nonce_space_header_unit(space, prep->generation, header_index, &unit)) return false;
+
+    prepared_header_t *work = &prep->scratch;
+    if (!prep->scratch_valid || prep->extranonce2 != unit.extranonce2) {
+        uint8_t extranonce2[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+        size_t extranonce2_len = nonce_space_extranonce2_bytes(space, unit.extranonce2, extranonce2,
+                                                               sizeof(extranonce2));
+        uint8_t merkle_root[32];
+        coinbaseMerkleRoot(&prep->coinbase, extranonce2, extranonce2_len, merkle_root);
+        setBlockHeaderMerkleRoot(work->header, merkle_root);
+        prep->extranonce2 = unit.extranonce2;
+        prep->scratch_valid = true;
+    }
+    setBlockHeaderVersionBits(work->header, prep->version_mask, unit.version_bits);
+    setBlockHeaderNtime(work->header, rolledNtime(work->job_ntime, unit.ntime_roll, 0));
+    if (work->cache.valid && memcmp(work->header, prep->scratch_block, 64) == 0) {
+        // Only ntime or nbits differ from the header prepared last
+        updateMidstateCacheTail(&work->cache, work->header);
+        __atomic_fetch_add(&prep->midstates_reused, 1, __ATOMIC_RELAXED);
+    } else {
+        updateMidstateCache(&work->cache, work->header);
+        memcpy(prep->scratch_block, work->header, 64);
+    }
+    work->header_index = header_index;
+
+    // Publish: readers that overlap the copy see an odd or changed sequence
+    // count and build the header themselves
+    work_prep_slot_t *slot = &prep->slots[header_index % WORK_PREP_SLOTS];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->work, work, sizeof(*work));
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&prep->prepared, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+// FNV-1a over everything the coinbase and merkle root of header 0 depend on
+static uint64_t memo_key(const StratumJob *job, const uint8_t *extranonce1, size_t extranonce1_len,
+                         size_t extranonce2_len) {
+    const struct {
+        const void *data;
+        size_t len;
+    } parts[4] = {
+        {job->coinb1, job->coinb1_len},
+        {extranonce1, extranonce1_len},
+        {job->coinb2, job->coinb2_len},
+        {job->merkle_branch, (size_t)job->merkle_count * 32},
+    };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int p = 0; p < 4; p++) {
+        const uint8_t *bytes = (const uint8_t *)parts[p].data;
+        for (size_t i = 0; i < parts[p].len; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+        // Lengths too, so moving bytes between parts changes the key
+        hash = (hash ^ parts[p].len) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ extranonce2_len) * 0x100000001b3ULL;
+    return hash ? hash : 1;
+}
+
+// The memo entry holds exactly this coinbase and these branches; a key
+// collision must not reuse another coinbase's midstate and merkle root
+static bool memo_matches(const work_prep_memo_t *memo, const StratumJob *job, const uint8_t *extranonce1,
+                         size_t extranonce1_len, size_t extranonce2_len) {
+    return memo->coinb1_len == job->coinb1_len && memo->extranonce1_len == extranonce1_len &&
+           memo->coinb2_len == job->coinb2_len && memo->merkle_count == job->merkle_count &&
+           memo->extranonce2_len == extranonce2_len &&
+           memcmp(memo->coinb1, job->coinb1, job->coinb1_len) == 0 &&
+           memcmp(memo->extranonce1, extranonce1, extranonce1_len) == 0 &&
+           memcmp(memo->coinb2, job->coinb2, job->coinb2_len) == 0 &&
+           memcmp(memo->merkle_branch, job->merkle_branch, (size_t)job->merkle_count * 32) == 0;
+}
+
+// Coinbase of the snapshot's job and the merkle root of extranonce2 0, from the memo when
+// the same content was prepared before
+static bool prepare_coinbase(work_prep_t *prep, const job_snapshot_t *snapshot, const uint8_t *extranonce2,
+                             size_t extranonce2_len, uint8_t *merkle_root) {
+    const StratumJob *job = &snapshot->job;
+    CoinbaseMidstate *coinbase = &prep->coinbase;
+    uint64_t key = memo_key(job, snapshot->extranonce1, snapshot->extranonce1_len, extranonce2_len);
+    for (int i = 0; i < WORK_PREP_MEMO_SIZE; i++) {
+        work_prep_memo_t *memo = &prep->memo[i];
+        if (memo->key != key ||
+            !memo_matches(memo, job, snapshot->extranonce1, snapshot->extranonce1_len, extranonce2_len)) {
+            continue;
+        }
+        memcpy(coinbase->midstate, memo->midstate, sizeof(coinbase->midstate));
+        memcpy(coinbase->prefix_tail, memo->prefix_tail, memo->prefix_tail_len);
+        coinbase->prefix_tail_len = memo->prefix_tail_len;
+        coinbase->prefix_len = memo->prefix_len;
+        coinbase->coinb2_len = job->coinb2_len;
+        memcpy(coinbase->coinb2, job->coinb2, job->coinb2_len);
+        coinbase->merkle_count = job->merkle_count;
+        memcpy(coinbase->merkle_branch, job->merkle_branch, job->merkle_count * 32);
+        coinbase->valid = true;
+        memcpy(merkle_root, memo->merkle_root, 32);
+        __atomic_fetch_add(&prep->coinbases_reused, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&prep->roots_reused, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    if (!initCoinbaseMidstate(coinbase, job, snapshot->extranonce1, snapshot->extranonce1_len)) return false;
+    coinbaseMerkleRoot(coinbase, extranonce2, extranonce2_len, merkle_root);
+
+    work_prep_memo_t *memo = &prep->memo[prep->memo_next];
+    prep->memo_next = (prep->memo_next + 1) % WORK_PREP_MEMO_SIZE;
+    memo->key = key;
+    memcpy(memo->coinb1, job->coinb1, job->coinb1_len);
+    memo->coinb1_len = job->coinb1_len;
+    memcpy(memo->extranonce1, snapshot->extranonce1, snapshot->extranonce1_len);
+    memo->extranonce1_len = snapshot->extranonce1_len;
+    memcpy(memo->coinb2, job->coinb2, job->coinb2_len);
+    memo->coinb2_len = job->coinb2_len;
+    memcpy(memo->merkle_branch, job->merkle_branch, (size_t)job->merkle_count * 32);
+    memo->merkle_count = job->merkle_count;
+    memo->extranonce2_len = extranonce2_len;
+    memcpy(memo->midstate, coinbase->midstate, sizeof(memo->midstate));
+    memcpy(memo->prefix_tail, coinbase->prefix_tail, coinbase->prefix_tail_len);
+    memo->prefix_tail_len = coinbase->prefix_tail_len;
+    memo->prefix_len = coinbase->prefix_len;
+    memcpy(memo->merkle_root, merkle_root, 32);
+    return true;
+}
+
+void work_prep_begin_job(work_prep_t *prep, const nonce_space_t *space, const job_snapshot_t *snapshot) {
+    const StratumJob *job = &snapshot->job;
+    prep->generation = snapshot->generation;
+    prep->next_header = 0;
+    prep->version_mask = snapshot->version_mask;
+    prep->scratch_valid = false;
+
+    // The header template: every field but the merkle root, version bits and
+    // ntime is the same for all headers of the job. The cache keeps the last
+    // midstate, for a first block the new job repeats.
+    prepared_header_t *work = &prep->scratch;
+    strncpy(work->cache.job_id, job->job_id, MAX_JOB_ID_LEN);
+    work->cache.job_id[MAX_JOB_ID_LEN] = '\0';
+    work->generation = prep->generation;
+    work->job_ntime = job->ntime;
+    work->received_ms = job->received_ms;
+
+    nonce_unit_t first;
+    uint8_t merkle_root[32];
+    if (job->job_id[0] != '\0' && nonce_space_header_unit(space, prep->generation, 0, &first)) {
+        uint8_t extranonce2[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+        size_t extranonce2_len = nonce_space_extranonce2_bytes(space, first.extranonce2, extranonce2,
+                                                               sizeof(extranonce2));
+        if (prepare_coinbase(prep, snapshot, extranonce2, extranonce2_len, merkle_root)) {
+            fillJobHeader(work->header, 0, job, merkle_root);
+            prep->extranonce2 = first.extranonce2;
+            prep->scratch_valid = true;
+            if (prepare_header(prep, space, 0)) prep->next_header = 1;
+        }
+    }
+}
+
+bool work_prep_refill(work_prep_t *prep, const nonce_space_t *space) {
+    if (prep->generation == 0 || !prep->scratch_valid || nonce_space_generation(space) != prep->generation) {
+        return false;
+    }
+
+    // Workers that outran the table skip the headers they passed
+    uint64_t position = nonce_space_cursor(space, prep->generation);
+    uint32_t cursor = (uint32_t)(position >> 32);
+    if (prep->next_header < cursor) prep->next_header = cursor;
+    if (prep->next_header - cursor >= WORK_PREP_SLOTS) return false;
+
+    nonce_unit_t unit;
+    if (!nonce_space_header_unit(space, prep->generation, prep->next_header, &unit)) return false;
+
+    // A header holds 2^32 nonces and most jobs are replaced before the
+    // cursor leaves it: a new coinbase is only hashed for the header in use
+    // or the one the cursor is about to reach
+    bool same_root = unit.extranonce2 == prep->extranonce2;
+    bool reached = prep->next_header == cursor ||
+                   (prep->next_header == cursor + 1 && (uint32_t)position >= WORK_PREP_NEAR_END);
+    if (!same_root && !reached) return false;
+
+    if (!prepare_header(prep, space, prep->next_header)) return false;
+    prep->next_header++;
+    return true;
+}
+
+bool work_prep_run(work_prep_t *prep, const nonce_space_t *space, job_slot_t *slot) {
+    if (job_slot_published(slot) != prep->published) {
+        // The job is published just before its nonce space starts; until
+        // then its headers have no units
+        if (!job_slot_read(slot, &prep->job) || nonce_space_generation(space) != prep->job.generation) {
+            return false;
+        }
+        prep->published = prep->job.published;
+        work_prep_begin_job(prep, space, &prep->job);
+        return prep->next_header > 0;
+    }
+    return work_prep_refill(prep, space);
+}
+
+bool work_prep_take(work_prep_t *prep, const nonce_unit_t *unit, prepared_header_t *out) {
+    work_prep_slot_t *slot = &prep->slots[unit->header % WORK_PREP_SLOTS];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    bool taken = false;
+    if ((seq & 1) == 0) {
+        memcpy(out, &slot->work, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        taken = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq && out->generation == unit->generation &&
+                out->header_index == unit->header && out->cache.valid;
+    }
+    __atomic_fetch_add(taken ? &prep->taken : &prep->missed, 1, __ATOMIC_RELAXED);
+    return taken;
+}
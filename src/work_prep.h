@@ -0,0 +1,119 @@
+#ifndef WORK_PREP_H
+#define WORK_PREP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mining_utils.h"
+#include "nonce_space.h"
+#include "job_slot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORK_PREP_SLOTS 4                // headers kept prepared from the claim cursor on
+#define WORK_PREP_MEMO_SIZE 4            // coinbases remembered across mining.notify
+#define WORK_PREP_NEAR_END 0xC0000000u   // cursor nonce from which the next coinbase is prepared
+#define WORK_PREP_POLL_MS 10             // prep task sleep with nothing to prepare
+
+// A header ready to hash: built, version bits and rolled ntime applied, with
+// its midstate and kernel state
+typedef struct {
+    uint32_t generation;                 // job of the header, 0 when empty
+    uint32_t header_index;               // nonce space header index
+    uint8_t header[80];                  // nonce 0
+    MidstateCache cache;
+    uint32_t job_ntime;                  // ntime as notified, before ntime_roll
+    unsigned long received_ms;           // millis() at the job's mining.notify
+} prepared_header_t;
+
+typedef struct {
+    volatile uint32_t seq;               // odd while the slot is rewritten
+    prepared_header_t work;
+} work_prep_slot_t;
+
+// A coinbase seen in an earlier job: its prefix midstate and the merkle root
+// of the first header (extranonce2 0), reused when a notify resends the
+// same coinbase and branches. The key only narrows the search; an entry is
+// reused once its content compares equal byte for byte.
+typedef struct {
+    uint64_t key;                        // content hash, 0 when empty
+    uint8_t coinb1[MAX_COINB1_BYTES];
+    uint32_t coinb1_len;
+    uint8_t extranonce1[MAX_EXTRANONCE1_BYTES];
+    uint32_t extranonce1_len;
+    uint8_t coinb2[MAX_COINB2_BYTES];
+    uint32_t coinb2_len;
+    uint8_t merkle_branch[MAX_MERKLE_BRANCHES][32];
+    int merkle_count;
+    uint32_t extranonce2_len;
+    uint32_t midstate[8];
+    uint8_t prefix_tail[64];
+    uint32_t prefix_tail_len;
+    uint64_t prefix_len;
+    uint8_t merkle_root[32];
+} work_prep_memo_t;
+
+// Headers of the current job prepared ahead of the workers by a prep task
+// of its own, off the hash cores: the job's first header once the job slot
+// publishes it, later ones while the claim cursor approaches them. Headers
+// that only roll the version or ntime share the merkle root and cost one
+// midstate; one with a new extranonce2 costs a coinbase hash and a merkle
+// walk, so it is only prepared once the cursor nears it.
+// Header index i lives in slots[i % WORK_PREP_SLOTS] behind a sequence
+// count, so workers copy it out without locks and fall back to building the
+// header when it is missing or being rewritten. Only the prep task writes
+// the rest.
+typedef struct {
+    work_prep_slot_t slots[WORK_PREP_SLOTS];
+    uint32_t published;                  // job slot publish the job was read from
+    job_snapshot_t job;                  // job being prepared
+    uint32_t generation;                 // job being prepared, 0 before the first
+    uint32_t next_header;                // first header index not prepared yet
+    uint32_t version_mask;               // negotiated mask the version bits go under
+    uint64_t extranonce2;                // extranonce2 whose merkle root is in scratch.header
+    bool scratch_valid;
+    prepared_header_t scratch;           // header being prepared
+    uint8_t scratch_block[64];           // first block scratch.cache.midstate was computed from
+    CoinbaseMidstate coinbase;
+    work_prep_memo_t memo[WORK_PREP_MEMO_SIZE];
+    uint32_t memo_next;                  // entry replaced next
+
+    volatile uint32_t prepared;          // headers prepared
+    volatile uint32_t taken;             // units started from a prepared header
+    volatile uint32_t missed;            // units whose header a worker built itself
+
+    // Recomputations avoided because a notify repeated earlier content
+    volatile uint32_t coinbases_reused;  // coinbase prefix compressions
+    volatile uint32_t roots_reused;      // coinbase hashes and merkle walks
+    volatile uint32_t midstates_reused;  // header midstates, first block unchanged
+} work_prep_t;
+
+void work_prep_init(work_prep_t *prep);
+// Prepares the first header of job, whose generation nonce_space_begin_job
+// started on space. A coinbase and branches already seen reuse their prefix
+// midstate and first merkle root, and a first header block equal to the
+// previous one its midstate.
+void work_prep_begin_job(work_prep_t *prep, const nonce_space_t *space, const job_snapshot_t *job);
+// Prepares the next header if it lies within WORK_PREP_SLOTS of the claim
+// cursor and shares the merkle root of the header before it; one with a new
+// extranonce2 only once it is the cursor's header or the next one with the
+// cursor past WORK_PREP_NEAR_END. At most one header per call; true if a
+// header was prepared.
+bool work_prep_refill(work_prep_t *prep, const nonce_space_t *space);
+// One step of the prep task: begins the job slot's current job once space
+// has started its generation, otherwise refills. True if a header was
+// prepared; the task sleeps WORK_PREP_POLL_MS otherwise.
+bool work_prep_run(work_prep_t *prep, const nonce_space_t *space, job_slot_t *slot);
+// Copies the prepared header of unit into out; false when it is not
+// prepared (yet), and the caller builds it
+bool work_prep_take(work_prep_t *prep, const nonce_unit_t *unit, prepared_header_t *out);
+
+// Filled by the prep task from mining_job_slot, read by all mining workers
+extern work_prep_t mining_work_prep;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
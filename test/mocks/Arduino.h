@@ -0,0 +1,5 @@
+#pragma once
+
+// Host builds of libraries that include <Arduino.h> (ArduinoJson's String
+// support) get the unit test stubs
+#include "arduino_stubs.h"
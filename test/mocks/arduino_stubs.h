@@ -1,9 +1,12 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <map>
 #include <string>
 #include <unordered_map>
@@ -61,6 +64,19 @@ public:
         return *this;
     }
 
+    bool concat(const char* s) {
+        value_ += s ? s : "";
+        return true;
+    }
+    bool concat(char c) {
+        value_ += c;
+        return true;
+    }
+    bool reserve(size_t size) {
+        value_.reserve(size);
+        return true;
+    }
+
     bool operator==(const String& other) const { return value_ == other.value_; }
     bool operator!=(const String& other) const { return !(*this == other); }
     bool operator==(const char* other) const { return value_ == (other ? other : ""); }
@@ -74,6 +90,12 @@ private:
     std::string value_;
 };
 
+// Result type of Arduino's String concatenation, named by ArduinoJson
+class StringSumHelper : public String {
+public:
+    using String::String;
+};
+
 inline String operator+(const String& lhs, const String& rhs) {
     return String(lhs.std() + rhs.std());
 }
@@ -103,12 +125,22 @@ public:
 
 inline SerialClass Serial;
 
+template <typename T>
+inline T min(T a, T b) { return (b < a) ? b : a; }
+template <typename T>
+inline T max(T a, T b) { return (a < b) ? b : a; }
+
 inline void delay(int) {}
 inline unsigned long millis() {
     static unsigned long counter = 0;
     counter += 1;
     return counter;
 }
+// Real clock so throughput probes measure something on the host
+inline unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 // File & SPIFFS stubs
 class File {
@@ -154,65 +186,80 @@ private:
 
 inline SPIFFSClass SPIFFS;
 
-// Preferences stub
+// Preferences stub: like NVS, every instance opened on the same namespace
+// sees the same keys
 class Preferences {
 public:
-    bool begin(const char*, bool) { return true; }
+    bool begin(const char* name, bool) {
+        ns_ = &namespaces()[name ? name : ""];
+        return true;
+    }
     void end() {}
     void clear() {
-        strings_.clear();
-        ints_.clear();
-        bools_.clear();
+        ns().strings.clear();
+        ns().ints.clear();
+        ns().bools.clear();
     }
 
     bool putString(const char* key, const char* value) {
-        strings_[key ? key : ""] = value ? value : "";
+        ns().strings[key ? key : ""] = value ? value : "";
         return true;
     }
 
     bool putString(const char* key, const String& value) {
-        strings_[key ? key : ""] = value.std();
+        ns().strings[key ? key : ""] = value.std();
         return true;
     }
 
     String getString(const char* key, const char* default_value = "") const {
-        auto it = strings_.find(key ? key : "");
-        if (it == strings_.end()) {
+        auto it = ns().strings.find(key ? key : "");
+        if (it == ns().strings.end()) {
             return String(default_value ? default_value : "");
         }
         return String(it->second);
     }
 
     bool putInt(const char* key, int value) {
-        ints_[key ? key : ""] = value;
+        ns().ints[key ? key : ""] = value;
         return true;
     }
 
     int getInt(const char* key, int default_value = 0) const {
-        auto it = ints_.find(key ? key : "");
-        if (it == ints_.end()) {
+        auto it = ns().ints.find(key ? key : "");
+        if (it == ns().ints.end()) {
             return default_value;
         }
         return it->second;
     }
 
     bool putBool(const char* key, bool value) {
-        bools_[key ? key : ""] = value;
+        ns().bools[key ? key : ""] = value;
         return true;
     }
 
     bool getBool(const char* key, bool default_value = false) const {
-        auto it = bools_.find(key ? key : "");
-        if (it == bools_.end()) {
+        auto it = ns().bools.find(key ? key : "");
+        if (it == ns().bools.end()) {
             return default_value;
         }
         return it->second;
     }
 
 private:
-    std::unordered_map<std::string, std::string> strings_;
-    std::unordered_map<std::string, int> ints_;
-    std::unordered_map<std::string, bool> bools_;
+    struct Namespace {
+        std::unordered_map<std::string, std::string> strings;
+        std::unordered_map<std::string, int> ints;
+        std::unordered_map<std::string, bool> bools;
+    };
+
+    static std::map<std::string, Namespace>& namespaces() {
+        static std::map<std::string, Namespace> storage;
+        return storage;
+    }
+
+    Namespace& ns() const { return ns_ ? *ns_ : namespaces()[""]; }
+
+    Namespace* ns_ = nullptr;
 };
 
 // WebServer stub
@@ -254,16 +301,87 @@ public:
     String toString() const { return String("192.168.4.1"); }
 };
 
+const int WL_CONNECTED = 3;
+
 class WiFiClass {
 public:
     void disconnect(bool) {}
     void mode(int) {}
     void softAP(const char*, const char*) {}
     IPAddress softAPIP() const { return IPAddress(); }
+    int status() const { return WL_CONNECTED; }
+    bool hostByName(const char*, IPAddress&) { return true; }
 };
 
 inline WiFiClass WiFi;
 
+// WiFiClient stub: a scripted stand-in pool. Every line the client prints is
+// passed to WiFiClient::pool(), which answers with WiFiClient::reply(); the
+// client reads replies back in order.
+class WiFiClient {
+public:
+    typedef std::function<void(const std::string& line)> Pool;
+
+    static Pool& pool() {
+        static Pool handler;
+        return handler;
+    }
+    static std::deque<std::string>& inbox() {
+        static std::deque<std::string> lines;
+        return lines;
+    }
+    static void reply(const std::string& line) { inbox().push_back(line); }
+    static void reset() {
+        pool() = nullptr;
+        inbox().clear();
+    }
+
+    bool connect(const IPAddress&, int) { return connected_ = true; }
+    bool connect(const char*, int) { return connected_ = true; }
+    bool connected() const { return connected_; }
+    void stop() { connected_ = false; }
+    void setTimeout(unsigned long) {}
+
+    size_t print(const char* message) {
+        std::string text(message ? message : "");
+        size_t start = 0;
+        size_t end;
+        while ((end = text.find('\n', start)) != std::string::npos) {
+            if (pool()) pool()(text.substr(start, end - start));
+            start = end + 1;
+        }
+        return text.size();
+    }
+
+    int available() const { return inbox().empty() ? 0 : (int)inbox().front().size() + 1; }
+
+    String readStringUntil(char) {
+        if (inbox().empty()) return String();
+        String line(inbox().front());
+        inbox().pop_front();
+        return line;
+    }
+
+private:
+    bool connected_ = false;
+};
+
+// FreeRTOS stubs: one task, so the mutex is always free
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+const int pdTRUE = 1;
+const TickType_t portTICK_PERIOD_MS = 1;
+inline TickType_t pdMS_TO_TICKS(unsigned long ms) { return (TickType_t)ms; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    static int mutex;
+    return &mutex;
+}
+inline int xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline int xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+inline void vSemaphoreDelete(SemaphoreHandle_t) {}
+inline void vTaskDelay(TickType_t) {}
+inline void esp_task_wdt_reset() {}
+
 // ESP stub
 class ESPClass {
 public:
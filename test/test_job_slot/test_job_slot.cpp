@@ -0,0 +1,283 @@
+#define UNIT_TEST
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "job_slot.h"
+
+static job_slot_t slot;
+static StratumState state;
+
+// A job whose every byte follows from n, so a snapshot mixing two jobs shows
+static void make_job(uint32_t n) {
+    StratumJob &job = state.current_job;
+    memset(&job, 0, sizeof(job));
+    snprintf(job.job_id, sizeof(job.job_id), "job%u", n);
+    memset(job.prevhash, (uint8_t)n, sizeof(job.prevhash));
+    job.coinb1_len = MAX_COINB1_BYTES;
+    memset(job.coinb1, (uint8_t)(n + 1), job.coinb1_len);
+    job.coinb2_len = MAX_COINB2_BYTES;
+    memset(job.coinb2, (uint8_t)(n + 2), job.coinb2_len);
+    job.merkle_count = MAX_MERKLE_BRANCHES;
+    memset(job.merkle_branch, (uint8_t)(n + 3), sizeof(job.merkle_branch));
+    job.version = 0x20000000;
+    job.nbits = 0x1c2ac4af;
+    job.ntime = n;
+    job.received_ms = n;
+    memset(state.extranonce1, (uint8_t)(n + 4), sizeof(state.extranonce1));
+    state.extranonce1_len = 4;
+}
+
+// The snapshot holds one whole job, the one of its generation
+static bool consistent(const job_snapshot_t &snapshot) {
+    uint32_t n = snapshot.job.ntime;
+    const StratumJob &job = snapshot.job;
+    char job_id[MAX_JOB_ID_LEN + 1];
+    snprintf(job_id, sizeof(job_id), "job%u", n);
+    if (snapshot.generation != n || strcmp(job.job_id, job_id) != 0 || job.received_ms != n) return false;
+    for (size_t i = 0; i < sizeof(job.prevhash); i++) {
+        if (job.prevhash[i] != (uint8_t)n) return false;
+    }
+    for (size_t i = 0; i < job.coinb1_len; i++) {
+        if (job.coinb1[i] != (uint8_t)(n + 1)) return false;
+    }
+    for (size_t i = 0; i < job.coinb2_len; i++) {
+        if (job.coinb2[i] != (uint8_t)(n + 2)) return false;
+    }
+    const uint8_t *branches = &job.merkle_branch[0][0];
+    for (size_t i = 0; i < sizeof(job.merkle_branch); i++) {
+        if (branches[i] != (uint8_t)(n + 3)) return false;
+    }
+    for (int i = 0; i < snapshot.extranonce1_len; i++) {
+        if (snapshot.extranonce1[i] != (uint8_t)(n + 4)) return false;
+    }
+    return job.coinb1_len == MAX_COINB1_BYTES && job.coinb2_len == MAX_COINB2_BYTES &&
+           job.merkle_count == MAX_MERKLE_BRANCHES && snapshot.extranonce1_len == 4;
+}
+
+void setUp() {
+    job_slot_init(&slot);
+    state = StratumState();
+}
+
+void tearDown() {}
+
+static void test_nothing_before_first_publish() {
+    job_snapshot_t snapshot;
+    TEST_ASSERT_EQUAL_UINT32(0, job_slot_published(&slot));
+    TEST_ASSERT_FALSE(job_slot_read(&slot, &snapshot));
+    char job_id[8] = "stale";
+    job_slot_read_id(&slot, job_id, sizeof(job_id));
+    TEST_ASSERT_EQUAL_STRING("", job_id);
+}
+
+// The snapshot carries the job and the session it is mined in
+static void test_publish_copies_job_and_session() {
+    make_job(7);
+    state.version_rolling = true;
+    state.version_mask = 0x1fffe000;
+    job_slot_publish(&slot, &state, 7);
+
+    job_snapshot_t snapshot;
+    TEST_ASSERT_TRUE(job_slot_read(&slot, &snapshot));
+    TEST_ASSERT_TRUE(consistent(snapshot));
+    TEST_ASSERT_EQUAL_UINT32(job_slot_published(&slot), snapshot.published);
+    TEST_ASSERT_EQUAL_HEX32(0x1fffe000, snapshot.version_mask);
+
+    // Without version rolling the mask is not applied, whatever the state holds
+    state.version_rolling = false;
+    job_slot_publish(&slot, &state, 7);
+    TEST_ASSERT_TRUE(job_slot_read(&slot, &snapshot));
+    TEST_ASSERT_EQUAL_HEX32(0, snapshot.version_mask);
+
+    char job_id[MAX_JOB_ID_LEN + 1];
+    job_slot_read_id(&slot, job_id, sizeof(job_id));
+    TEST_ASSERT_EQUAL_STRING("job7", job_id);
+    char short_id[3];
+    job_slot_read_id(&slot, short_id, sizeof(short_id));
+    TEST_ASSERT_EQUAL_STRING("jo", short_id);
+}
+
+// A publish leaves the current buffer alone, so a snapshot taken before it
+// stays whole and is only recognized as stale
+static void test_publish_fills_the_other_buffer() {
+    make_job(1);
+    job_slot_publish(&slot, &state, 1);
+    job_snapshot_t before;
+    TEST_ASSERT_TRUE(job_slot_read(&slot, &before));
+    const job_snapshot_t *current = &slot.buffers[job_slot_published(&slot) & 1].snapshot;
+
+    make_job(2);
+    job_slot_publish(&slot, &state, 2);
+    TEST_ASSERT_EQUAL_UINT32(1, current->generation);
+    TEST_ASSERT_TRUE(consistent(*current));
+    TEST_ASSERT_TRUE(before.published != job_slot_published(&slot));
+
+    job_snapshot_t after;
+    TEST_ASSERT_TRUE(job_slot_read(&slot, &after));
+    TEST_ASSERT_EQUAL_UINT32(2, after.generation);
+    TEST_ASSERT_TRUE(consistent(after));
+    TEST_ASSERT_EQUAL_UINT32(0, slot.retries);
+}
+
+// Jobs stay looked up by generation until clean_jobs, a new session or
+// JOB_HISTORY_SIZE newer jobs retire them
+static void test_history_keeps_recent_jobs() {
+    char job_id[MAX_JOB_ID_LEN + 1];
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 1, job_id, sizeof(job_id)));
+    for (uint32_t n = 1; n <= 3; n++) {
+        make_job(n);
+        TEST_ASSERT_FALSE(job_slot_publish(&slot, &state, n));
+    }
+    for (uint32_t n = 1; n <= 3; n++) {
+        char expected[8];
+        snprintf(expected, sizeof(expected), "job%u", n);
+        TEST_ASSERT_TRUE(job_slot_lookup(&slot, n, job_id, sizeof(job_id)));
+        TEST_ASSERT_EQUAL_STRING(expected, job_id);
+    }
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 4, job_id, sizeof(job_id)));
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 0, job_id, sizeof(job_id)));
+
+    // Replaced in the ring
+    for (uint32_t n = 4; n <= JOB_HISTORY_SIZE + 1; n++) {
+        make_job(n);
+        job_slot_publish(&slot, &state, n);
+    }
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 1, job_id, sizeof(job_id)));
+    TEST_ASSERT_TRUE(job_slot_lookup(&slot, 2, job_id, sizeof(job_id)));
+
+    // clean_jobs keeps only its own job
+    uint32_t clean = JOB_HISTORY_SIZE + 2;
+    make_job(clean);
+    state.current_job.clean_jobs = true;
+    TEST_ASSERT_TRUE(job_slot_publish(&slot, &state, clean));
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, clean - 1, job_id, sizeof(job_id)));
+    TEST_ASSERT_TRUE(job_slot_lookup(&slot, clean, job_id, sizeof(job_id)));
+
+    job_slot_retire_all(&slot);
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, clean, job_id, sizeof(job_id)));
+}
+
+// An abort stops the work of every earlier job and drops its shares; the
+// latency is the slowest worker's, measured from the notify
+static void test_abort_stops_earlier_jobs() {
+    TEST_ASSERT_FALSE(job_slot_aborted(&slot, 1));
+    make_job(5);
+    job_slot_publish(&slot, &state, 5);
+
+    job_slot_abort(&slot, 6, 1000);
+    TEST_ASSERT_TRUE(job_slot_aborted(&slot, 5));
+    TEST_ASSERT_FALSE(job_slot_aborted(&slot, 6));
+    TEST_ASSERT_FALSE(job_slot_aborted(&slot, 7));
+    char job_id[MAX_JOB_ID_LEN + 1];
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 5, job_id, sizeof(job_id)));
+
+    job_slot_note_abort(&slot, 4000);
+    job_slot_note_abort(&slot, 2500);
+    TEST_ASSERT_EQUAL_UINT32(1, slot.aborts);
+    TEST_ASSERT_EQUAL_UINT32(3000, slot.abort_latency_us);
+    TEST_ASSERT_EQUAL_UINT32(3000, slot.max_abort_latency_us);
+
+    // A quicker abort keeps the worst; micros() wrapping is harmless
+    job_slot_abort(&slot, 7, 0xFFFFFF00u);
+    job_slot_note_abort(&slot, 0x100);
+    TEST_ASSERT_TRUE(job_slot_aborted(&slot, 6));
+    TEST_ASSERT_EQUAL_UINT32(0x200, slot.abort_latency_us);
+    TEST_ASSERT_EQUAL_UINT32(3000, slot.max_abort_latency_us);
+}
+
+// A cancelled abort restores the jobs it stopped, shares included; only
+// publishing the aborting job retires them
+static void test_abort_cancel_restores_earlier_jobs() {
+    make_job(5);
+    job_slot_publish(&slot, &state, 5);
+    char job_id[MAX_JOB_ID_LEN + 1];
+
+    uint32_t valid_from = job_slot_abort(&slot, 6, 1000);
+    TEST_ASSERT_EQUAL_UINT32(0, valid_from);
+    TEST_ASSERT_TRUE(job_slot_aborted(&slot, 5));
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 5, job_id, sizeof(job_id)));
+    job_slot_abort_cancel(&slot, valid_from);
+    TEST_ASSERT_FALSE(job_slot_aborted(&slot, 5));
+    TEST_ASSERT_TRUE(job_slot_lookup(&slot, 5, job_id, sizeof(job_id)));
+    TEST_ASSERT_EQUAL_STRING("job5", job_id);
+    TEST_ASSERT_EQUAL_UINT32(0, slot.aborts);
+
+    // Without clean_jobs, the aborting job still retires the earlier ones
+    TEST_ASSERT_EQUAL_UINT32(0, job_slot_abort(&slot, 6, 2000));
+    make_job(6);
+    TEST_ASSERT_TRUE(job_slot_publish(&slot, &state, 6));
+    TEST_ASSERT_FALSE(job_slot_lookup(&slot, 5, job_id, sizeof(job_id)));
+    TEST_ASSERT_TRUE(job_slot_lookup(&slot, 6, job_id, sizeof(job_id)));
+
+    // A later cancel goes back to that abort, not to before it
+    TEST_ASSERT_EQUAL_UINT32(6, job_slot_abort(&slot, 7, 3000));
+    job_slot_abort_cancel(&slot, 6);
+    TEST_ASSERT_TRUE(job_slot_aborted(&slot, 5));
+    TEST_ASSERT_FALSE(job_slot_aborted(&slot, 6));
+    TEST_ASSERT_EQUAL_UINT32(1, slot.aborts);
+}
+
+// Readers racing a publisher never copy a torn job and never go back to an
+// older one
+static void test_concurrent_publish_and_read() {
+    make_job(1);
+    job_slot_publish(&slot, &state, 1);
+
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> torn(0);
+    std::atomic<uint32_t> backwards(0);
+    std::atomic<uint32_t> reads(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&]() {
+            job_snapshot_t snapshot;
+            uint32_t last = 0;
+            while (!done.load()) {
+                if (!job_slot_read(&slot, &snapshot)) continue;
+                reads++;
+                if (!consistent(snapshot)) torn++;
+                if (snapshot.generation < last) backwards++;
+                last = snapshot.generation;
+
+                char job_id[MAX_JOB_ID_LEN + 1];
+                job_slot_read_id(&slot, job_id, sizeof(job_id));
+                if (strncmp(job_id, "job", 3) != 0) torn++;
+            }
+        });
+    }
+
+    // Enough publishes that readers get preempted mid-copy even on one core
+    uint32_t n = 1;
+    while (n < 2000000) {
+        make_job(++n);
+        job_slot_publish(&slot, &state, n);
+    }
+    done = true;
+    for (std::thread &reader : readers) reader.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+    TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+    TEST_ASSERT_TRUE(reads.load() > 0);
+
+    job_snapshot_t snapshot;
+    TEST_ASSERT_TRUE(job_slot_read(&slot, &snapshot));
+    TEST_ASSERT_EQUAL_UINT32(n, snapshot.generation);
+    TEST_ASSERT_EQUAL_UINT32(n, job_slot_published(&slot));
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_nothing_before_first_publish);
+    RUN_TEST(test_publish_copies_job_and_session);
+    RUN_TEST(test_publish_fills_the_other_buffer);
+    RUN_TEST(test_history_keeps_recent_jobs);
+    RUN_TEST(test_abort_stops_earlier_jobs);
+    RUN_TEST(test_abort_cancel_restores_earlier_jobs);
+    RUN_TEST(test_concurrent_publish_and_read);
+    return UNITY_END();
+}
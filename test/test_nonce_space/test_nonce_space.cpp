@@ -0,0 +1,420 @@
+#define UNIT_TEST
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "configs.h"
+#include "nonce_space.h"
+
+static nonce_space_t space;
+
+void setUp() {
+    nonce_space_init(&space, NONCE_RANGE_SIZE);
+}
+
+void tearDown() {}
+
+static uint64_t unit_begin(const nonce_unit_t& unit) {
+    return (unit.extranonce2 << 32) | unit.nonce_start;
+}
+
+// Units sorted by position must tile [0, end) exactly: no gap, no overlap,
+// none crossing an extranonce2 boundary
+static void assert_tiles(std::vector<nonce_unit_t> units, uint64_t end) {
+    std::sort(units.begin(), units.end(), [](const nonce_unit_t& a, const nonce_unit_t& b) {
+        return unit_begin(a) < unit_begin(b);
+    });
+    uint64_t expected = 0;
+    for (const nonce_unit_t& unit : units) {
+        TEST_ASSERT_TRUE(unit_begin(unit) == expected);
+        TEST_ASSERT_TRUE(unit.nonce_count > 0);
+        TEST_ASSERT_TRUE((uint64_t)unit.nonce_start + unit.nonce_count <= (1ULL << 32));
+        expected += unit.nonce_count;
+    }
+    TEST_ASSERT_TRUE(expected == end);
+}
+
+static void test_no_work_before_first_job() {
+    nonce_unit_t unit;
+    TEST_ASSERT_FALSE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_EQUAL_UINT32(0, nonce_space_generation(&space));
+}
+
+static void test_units_follow_nonce_space() {
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    nonce_unit_t first;
+    nonce_unit_t second;
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &first));
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &second));
+
+    TEST_ASSERT_EQUAL_UINT32(1, first.generation);
+    TEST_ASSERT_TRUE(first.extranonce2 == 0);
+    TEST_ASSERT_EQUAL_UINT32(0, first.nonce_start);
+    TEST_ASSERT_EQUAL_UINT32(NONCE_RANGE_SIZE, first.nonce_count);
+    TEST_ASSERT_TRUE(second.extranonce2 == 0);
+    TEST_ASSERT_EQUAL_UINT32(NONCE_RANGE_SIZE, second.nonce_start);
+}
+
+// Units that do not divide 2^32 end each extranonce2 with a short unit; the
+// whole space of a 1-byte extranonce2 is handed out once, then refused
+static void test_extranonce2_rolls_until_exhausted() {
+    const uint32_t unit_size = 3u << 28;
+    nonce_space_init(&space, unit_size);
+    nonce_space_begin_job(&space, 1, 0, 0, 0);
+
+    std::vector<nonce_unit_t> units;
+    nonce_unit_t unit;
+    while (nonce_space_next(&space, &unit)) units.push_back(unit);
+    TEST_ASSERT_FALSE(nonce_space_next(&space, &unit));
+
+    // 5 full units and a 1/4 unit per extranonce2
+    TEST_ASSERT_EQUAL(256 * 6, units.size());
+    TEST_ASSERT_EQUAL_UINT32(1u << 28, units[5].nonce_count);
+    TEST_ASSERT_TRUE(units[6].extranonce2 == 1);
+    TEST_ASSERT_EQUAL_UINT32(0, units[6].nonce_start);
+    assert_tiles(units, 256ULL << 32);
+
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_TRUE(stats.units_issued == units.size());
+    TEST_ASSERT_TRUE(stats.nonces_issued == 256ULL << 32);
+    TEST_ASSERT_EQUAL_UINT32(255, stats.extranonce2_rolls);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.exhausted);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.overlapping_claims);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.repeated_headers);
+}
+
+// Each (extranonce2, version) header gets its whole nonce space; all the
+// versions of the mask come before the next extranonce2
+static void test_version_rolls_before_extranonce2() {
+    nonce_space_init(&space, 1u << 31);
+    nonce_space_begin_job(&space, 1, 0x00006000, 0, 0);
+
+    std::vector<nonce_unit_t> units;
+    nonce_unit_t unit;
+    while (nonce_space_next(&space, &unit)) units.push_back(unit);
+    TEST_ASSERT_EQUAL(256 * 4 * 2, units.size());
+
+    const uint32_t versions[4] = {0x0000, 0x2000, 0x4000, 0x6000};
+    for (size_t i = 0; i < units.size(); i++) {
+        TEST_ASSERT_TRUE(units[i].extranonce2 == i / 8);
+        TEST_ASSERT_EQUAL_HEX32(versions[(i / 2) % 4], units[i].version_bits);
+        TEST_ASSERT_EQUAL_UINT32((i % 2) << 31, units[i].nonce_start);
+    }
+
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(256 * 3, stats.version_rolls);
+    TEST_ASSERT_EQUAL_UINT32(255, stats.extranonce2_rolls);
+    TEST_ASSERT_TRUE(stats.nonces_issued == 1024ULL << 32);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.overlapping_claims);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.repeated_headers);
+}
+
+// BIP310 masks are usually 16 bits wide; wider ones roll only their lowest
+// NONCE_SPACE_MAX_VERSION_BITS bits
+static void test_version_rolling_uses_low_mask_bits() {
+    nonce_space_begin_job(&space, 4, 0x1fffe000, 0, 0);
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &unit));
+    TEST_ASSERT_EQUAL_HEX32(0, unit.version_bits);
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &unit));
+    TEST_ASSERT_EQUAL_UINT32(1, unit.nonce_count);
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    TEST_ASSERT_EQUAL_HEX32(0x2000, unit.version_bits);
+
+    nonce_space_begin_job(&space, 4, 0xFFFFFFFFu, 0, 0);
+    uint32_t seen = 0;
+    for (uint32_t header = 0; header < (1u << NONCE_SPACE_MAX_VERSION_BITS); header++) {
+        TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &unit));
+        TEST_ASSERT_TRUE(unit.extranonce2 == 0);
+        seen |= unit.version_bits;
+        TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    }
+    TEST_ASSERT_EQUAL_HEX32(0xFFFF, seen);
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    TEST_ASSERT_TRUE(unit.extranonce2 == 1);
+    TEST_ASSERT_EQUAL_HEX32(0, unit.version_bits);
+}
+
+// A used-up extranonce2 space starts over one ntime second later, up to the
+// roll limit
+static void test_ntime_rolls_after_extranonce2() {
+    nonce_space_init(&space, 1u << 31);
+    nonce_space_begin_job(&space, 1, 0, 2, 0);
+
+    std::vector<nonce_unit_t> units;
+    nonce_unit_t unit;
+    while (nonce_space_next(&space, &unit)) units.push_back(unit);
+    TEST_ASSERT_EQUAL(3 * 256 * 2, units.size());
+
+    for (size_t i = 0; i < units.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(i / 512, units[i].ntime_roll);
+        TEST_ASSERT_TRUE(units[i].extranonce2 == (i / 2) % 256);
+        TEST_ASSERT_EQUAL_UINT32((i % 2) << 31, units[i].nonce_start);
+    }
+
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.ntime_rolls);
+    TEST_ASSERT_EQUAL_UINT32(3 * 255, stats.extranonce2_rolls);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.overlapping_claims);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.repeated_headers);
+
+    // Versions still roll first
+    nonce_space_begin_job(&space, 1, 0x00002000, 1, 0);
+    for (int i = 0; i < 256 * 2 * 2; i++) TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_EQUAL_UINT32(1, unit.ntime_roll);
+    TEST_ASSERT_TRUE(unit.extranonce2 == 0);
+    TEST_ASSERT_EQUAL_HEX32(0, unit.version_bits);
+}
+
+static void test_new_job_starts_over() {
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    nonce_unit_t unit;
+    for (int i = 0; i < 10; i++) nonce_space_next(&space, &unit);
+
+    TEST_ASSERT_EQUAL_UINT32(2, nonce_space_next_generation(&space));
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_EQUAL_UINT32(2, unit.generation);
+    TEST_ASSERT_TRUE(unit.extranonce2 == 0);
+    TEST_ASSERT_EQUAL_UINT32(0, unit.nonce_start);
+
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.generation);
+    TEST_ASSERT_TRUE(stats.units_issued == 1);
+}
+
+static void test_extranonce2_formatting() {
+    char out[2 * NONCE_SPACE_MAX_EXTRANONCE2_SIZE + 1];
+
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    nonce_space_format_extranonce2(&space, 1, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("00000001", out);
+
+    nonce_space_begin_job(&space, 8, 0, 0, 0);
+    nonce_space_format_extranonce2(&space, 0x1234abcdULL, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("000000001234abcd", out);
+
+    nonce_space_begin_job(&space, 2, 0, 0, 0);
+    nonce_space_format_extranonce2(&space, 0xbeef, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("beef", out);
+
+    // No size from the pool: the 4 bytes workers always used
+    nonce_space_begin_job(&space, 0, 0, 0, 0);
+    nonce_space_format_extranonce2(&space, 0xff, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("000000ff", out);
+}
+
+static void test_extranonce2_bytes() {
+    uint8_t out[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    const uint8_t four[4] = {0x12, 0x34, 0xab, 0xcd};
+    TEST_ASSERT_EQUAL(4, nonce_space_extranonce2_bytes(&space, 0x1234abcdULL, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(four, out, 4);
+
+    // Sizes beyond 8 bytes are zero-padded at the front
+    nonce_space_begin_job(&space, 10, 0, 0, 0);
+    const uint8_t ten[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0xbe, 0xef};
+    TEST_ASSERT_EQUAL(10, nonce_space_extranonce2_bytes(&space, 0xbeef, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(ten, out, 10);
+
+    TEST_ASSERT_EQUAL(0, nonce_space_extranonce2_bytes(&space, 0xbeef, out, 4));
+}
+
+// Four threads drain a 1-byte extranonce2 space; together they must cover it
+// exactly once
+static void test_concurrent_claims_are_disjoint() {
+    nonce_space_init(&space, 1u << 24);
+    nonce_space_begin_job(&space, 1, 0, 0, 0);
+
+    std::vector<nonce_unit_t> units[4];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t, &units]() {
+            nonce_unit_t unit;
+            while (nonce_space_next(&space, &unit)) units[t].push_back(unit);
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    std::vector<nonce_unit_t> all;
+    for (int t = 0; t < 4; t++) all.insert(all.end(), units[t].begin(), units[t].end());
+    assert_tiles(all, 256ULL << 32);
+
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_TRUE(stats.nonces_issued == 256ULL << 32);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.overlapping_claims);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.repeated_headers);
+}
+
+// The duplicate work counters see past the cursor: a range handed out again
+// after a lost cursor update, and header indexes that share their fields
+static void test_duplicate_work_is_counted() {
+    nonce_space_init(&space, 1u << 20);
+    nonce_space_begin_job(&space, 1, 0x00006000, 0, 0);
+    nonce_space_job_t *job = &space.jobs[nonce_space_generation(&space) & 1];
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+
+    job->position = 1u << 19;
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    TEST_ASSERT_EQUAL_UINT32(1u << 19, unit.nonce_start);
+    TEST_ASSERT_TRUE(nonce_space_next(&space, &unit));
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.overlapping_claims);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.repeated_headers);
+
+    // A header index bit no version bit stands for: headers 4 and 5 get the
+    // fields of headers 0 and 1
+    job->version_shift = 3;
+    job->position = 4ULL << 32;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &unit));
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    TEST_ASSERT_EQUAL_UINT32(5, unit.header);
+    TEST_ASSERT_EQUAL_HEX32(0x2000, unit.version_bits);
+    TEST_ASSERT_TRUE(unit.extranonce2 == 0);
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.repeated_headers);
+}
+
+// Jobs switching under the claimers: within each generation the units must
+// still be disjoint and start from zero
+static void test_job_switches_during_claims() {
+    nonce_space_init(&space, 1u << 20);
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+
+    std::vector<nonce_unit_t> units[3];
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([t, &units, &stop]() {
+            nonce_unit_t unit;
+            while (!stop) {
+                if (nonce_space_next(&space, &unit)) units[t].push_back(unit);
+            }
+        });
+    }
+    for (int job = 0; job < 200; job++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        nonce_space_begin_job(&space, 4, 0, 0, 0);
+    }
+    stop = true;
+    for (std::thread& thread : threads) thread.join();
+
+    std::vector<nonce_unit_t> all;
+    for (int t = 0; t < 3; t++) all.insert(all.end(), units[t].begin(), units[t].end());
+    std::sort(all.begin(), all.end(), [](const nonce_unit_t& a, const nonce_unit_t& b) {
+        return a.generation != b.generation ? a.generation < b.generation : unit_begin(a) < unit_begin(b);
+    });
+    for (size_t i = 1; i < all.size(); i++) {
+        if (all[i].generation != all[i - 1].generation) continue;
+        TEST_ASSERT_TRUE(unit_begin(all[i]) >= unit_begin(all[i - 1]) + all[i - 1].nonce_count);
+    }
+}
+
+// Claims of any size stop at the extranonce2 boundary
+static void test_claims_of_varying_size() {
+    nonce_space_begin_job(&space, 1, 0, 0, 0);
+    std::vector<nonce_unit_t> units;
+    nonce_unit_t unit;
+    uint32_t sizes[] = {NONCE_CHUNK_MIN, 3u << 30, NONCE_CHUNK_MAX, 1};
+    for (int i = 0; nonce_space_claim(&space, sizes[i % 4], &unit); i++) {
+        TEST_ASSERT_TRUE(unit.nonce_count <= sizes[i % 4]);
+        units.push_back(unit);
+    }
+    assert_tiles(units, 256ULL << 32);
+}
+
+static void test_chunk_tracks_latency_target() {
+    nonce_chunk_tuner_t tuner;
+    nonce_chunk_init(&tuner, NONCE_RANGE_SIZE);
+    TEST_ASSERT_EQUAL_UINT32(NONCE_RANGE_SIZE, tuner.size);
+
+    // 100 kH/s and a 50 ms target: 5000 nonces, rounded to a scan batch
+    TEST_ASSERT_EQUAL_UINT32(4096, nonce_chunk_update(&tuner, 100000, 1000000, 50));
+    // A core twice as fast converges on twice the claim
+    nonce_chunk_tuner_t fast;
+    nonce_chunk_init(&fast, NONCE_RANGE_SIZE);
+    nonce_chunk_update(&fast, 1000000, 1000000, 50);
+    TEST_ASSERT_EQUAL_UINT32(49152, fast.size);
+    for (int i = 0; i < 20; i++) nonce_chunk_update(&fast, 2000000, 1000000, 50);
+    TEST_ASSERT_EQUAL_UINT32(98304, fast.size);
+
+    // Bounds, and nothing learned from an empty claim
+    TEST_ASSERT_EQUAL_UINT32(NONCE_CHUNK_MIN, nonce_chunk_update(&tuner, 10, 1000000, 50));
+    TEST_ASSERT_EQUAL_UINT32(NONCE_CHUNK_MIN, nonce_chunk_update(&tuner, 0, 0, 50));
+    nonce_chunk_tuner_t huge;
+    nonce_chunk_init(&huge, 0);
+    TEST_ASSERT_EQUAL_UINT32(NONCE_CHUNK_MIN, huge.size);
+    TEST_ASSERT_EQUAL_UINT32(NONCE_CHUNK_MAX, nonce_chunk_update(&huge, 4000000000u, 1000, 1000));
+}
+
+// The switch completes when the last worker starts hashing the job
+static void test_switch_latency_waits_for_all_workers() {
+    nonce_space_set_workers(&space, 3);
+    nonce_space_begin_job(&space, 4, 0, 0, 1000);
+    uint32_t generation = nonce_space_generation(&space);
+
+    nonce_space_note_start(&space, 0, generation, 3000);
+    nonce_space_note_start(&space, 2, generation, 9000);
+    nonce_space_stats_t stats;
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.workers_joined);
+    TEST_ASSERT_EQUAL_UINT32(2000, stats.first_hash_us);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.switch_us);
+
+    nonce_space_note_start(&space, 1, generation, 41000);
+    // A worker noting twice does not move the measurement
+    nonce_space_note_start(&space, 1, generation, 90000);
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.workers_joined);
+    TEST_ASSERT_EQUAL_UINT32(40000, stats.switch_us);
+    TEST_ASSERT_EQUAL_UINT32(40000, stats.max_switch_us);
+
+    // Faster next switch keeps the worst one; a stale generation is ignored
+    // and micros() wrapping is harmless
+    nonce_space_begin_job(&space, 4, 0, 0, 0xFFFFF000u);
+    nonce_space_note_start(&space, 0, generation, 0x1000);
+    for (uint32_t worker = 0; worker < 3; worker++) {
+        nonce_space_note_start(&space, worker, generation + 1, 0x1000);
+    }
+    nonce_space_get_stats(&space, &stats);
+    TEST_ASSERT_EQUAL_UINT32(0x2000, stats.first_hash_us);
+    TEST_ASSERT_EQUAL_UINT32(0x2000, stats.switch_us);
+    TEST_ASSERT_EQUAL_UINT32(40000, stats.max_switch_us);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_no_work_before_first_job);
+    RUN_TEST(test_units_follow_nonce_space);
+    RUN_TEST(test_extranonce2_rolls_until_exhausted);
+    RUN_TEST(test_version_rolls_before_extranonce2);
+    RUN_TEST(test_version_rolling_uses_low_mask_bits);
+    RUN_TEST(test_ntime_rolls_after_extranonce2);
+    RUN_TEST(test_new_job_starts_over);
+    RUN_TEST(test_extranonce2_formatting);
+    RUN_TEST(test_extranonce2_bytes);
+    RUN_TEST(test_concurrent_claims_are_disjoint);
+    RUN_TEST(test_duplicate_work_is_counted);
+    RUN_TEST(test_job_switches_during_claims);
+    RUN_TEST(test_claims_of_varying_size);
+    RUN_TEST(test_chunk_tracks_latency_target);
+    RUN_TEST(test_switch_latency_waits_for_all_workers);
+    return UNITY_END();
+}
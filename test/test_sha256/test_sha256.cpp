@@ -0,0 +1,247 @@
+#define UNIT_TEST
+
+#include <cstdlib>
+#include <cstring>
+#include <unity.h>
+
+#include "configs.h"
+#include "sha256_optimized.h"
+#include "sha256_avx2.h"
+#include "sha256_shani.h"
+
+// Real block headers (80 bytes, wire order) and their double SHA-256 in raw
+// digest byte order (the block explorer hash reversed).
+struct KnownHeader {
+    const char* name;
+    const char* header_hex;
+    const char* hash_hex;
+};
+
+static const KnownHeader KNOWN_HEADERS[] = {
+    {"genesis",
+     "0100000000000000000000000000000000000000000000000000000000000000000000003ba3edfd"
+     "7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a29ab5f49ffff001d1dac2b7c",
+     "6fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000"},
+    {"block 100000",
+     "0100000050120119172a610421a6c3011dd330d9df07b63616c2cc1f1cd00200000000006657a925"
+     "2aacd5c0b2940996ecff952228c3067cc38d4885efb5a4ac4247e9f337221b4d4c86041b0f2b5710",
+     "06e533fd1ada86391f3f6c343204b0d278d4aaec1c0b20aa27ba030000000000"},
+    {"block 125552",
+     "0100000081cd02ab7e569e8bcd9317e2fe99f2de44d49ab2b8851ba4a308000000000000e320b6c2"
+     "fffc8d750423db8b1eb942ae710e951ed797f7affc8892b0f1fc122bc7f5d74df2b9441a42a14695",
+     "1dbd981fe6985776b644b173a4d0385ddc1aa2a829688d1e0000000000000000"},
+};
+static const int KNOWN_HEADER_COUNT = sizeof(KNOWN_HEADERS) / sizeof(KNOWN_HEADERS[0]);
+
+static void decode_hex(const char* hex, uint8_t* out) {
+    for (size_t i = 0; hex[i * 2] && hex[i * 2 + 1]; i++) {
+        char byte_str[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+        out[i] = (uint8_t)strtoul(byte_str, NULL, 16);
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_bitcoin_hash_matches_known_headers() {
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        uint8_t expected[32];
+        uint8_t hash[32];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+        decode_hex(KNOWN_HEADERS[i].hash_hex, expected);
+
+        sha256_esp32_bitcoin_hash(header, hash);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, hash, 32, KNOWN_HEADERS[i].name);
+    }
+}
+
+// FIPS 180-2 vectors for the generic transform: one block and two blocks
+static void test_single_hash_matches_nist_vectors() {
+    const char* messages[] = {"abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    const char* digests[] = {
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    };
+    for (int i = 0; i < 2; i++) {
+        uint8_t expected[32];
+        uint8_t hash[32];
+        decode_hex(digests[i], expected);
+        sha256_esp32_hash((const uint8_t*)messages[i], strlen(messages[i]), hash);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, hash, 32, messages[i]);
+    }
+}
+
+static void test_midstate_fast_hash_matches_full_hash() {
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        uint8_t expected[32];
+        uint8_t hash[32];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+        sha256_esp32_bitcoin_hash(header, expected);
+
+        uint32_t midstate[8];
+        sha256_compute_midstate(header, 64, midstate);
+        sha256_bitcoin_hash_fast(midstate, header + 64, 16, hash);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, hash, 32, KNOWN_HEADERS[i].name);
+    }
+}
+
+static void test_specialized_kernels_match_full_hash() {
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+
+        uint32_t midstate[8];
+        sha256_compute_midstate(header, 64, midstate);
+        sha256d_job_t job;
+        sha256d_job_init(&job, midstate, header);
+
+        // Walk nonces around the real one; the winning nonce itself must pass
+        // the 4-byte early reject since every known header has >= 32 zero bits
+        uint32_t real_nonce = *(uint32_t*)(header + 76);
+        for (uint32_t nonce = real_nonce - 64; nonce != real_nonce + 64; nonce++) {
+            uint8_t expected[32];
+            uint8_t hash[32];
+            *(uint32_t*)(header + 76) = nonce;
+            sha256_esp32_bitcoin_hash(header, expected);
+
+            sha256d_job_hash(&job, nonce, hash);
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, hash, 32, KNOWN_HEADERS[i].name);
+
+            bool candidate = sha256d_job_check(&job, nonce, 4, hash);
+            TEST_ASSERT_EQUAL(nonce == real_nonce, candidate);
+            if (candidate) {
+                TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expected, hash, 32, KNOWN_HEADERS[i].name);
+            }
+        }
+    }
+}
+
+static void test_scan_reports_real_nonce() {
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+
+        uint32_t midstate[8];
+        sha256_compute_midstate(header, 64, midstate);
+        sha256d_job_t job;
+        sha256d_job_init(&job, midstate, header);
+
+        sha256d_target_t target;
+        sha256d_target_init(&target, 4);
+        uint32_t hits[4];
+        uint32_t real_nonce = *(uint32_t*)(header + 76);
+        size_t found = sha256d_scan(&job, real_nonce - 1000, 2000, &target, hits, 4);
+        TEST_ASSERT_EQUAL_MESSAGE(1, found, KNOWN_HEADERS[i].name);
+        TEST_ASSERT_EQUAL_UINT32(real_nonce, hits[0]);
+    }
+}
+
+static void test_selected_scan_matches_scalar_scan() {
+    sha256d_scan_fn scan = sha256d_scan_select();
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+
+        uint32_t midstate[8];
+        sha256_compute_midstate(header, 64, midstate);
+        sha256d_job_t job;
+        sha256d_job_init(&job, midstate, header);
+
+        // One zero byte gives ~1/256 hits; odd start and count exercise the
+        // unaligned remainder of the 8-lane kernel
+        sha256d_target_t target;
+        sha256d_target_init(&target, 1);
+        uint32_t expected[64];
+        uint32_t hits[64];
+        size_t expected_found = sha256d_scan(&job, 12345, 8191, &target, expected, 64);
+        size_t found = scan(&job, 12345, 8191, &target, hits, 64);
+        TEST_ASSERT_EQUAL_MESSAGE(expected_found, found, KNOWN_HEADERS[i].name);
+        TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, hits, found);
+
+        // A small hit buffer stops both kernels at the same nonce
+        expected_found = sha256d_scan(&job, 0, 8192, &target, expected, 3);
+        found = scan(&job, 0, 8192, &target, hits, 3);
+        TEST_ASSERT_EQUAL(3, found);
+        TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, hits, 3);
+
+        sha256d_target_init(&target, 4);
+        uint32_t real_nonce = *(uint32_t*)(header + 76);
+        found = scan(&job, real_nonce - 1003, 2000, &target, hits, 4);
+        TEST_ASSERT_EQUAL_MESSAGE(1, found, KNOWN_HEADERS[i].name);
+        TEST_ASSERT_EQUAL_UINT32(real_nonce, hits[0]);
+    }
+}
+
+static void test_shani_kernels_match_software() {
+#if SHA256_HAVE_SHANI
+    if (!sha256_shani_available()) {
+        TEST_IGNORE_MESSAGE("SHA extensions not available");
+    }
+
+    // Pseudo-random blocks through the compression function
+    uint8_t block[64];
+    uint32_t seed = 0x12345678;
+    for (int round = 0; round < 64; round++) {
+        for (int i = 0; i < 64; i++) {
+            seed = seed * 1103515245 + 12345;
+            block[i] = (uint8_t)(seed >> 16);
+        }
+        uint32_t expected[8];
+        uint32_t state[8];
+        for (int i = 0; i < 8; i++) expected[i] = state[i] = sha256_h0[i] ^ seed;
+        sha256_transform(expected, block);
+        sha256_shani_transform(state, block);
+        TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, state, 8);
+
+        uint8_t expected_hash[32];
+        uint8_t hash[32];
+        sha256d_64(block, expected_hash);
+        sha256d_64_shani(block, hash);
+        TEST_ASSERT_EQUAL_MEMORY(expected_hash, hash, 32);
+    }
+
+    for (int i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        uint8_t header[80];
+        decode_hex(KNOWN_HEADERS[i].header_hex, header);
+
+        uint32_t midstate[8];
+        sha256_compute_midstate(header, 64, midstate);
+        sha256d_job_t job;
+        sha256d_job_init(&job, midstate, header);
+
+        sha256d_target_t target;
+        sha256d_target_init(&target, 1);
+        uint32_t expected[64];
+        uint32_t hits[64];
+        size_t expected_found = sha256d_scan(&job, 777, 8192, &target, expected, 64);
+        size_t found = sha256d_scan_shani(&job, 777, 8192, &target, hits, 64);
+        TEST_ASSERT_EQUAL_MESSAGE(expected_found, found, KNOWN_HEADERS[i].name);
+        TEST_ASSERT_EQUAL_UINT32_ARRAY(expected, hits, found);
+
+        sha256d_target_init(&target, 4);
+        uint32_t real_nonce = *(uint32_t*)(header + 76);
+        found = sha256d_scan_shani(&job, real_nonce - 1000, 2000, &target, hits, 4);
+        TEST_ASSERT_EQUAL_MESSAGE(1, found, KNOWN_HEADERS[i].name);
+        TEST_ASSERT_EQUAL_UINT32(real_nonce, hits[0]);
+    }
+#else
+    TEST_IGNORE_MESSAGE("SHA extension kernels not built for this target");
+#endif
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_bitcoin_hash_matches_known_headers);
+    RUN_TEST(test_single_hash_matches_nist_vectors);
+    RUN_TEST(test_midstate_fast_hash_matches_full_hash);
+    RUN_TEST(test_specialized_kernels_match_full_hash);
+    RUN_TEST(test_scan_reports_real_nonce);
+    RUN_TEST(test_selected_scan_matches_scalar_scan);
+    RUN_TEST(test_shani_kernels_match_software);
+    return UNITY_END();
+}
@@ -0,0 +1,263 @@
+#define UNIT_TEST
+
+#include <cstring>
+#include <unity.h>
+
+#include "arduino_stubs.h"
+
+#include "configs.h"
+#include "sha256_backend.h"
+#include "sha256_optimized.h"
+
+// Counts every nonce a backend is asked to hash, so tests can tell a
+// self-test (a few hundred nonces) from a throughput probe
+static uint32_t counted_nonces = 0;
+
+static size_t counting_scan(const sha256d_job_t* job, uint32_t nonce_start, uint32_t count,
+                            const sha256d_target_t* target, uint32_t* hits, size_t max_hits) {
+    counted_nonces += count;
+    return sha256d_scan(job, nonce_start, count, target, hits, max_hits);
+}
+
+// Never reports a hit
+static size_t blind_scan(const sha256d_job_t*, uint32_t, uint32_t, const sha256d_target_t*, uint32_t*, size_t) {
+    return 0;
+}
+
+// Reports every hit one nonce late
+static size_t off_by_one_scan(const sha256d_job_t* job, uint32_t nonce_start, uint32_t count,
+                              const sha256d_target_t* target, uint32_t* hits, size_t max_hits) {
+    size_t found = sha256d_scan(job, nonce_start, count, target, hits, max_hits);
+    for (size_t i = 0; i < found; i++) hits[i]++;
+    return found;
+}
+
+static bool never_available() {
+    return false;
+}
+
+static const sha256_backend_t COUNTING = {"counting", counting_scan, NULL, NULL};
+static const sha256_backend_t BLIND = {"blind", blind_scan, NULL, NULL};
+static const sha256_backend_t OFF_BY_ONE = {"off_by_one", off_by_one_scan, NULL, NULL};
+static const sha256_backend_t UNAVAILABLE = {"unavailable", sha256d_scan, never_available, NULL};
+
+// Assignment candidates: two drivers of one engine and two software kernels
+static const sha256_backend_t ENGINE = {"engine", sha256d_scan, NULL, "sha_engine"};
+static const sha256_backend_t ENGINE_LIB = {"engine_lib", sha256d_scan, NULL, "sha_engine"};
+static const sha256_backend_t SOFT_FAST = {"soft_fast", sha256d_scan, NULL, NULL};
+static const sha256_backend_t SOFT_SLOW = {"soft_slow", sha256d_scan, NULL, NULL};
+static const sha256_backend_t* const CANDIDATES[] = {&ENGINE, &ENGINE_LIB, &SOFT_FAST, &SOFT_SLOW};
+
+static void given_cached_choice(const char* version, const char* name) {
+    Preferences prefs;
+    prefs.begin(SHA256_BACKEND_PREFS_NAMESPACE, false);
+    prefs.clear();
+    prefs.putString("version", version);
+    prefs.putInt("workers", 1);
+    prefs.putString("name", name);
+    prefs.end();
+}
+
+static String cached_name() {
+    Preferences prefs;
+    prefs.begin(SHA256_BACKEND_PREFS_NAMESPACE, true);
+    String name = prefs.getString("name", "");
+    prefs.end();
+    return name;
+}
+
+void setUp() {
+    sha256_backend_register_builtin();
+    sha256_backend_register(&COUNTING);
+    sha256_backend_register(&BLIND);
+    sha256_backend_register(&OFF_BY_ONE);
+    sha256_backend_register(&UNAVAILABLE);
+    counted_nonces = 0;
+}
+
+void tearDown() {}
+
+static void test_builtin_backends_pass_self_test() {
+    TEST_ASSERT_NOT_NULL(sha256_backend_find("generic"));
+    TEST_ASSERT_NOT_NULL(sha256_backend_find("specialized"));
+    for (size_t i = 0; i < sha256_backend_count(); i++) {
+        const sha256_backend_t* backend = sha256_backend_get(i);
+        if (backend == &BLIND || backend == &OFF_BY_ONE) continue;
+        if (backend->available && !backend->available()) continue;
+        TEST_ASSERT_TRUE_MESSAGE(sha256_backend_self_test(backend), backend->name);
+    }
+}
+
+static void test_self_test_rejects_wrong_kernels() {
+    TEST_ASSERT_FALSE(sha256_backend_self_test(&BLIND));
+    TEST_ASSERT_FALSE(sha256_backend_self_test(&OFF_BY_ONE));
+    TEST_ASSERT_FALSE(sha256_backend_self_test(NULL));
+}
+
+static void test_register_rejects_duplicates() {
+    size_t count = sha256_backend_count();
+    TEST_ASSERT_FALSE(sha256_backend_register(&COUNTING));
+    sha256_backend_register_builtin();
+    TEST_ASSERT_EQUAL(count, sha256_backend_count());
+}
+
+static void test_probe_reports_throughput() {
+    TEST_ASSERT_TRUE(sha256_backend_probe(sha256_backend_find("specialized")) > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, sha256_backend_probe(NULL));
+}
+
+static void test_select_probes_and_caches_correct_backend() {
+    given_cached_choice("", "");
+    const sha256_backend_t* selected = sha256_backend_select();
+
+    TEST_ASSERT_NOT_NULL(selected);
+    TEST_ASSERT_TRUE(selected != &BLIND && selected != &OFF_BY_ONE && selected != &UNAVAILABLE);
+    TEST_ASSERT_EQUAL_PTR(selected, sha256_backend_active());
+    TEST_ASSERT_TRUE(counted_nonces >= SHA256_BACKEND_PROBE_NONCES);
+    TEST_ASSERT_TRUE(cached_name() == selected->name);
+}
+
+static void test_cached_choice_skips_probe() {
+    given_cached_choice(MINER_VERSION, "counting");
+    const sha256_backend_t* selected = sha256_backend_select();
+
+    TEST_ASSERT_EQUAL_PTR(&COUNTING, selected);
+    // Only the self-test of the cached backend ran
+    TEST_ASSERT_TRUE(counted_nonces > 0);
+    TEST_ASSERT_TRUE(counted_nonces < SHA256_BACKEND_PROBE_NONCES);
+}
+
+static void test_cache_from_other_firmware_is_ignored() {
+    given_cached_choice("YAMUNA/0.9", "counting");
+    sha256_backend_select();
+    TEST_ASSERT_TRUE(counted_nonces >= SHA256_BACKEND_PROBE_NONCES);
+}
+
+static void test_cached_broken_backend_is_replaced() {
+    given_cached_choice(MINER_VERSION, "off_by_one");
+    const sha256_backend_t* selected = sha256_backend_select();
+
+    TEST_ASSERT_NOT_NULL(selected);
+    TEST_ASSERT_TRUE(selected != &OFF_BY_ONE);
+    TEST_ASSERT_TRUE(cached_name() == selected->name);
+}
+
+static void test_assign_gives_engine_to_one_worker() {
+    const uint32_t rates[] = {30000, 20000, 10000, 5000};
+    const sha256_backend_t* assignment[3];
+
+    TEST_ASSERT_EQUAL(2, sha256_backend_assign(CANDIDATES, rates, 4, assignment, 2));
+    TEST_ASSERT_EQUAL_PTR(&ENGINE, assignment[0]);
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[1]);
+
+    // Neither driver of the taken engine goes to a third worker
+    TEST_ASSERT_EQUAL(3, sha256_backend_assign(CANDIDATES, rates, 4, assignment, 3));
+    TEST_ASSERT_EQUAL_PTR(&ENGINE, assignment[0]);
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[1]);
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[2]);
+}
+
+static void test_assign_keeps_software_when_faster() {
+    const uint32_t rates[] = {8000, 6000, 10000, 5000};
+    const sha256_backend_t* assignment[2];
+
+    TEST_ASSERT_EQUAL(2, sha256_backend_assign(CANDIDATES, rates, 4, assignment, 2));
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[0]);
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[1]);
+
+    // On a tie the engine stays free
+    const uint32_t tied[] = {10000, 0, 10000, 0};
+    TEST_ASSERT_EQUAL(2, sha256_backend_assign(CANDIDATES, tied, 4, assignment, 2));
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[0]);
+    TEST_ASSERT_EQUAL_PTR(&SOFT_FAST, assignment[1]);
+}
+
+static void test_assign_skips_unusable_backends() {
+    const sha256_backend_t* assignment[2];
+
+    // Only the engine works: the second worker gets nothing
+    const uint32_t engine_only[] = {30000, 0, 0, 0};
+    TEST_ASSERT_EQUAL(1, sha256_backend_assign(CANDIDATES, engine_only, 4, assignment, 2));
+    TEST_ASSERT_EQUAL_PTR(&ENGINE, assignment[0]);
+    TEST_ASSERT_NULL(assignment[1]);
+
+    const uint32_t none[] = {0, 0, 0, 0};
+    TEST_ASSERT_EQUAL(0, sha256_backend_assign(CANDIDATES, none, 4, assignment, 2));
+    TEST_ASSERT_NULL(assignment[0]);
+}
+
+static void test_select_workers_plans_and_caches() {
+    given_cached_choice("", "");
+    TEST_ASSERT_EQUAL(2, sha256_backend_select_workers(2));
+    TEST_ASSERT_NOT_NULL(sha256_backend_for_worker(0));
+    TEST_ASSERT_NOT_NULL(sha256_backend_for_worker(1));
+    TEST_ASSERT_EQUAL_PTR(sha256_backend_active(), sha256_backend_for_worker(0));
+    // Workers beyond the plan get the default kernel, never a planned engine
+    TEST_ASSERT_NULL(sha256_backend_for_worker(5));
+    TEST_ASSERT_TRUE(counted_nonces >= SHA256_BACKEND_PROBE_NONCES);
+
+    const sha256_backend_t* first = sha256_backend_for_worker(0);
+    const sha256_backend_t* second = sha256_backend_for_worker(1);
+    counted_nonces = 0;
+    TEST_ASSERT_EQUAL(2, sha256_backend_select_workers(2));
+    TEST_ASSERT_EQUAL_PTR(first, sha256_backend_for_worker(0));
+    TEST_ASSERT_EQUAL_PTR(second, sha256_backend_for_worker(1));
+    TEST_ASSERT_TRUE(counted_nonces < SHA256_BACKEND_PROBE_NONCES);
+
+    // A plan for another worker count is not reused
+    sha256_backend_select_workers(1);
+    TEST_ASSERT_TRUE(counted_nonces >= SHA256_BACKEND_PROBE_NONCES);
+}
+
+// A plan that left a worker without a backend is cached under the requested
+// count, so the next boot reuses it instead of probing again
+static void test_partial_plan_is_cached_for_requested_workers() {
+    given_cached_choice(MINER_VERSION, "counting");
+    Preferences prefs;
+    prefs.begin(SHA256_BACKEND_PREFS_NAMESPACE, false);
+    prefs.putInt("workers", 2);
+    prefs.putString("name1", "");
+    prefs.end();
+
+    TEST_ASSERT_EQUAL(1, sha256_backend_select_workers(2));
+    TEST_ASSERT_EQUAL_PTR(&COUNTING, sha256_backend_for_worker(0));
+    TEST_ASSERT_NULL(sha256_backend_for_worker(1));
+    TEST_ASSERT_TRUE(counted_nonces < SHA256_BACKEND_PROBE_NONCES);
+}
+
+static void test_hash_counters_per_backend() {
+    unsigned long counting = sha256_backend_hashes(&COUNTING);
+    unsigned long blind = sha256_backend_hashes(&BLIND);
+
+    sha256_backend_add_hashes(&COUNTING, 4096);
+    sha256_backend_add_hashes(&COUNTING, 100);
+    sha256_backend_add_hashes(&BLIND, 7);
+    // Unregistered backends are not counted
+    sha256_backend_add_hashes(&ENGINE, 50);
+    sha256_backend_add_hashes(NULL, 50);
+
+    TEST_ASSERT_EQUAL_UINT32(counting + 4196, sha256_backend_hashes(&COUNTING));
+    TEST_ASSERT_EQUAL_UINT32(blind + 7, sha256_backend_hashes(&BLIND));
+    TEST_ASSERT_EQUAL_UINT32(0, sha256_backend_hashes(&ENGINE));
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_builtin_backends_pass_self_test);
+    RUN_TEST(test_self_test_rejects_wrong_kernels);
+    RUN_TEST(test_register_rejects_duplicates);
+    RUN_TEST(test_probe_reports_throughput);
+    RUN_TEST(test_select_probes_and_caches_correct_backend);
+    RUN_TEST(test_cached_choice_skips_probe);
+    RUN_TEST(test_cache_from_other_firmware_is_ignored);
+    RUN_TEST(test_cached_broken_backend_is_replaced);
+    RUN_TEST(test_assign_gives_engine_to_one_worker);
+    RUN_TEST(test_assign_keeps_software_when_faster);
+    RUN_TEST(test_assign_skips_unusable_backends);
+    RUN_TEST(test_select_workers_plans_and_caches);
+    RUN_TEST(test_partial_plan_is_cached_for_requested_workers);
+    RUN_TEST(test_hash_counters_per_backend);
+    return UNITY_END();
+}
@@ -0,0 +1,625 @@
+// Host-native microbenchmarks for the SHA-256 mining kernels.
+// Run with: make bench  (pio test --environment native-bench --verbose)
+// Set YAMUNA_BENCH_JSON=<path> to also write the JSON report to a file.
+
+#define UNIT_TEST
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "configs.h"
+#include "mining_utils.h"
+#include "pool_connection.h"
+#include "sha256_optimized.h"
+#include "sha256_backend.h"
+#include "sha256_avx2.h"
+#include "sha256_shani.h"
+
+#ifndef BENCH_WARMUP_REPS
+#define BENCH_WARMUP_REPS 5
+#endif
+#ifndef BENCH_REPS
+#define BENCH_REPS 101
+#endif
+
+// ---------------------------------------------------------------------------
+// Timing
+// ---------------------------------------------------------------------------
+
+static inline uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#elif defined(__aarch64__)
+    uint64_t t;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static inline uint64_t bench_nanos() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* bench_timer_name() {
+#if defined(__x86_64__) || defined(__i386__)
+    return "rdtsc";
+#elif defined(__aarch64__)
+    return "cntvct_el0";
+#else
+    return "steady_clock";
+#endif
+}
+
+struct BenchResult {
+    std::string kernel;
+    std::string unit;
+    uint32_t ops_per_rep;
+    uint32_t reps;
+    double hps_median;
+    double hps_p99;      // throughput of the 99th-percentile (slowest 1%) repetition
+    double hps_best;
+    double cycles_per_op_median;
+    double cycles_per_op_p99;
+};
+
+static std::vector<BenchResult> bench_results;
+static volatile uint32_t bench_sink = 0;
+
+static double percentile(std::vector<double> values, double pct) {
+    std::sort(values.begin(), values.end());
+    size_t idx = (size_t)(pct * (values.size() - 1) + 0.5);
+    return values[std::min(idx, values.size() - 1)];
+}
+
+// Runs fn(i) ops_per_rep times per repetition; fn returns a word folded into a
+// sink so the compiler cannot discard the work. Batched kernels pass the number
+// of hashes one fn call performs as work_per_op so rates stay per hash.
+template <typename Fn>
+static const BenchResult& run_bench(const char* kernel, const char* unit, uint32_t ops_per_rep, Fn fn,
+                                    uint32_t work_per_op = 1) {
+    uint32_t acc = 0;
+    for (int rep = 0; rep < BENCH_WARMUP_REPS; rep++) {
+        for (uint32_t i = 0; i < ops_per_rep; i++) acc += fn(i);
+    }
+
+    std::vector<double> ns_per_op;
+    std::vector<double> cycles_per_op;
+    ns_per_op.reserve(BENCH_REPS);
+    cycles_per_op.reserve(BENCH_REPS);
+
+    for (int rep = 0; rep < BENCH_REPS; rep++) {
+        uint64_t t0 = bench_nanos();
+        uint64_t c0 = bench_cycles();
+        for (uint32_t i = 0; i < ops_per_rep; i++) acc += fn(i);
+        uint64_t c1 = bench_cycles();
+        uint64_t t1 = bench_nanos();
+        ns_per_op.push_back((double)(t1 - t0) / ((double)ops_per_rep * work_per_op));
+        cycles_per_op.push_back((double)(c1 - c0) / ((double)ops_per_rep * work_per_op));
+    }
+    bench_sink += acc;
+
+    BenchResult r;
+    r.kernel = kernel;
+    r.unit = unit;
+    r.ops_per_rep = ops_per_rep * work_per_op;
+    r.reps = BENCH_REPS;
+    r.hps_median = 1e9 / percentile(ns_per_op, 0.50);
+    r.hps_p99 = 1e9 / percentile(ns_per_op, 0.99);
+    r.hps_best = 1e9 / percentile(ns_per_op, 0.0);
+    r.cycles_per_op_median = percentile(cycles_per_op, 0.50);
+    r.cycles_per_op_p99 = percentile(cycles_per_op, 0.99);
+    bench_results.push_back(r);
+
+    printf("%-28s %12.0f %s/s median  %12.0f p99  %8.1f cycles/op\n",
+           kernel, r.hps_median, unit, r.hps_p99, r.cycles_per_op_median);
+    return bench_results.back();
+}
+
+static void write_json(FILE* out) {
+    fprintf(out, "{\n  \"suite\": \"yamuna-sha-bench\",\n");
+    fprintf(out, "  \"miner_version\": \"%s\",\n", MINER_VERSION);
+    fprintf(out, "  \"timer\": \"%s\",\n", bench_timer_name());
+    fprintf(out, "  \"warmup_reps\": %d,\n", BENCH_WARMUP_REPS);
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < bench_results.size(); i++) {
+        const BenchResult& r = bench_results[i];
+        fprintf(out,
+                "    {\"kernel\": \"%s\", \"unit\": \"%s\", \"ops_per_rep\": %u, \"reps\": %u, "
+                "\"hps_median\": %.1f, \"hps_p99\": %.1f, \"hps_best\": %.1f, "
+                "\"cycles_per_op_median\": %.2f, \"cycles_per_op_p99\": %.2f}%s\n",
+                r.kernel.c_str(), r.unit.c_str(), r.ops_per_rep, r.reps,
+                r.hps_median, r.hps_p99, r.hps_best,
+                r.cycles_per_op_median, r.cycles_per_op_p99,
+                (i + 1 < bench_results.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// ---------------------------------------------------------------------------
+// Fixtures
+// ---------------------------------------------------------------------------
+
+// Bitcoin genesis block header and its double SHA-256 (raw digest byte order)
+static const char* GENESIS_HEADER_HEX =
+    "01000000"
+    "0000000000000000000000000000000000000000000000000000000000000000"
+    "3ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a"
+    "29ab5f49" "ffff001d" "1dac2b7c";
+static const char* GENESIS_HASH_HEX =
+    "6fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000";
+
+// Synthetic coinbase sized like a real pool job (61 + 8 + 90 bytes, 12 branches)
+static const String BENCH_COINB1 =
+    "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff35"
+    "03a086010f2f5961756e612d62656e63682f08";
+static const String BENCH_COINB2 =
+    "ffffffff0200f2052a010000001976a91489abcdefabbaabbaabbaabbaabbaabbaabbaabba88ac"
+    "0000000000000000266a24aa21a9ede2f61c3f71d1defd3fa999dfa36953755c690689799962b48bebd836974e8cf9"
+    "00000000";
+static const String BENCH_EXTRANONCE1 = "f000000f";
+static const String BENCH_EXTRANONCE2 = "00000001";
+static const String BENCH_BRANCHES[12] = {
+    "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d",
+    "4bf5122f344554c53bde2ebb8cd2b7e3d1600ad631c385a5d7cce23c7785459a",
+    "dbc1b4c900ffe48d575b5da5c638040125f65db0fe3e24494b76ea986457d986",
+    "084fed08b978af4d7d196a7446a86b58009e636b611db16211b65a9aadff29c5",
+    "e52d9c508c502347344d8c07ad91cbd6068afc75ff6292f062a09ca381c89e71",
+    "e77b9a9ae9e30b0dbdb6f510a264ef9de781501d7b6b92ae89eb059c5ab743db",
+    "67586e98fad27da0b9968bc039a1ef34c939b9b8e523a8bef89d478608c5ecf6",
+    "ca358758f6d27e6cf45272937977a748fd88391db679ceda7dc7bf1f005ee879",
+    "beead77994cf573341ec17b58bbf7eb34d2711c993c1d976b128b3188dc1829a",
+    "2b4c342f5433ebe591a1da77e013d1b72475562d48578dca8b84bac6651c3cb9",
+    "01ba4719c80b6fe911b091a7c05124b64eeece964e09c058ef8f9805daca546b",
+    "e7cf46a078fed4fafd0b5e3aff144802b853f8ae459a4f0c14add3314b7cc3a6",
+};
+static const char* BENCH_MERKLE_ROOT_HEX =
+    "84dc44bf104eb8dfdef1d8f87b0010ab4b9f38bcddf83a13f383b034d7d20608";
+
+static uint8_t genesis_header[80];
+static uint8_t genesis_hash[32];
+
+void setUp() {
+    to_byte_array(GENESIS_HEADER_HEX, strlen(GENESIS_HEADER_HEX), genesis_header);
+    to_byte_array(GENESIS_HASH_HEX, strlen(GENESIS_HASH_HEX), genesis_hash);
+}
+
+void tearDown() {}
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+static void bench_sha256_transform() {
+    uint32_t state[8] = {0};
+    const BenchResult& r = run_bench("sha256_transform", "compressions", 20000, [&](uint32_t i) {
+        genesis_header[0] = (uint8_t)i;
+        sha256_transform(state, genesis_header);
+        return state[7];
+    });
+    genesis_header[0] = 0x01;
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void bench_sha256_esp32_double() {
+    uint8_t hash[32];
+    sha256_esp32_double(genesis_header, 80, hash);
+    TEST_ASSERT_EQUAL_MEMORY(genesis_hash, hash, 32);
+
+    uint8_t header[80];
+    memcpy(header, genesis_header, 80);
+    const BenchResult& r = run_bench("sha256_esp32_double", "hashes", 10000, [&](uint32_t i) {
+        *(uint32_t*)(header + 76) = i;
+        sha256_esp32_double(header, 80, hash);
+        return (uint32_t)hash[31];
+    });
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void bench_sha256_bitcoin_hash_fast() {
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    uint8_t tail[16];
+    uint8_t hash[32];
+    sha256_bitcoin_hash_fast(cache.midstate, cache.tail_data, 16, hash);
+    TEST_ASSERT_EQUAL_MEMORY(genesis_hash, hash, 32);
+
+    const BenchResult& r = run_bench("sha256_bitcoin_hash_fast", "hashes", 10000, [&](uint32_t i) {
+        memcpy(tail, cache.tail_data, 12);
+        *(uint32_t*)(tail + 12) = i;
+        sha256_bitcoin_hash_fast(cache.midstate, tail, 16, hash);
+        return (uint32_t)hash[31];
+    });
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void bench_sha256d_job_hash() {
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    uint8_t hash[32];
+    sha256d_job_hash(&cache.job, *(uint32_t*)(genesis_header + 76), hash);
+    TEST_ASSERT_EQUAL_MEMORY(genesis_hash, hash, 32);
+
+    const BenchResult& r = run_bench("sha256d_job_hash", "hashes", 10000, [&](uint32_t i) {
+        sha256d_job_hash(&cache.job, i, hash);
+        return (uint32_t)hash[31];
+    });
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void bench_sha256d_job_check() {
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    uint8_t hash[32];
+    TEST_ASSERT_TRUE(sha256d_job_check(&cache.job, *(uint32_t*)(genesis_header + 76), 4, hash));
+    TEST_ASSERT_EQUAL_MEMORY(genesis_hash, hash, 32);
+
+    // Early reject must agree with the full digest on every nonce
+    for (uint32_t nonce = 0; nonce < 4096; nonce++) {
+        uint8_t full[32];
+        sha256d_job_hash(&cache.job, nonce, full);
+        bool expected = (full[31] == 0);
+        TEST_ASSERT_EQUAL(expected, sha256d_job_check(&cache.job, nonce, 1, hash));
+        if (expected) TEST_ASSERT_EQUAL_MEMORY(full, hash, 32);
+    }
+
+    const BenchResult& r = run_bench("sha256d_job_check", "hashes", 10000, [&](uint32_t i) {
+        return (uint32_t)sha256d_job_check(&cache.job, i, 1, hash);
+    });
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void bench_sha256d_scan() {
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    sha256d_target_t target;
+    sha256d_target_init(&target, 1);
+    uint32_t hits[SCAN_MAX_HITS];
+    const BenchResult& r = run_bench("sha256d_scan", "hashes", 4, [&](uint32_t i) {
+        return (uint32_t)sha256d_scan(&cache.job, i * SCAN_BATCH_SIZE, SCAN_BATCH_SIZE, &target, hits, SCAN_MAX_HITS);
+    }, SCAN_BATCH_SIZE);
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+static void print_speedup(const BenchResult& r, const char* baseline) {
+    for (size_t i = 0; i < bench_results.size(); i++) {
+        if (bench_results[i].kernel == baseline) {
+            printf("%s speedup over %s: %.2fx\n", r.kernel.c_str(), baseline,
+                   r.hps_median / bench_results[i].hps_median);
+        }
+    }
+}
+
+// Lanes per second of the 8-way kernel against the scalar midstate path it
+// replaces; skipped on CPUs without AVX2
+static void bench_sha256d_scan_avx2() {
+#if SHA256_HAVE_AVX2
+    if (!sha256_avx2_available()) {
+        TEST_IGNORE_MESSAGE("AVX2 not available");
+    }
+
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    sha256d_target_t target;
+    sha256d_target_init(&target, 4);
+    uint32_t hits[SCAN_MAX_HITS];
+    uint32_t real_nonce = *(uint32_t*)(genesis_header + 76);
+    TEST_ASSERT_EQUAL(1, sha256d_scan_avx2(&cache.job, real_nonce - 100, 200, &target, hits, SCAN_MAX_HITS));
+    TEST_ASSERT_EQUAL_UINT32(real_nonce, hits[0]);
+
+    sha256d_target_init(&target, 1);
+    const BenchResult& r = run_bench("sha256d_scan_avx2", "hashes", 4, [&](uint32_t i) {
+        return (uint32_t)sha256d_scan_avx2(&cache.job, i * SCAN_BATCH_SIZE, SCAN_BATCH_SIZE, &target, hits,
+                                           SCAN_MAX_HITS);
+    }, SCAN_BATCH_SIZE);
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+
+    print_speedup(r, "sha256_bitcoin_hash_fast");
+#else
+    TEST_IGNORE_MESSAGE("AVX2 kernel not built for this target");
+#endif
+}
+
+static void bench_sha256d_scan_shani() {
+#if SHA256_HAVE_SHANI
+    if (!sha256_shani_available()) {
+        TEST_IGNORE_MESSAGE("SHA extensions not available");
+    }
+
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    sha256d_target_t target;
+    sha256d_target_init(&target, 4);
+    uint32_t hits[SCAN_MAX_HITS];
+    uint32_t real_nonce = *(uint32_t*)(genesis_header + 76);
+    TEST_ASSERT_EQUAL(1, sha256d_scan_shani(&cache.job, real_nonce - 100, 200, &target, hits, SCAN_MAX_HITS));
+    TEST_ASSERT_EQUAL_UINT32(real_nonce, hits[0]);
+
+    sha256d_target_init(&target, 1);
+    const BenchResult& r = run_bench("sha256d_scan_shani", "hashes", 4, [&](uint32_t i) {
+        return (uint32_t)sha256d_scan_shani(&cache.job, i * SCAN_BATCH_SIZE, SCAN_BATCH_SIZE, &target, hits,
+                                            SCAN_MAX_HITS);
+    }, SCAN_BATCH_SIZE);
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+    print_speedup(r, "sha256_bitcoin_hash_fast");
+    print_speedup(r, "sha256d_scan");
+    print_speedup(r, "sha256d_scan_avx2");
+#else
+    TEST_IGNORE_MESSAGE("SHA extension kernels not built for this target");
+#endif
+}
+
+// 64-byte merkle node double hash, portable path and the selected kernel
+static void bench_sha256d_64() {
+    uint8_t node[64];
+    memcpy(node, genesis_header, 64);
+    uint8_t expected[32];
+    uint8_t hash[32];
+    sha256_esp32_double(node, 64, expected);
+
+    sha256d_64(node, hash);
+    TEST_ASSERT_EQUAL_MEMORY(expected, hash, 32);
+    run_bench("sha256d_64", "nodes", 10000, [&](uint32_t i) {
+        *(uint32_t*)node = i;
+        sha256d_64(node, hash);
+        return (uint32_t)hash[0];
+    });
+
+    sha256d_64_fn selected = sha256d_64_select();
+    if (selected == sha256d_64) return;
+    *(uint32_t*)node = *(const uint32_t*)genesis_header;
+    selected(node, hash);
+    TEST_ASSERT_EQUAL_MEMORY(expected, hash, 32);
+    const BenchResult& r = run_bench("sha256d_64_selected", "nodes", 10000, [&](uint32_t i) {
+        *(uint32_t*)node = i;
+        selected(node, hash);
+        return (uint32_t)hash[0];
+    });
+    print_speedup(r, "sha256d_64");
+}
+
+static void bench_calculate_merkle_root() {
+    String root = calculateMerkleRoot(BENCH_COINB1, BENCH_COINB2, BENCH_EXTRANONCE1,
+                                      BENCH_EXTRANONCE2, BENCH_BRANCHES, 12);
+    TEST_ASSERT_EQUAL_STRING(BENCH_MERKLE_ROOT_HEX, root.c_str());
+
+    const BenchResult& r = run_bench("calculateMerkleRoot", "roots", 500, [&](uint32_t) {
+        String result = calculateMerkleRoot(BENCH_COINB1, BENCH_COINB2, BENCH_EXTRANONCE1,
+                                            BENCH_EXTRANONCE2, BENCH_BRANCHES, 12);
+        return (uint32_t)result[0];
+    });
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+}
+
+// Decodes the job the way mining.notify does
+static void bench_job(StratumJob* job, const String& coinb1, int branches) {
+    memset(job, 0, sizeof(*job));
+    strcpy(job->job_id, "bench");
+    job->coinb1_len = to_byte_array(coinb1.c_str(), coinb1.length(), job->coinb1);
+    job->coinb2_len = to_byte_array(BENCH_COINB2.c_str(), BENCH_COINB2.length(), job->coinb2);
+    for (int i = 0; i < branches; i++) {
+        to_byte_array(BENCH_BRANCHES[i].c_str(), 64, job->merkle_branch[i]);
+    }
+    job->merkle_count = branches;
+}
+
+static String coinbase_root_hex(const CoinbaseMidstate* cache, const String& extranonce2) {
+    uint8_t extranonce2_bytes[32];
+    to_byte_array(extranonce2.c_str(), extranonce2.length(), extranonce2_bytes);
+    uint8_t root[32];
+    coinbaseMerkleRoot(cache, extranonce2_bytes, extranonce2.length() / 2, root);
+    char hex_str[65];
+    for (int i = 0; i < 32; i++) snprintf(hex_str + i * 2, 3, "%02x", root[i]);
+    return String(hex_str);
+}
+
+// Extranonce2 rolling from the prepared coinbase prefix against the string path
+static void bench_coinbase_merkle_root() {
+    uint8_t extranonce1[4];
+    to_byte_array(BENCH_EXTRANONCE1.c_str(), BENCH_EXTRANONCE1.length(), extranonce1);
+    static StratumJob job;
+    bench_job(&job, BENCH_COINB1, 12);
+
+    CoinbaseMidstate cache;
+    TEST_ASSERT_TRUE(initCoinbaseMidstate(&cache, &job, extranonce1, sizeof(extranonce1)));
+    TEST_ASSERT_EQUAL_STRING(BENCH_MERKLE_ROOT_HEX, coinbase_root_hex(&cache, BENCH_EXTRANONCE2).c_str());
+
+    // Prefix lengths on both sides of a block boundary, extranonce2 of 4 and 8
+    // bytes, and no branches
+    const String prefixes[] = {"", "01", BENCH_COINB1.substring(0, 110), BENCH_COINB1.substring(0, 128),
+                               BENCH_COINB1.substring(0, 130), BENCH_COINB1 + BENCH_COINB1};
+    const String extranonce2s[] = {"00000001", "deadbeef00c0ffee"};
+    for (const String& coinb1 : prefixes) {
+        for (const String& extranonce2 : extranonce2s) {
+            for (int branches = 0; branches <= 12; branches += 12) {
+                bench_job(&job, coinb1, branches);
+                TEST_ASSERT_TRUE(initCoinbaseMidstate(&cache, &job, extranonce1, sizeof(extranonce1)));
+                String expected = calculateMerkleRoot(coinb1, BENCH_COINB2, BENCH_EXTRANONCE1, extranonce2,
+                                                      BENCH_BRANCHES, branches);
+                TEST_ASSERT_EQUAL_STRING(expected.c_str(), coinbase_root_hex(&cache, extranonce2).c_str());
+            }
+        }
+    }
+
+    // Headers of a job snapshot agree with and without the prepared prefix
+    bench_job(&job, BENCH_COINB1, 12);
+    static job_snapshot_t snapshot;
+    snapshot.job = job;
+    memcpy(snapshot.extranonce1, extranonce1, sizeof(extranonce1));
+    snapshot.extranonce1_len = sizeof(extranonce1);
+    TEST_ASSERT_TRUE(initCoinbaseMidstate(&cache, &job, extranonce1, sizeof(extranonce1)));
+    const uint8_t extranonce2_bytes[4] = {0x00, 0x00, 0x00, 0x01};
+    uint8_t direct[80];
+    uint8_t prepared[80];
+    TEST_ASSERT_TRUE(buildBlockHeader(direct, 7, &snapshot, extranonce2_bytes, sizeof(extranonce2_bytes)));
+    TEST_ASSERT_TRUE(buildJobHeader(prepared, 7, &job, &cache, extranonce2_bytes, sizeof(extranonce2_bytes)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(direct, prepared, 80);
+    uint8_t root[32];
+    const BenchResult& r = run_bench("coinbaseMerkleRoot", "roots", 500, [&](uint32_t i) {
+        uint8_t extranonce2[4] = {(uint8_t)(i >> 24), (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i};
+        coinbaseMerkleRoot(&cache, extranonce2, sizeof(extranonce2), root);
+        return (uint32_t)root[0];
+    });
+    print_speedup(r, "calculateMerkleRoot");
+}
+
+// Fresh work per header change: a rolled ntime rebuilds only the kernel state
+// of the second block, a rolled version also the midstate; both must hash
+// like a cache built from scratch
+static void bench_header_rolling() {
+    uint8_t header[80];
+    memcpy(header, genesis_header, 80);
+    MidstateCache rolled;
+    MidstateCache fresh;
+    initMidstateCache(&rolled);
+    initMidstateCache(&fresh);
+    updateMidstateCache(&rolled, header);
+
+    uint32_t nonce;
+    memcpy(&nonce, genesis_header + 76, 4);
+    uint8_t expected[32];
+    uint8_t hash[32];
+
+    setBlockHeaderNtime(header, 0x495fab2a);
+    updateMidstateCacheTail(&rolled, header);
+    updateMidstateCache(&fresh, header);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(fresh.midstate, rolled.midstate, 8);
+    sha256d_job_hash(&fresh.job, nonce, expected);
+    sha256d_job_hash(&rolled.job, nonce, hash);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, hash, 32);
+
+    setBlockHeaderVersionBits(header, 0x1fffe000, 0x00006000);
+    TEST_ASSERT_EQUAL_HEX32(0x00006001, header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24);
+    setBlockHeaderVersionBits(header, 0x1fffe000, 0);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(genesis_header, header, 4);
+
+    // Restoring the genesis ntime through the tail path gives its hash again
+    setBlockHeaderNtime(header, 0x495fab29);
+    updateMidstateCacheTail(&rolled, header);
+    sha256d_job_hash(&rolled.job, nonce, hash);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(genesis_hash, hash, 32);
+
+    const BenchResult& v = run_bench("version_roll", "headers", 2000, [&](uint32_t i) {
+        setBlockHeaderVersionBits(header, 0x1fffe000, i << 13);
+        updateMidstateCache(&rolled, header);
+        return rolled.job.midstate[0];
+    });
+    const BenchResult& t = run_bench("ntime_roll", "headers", 2000, [&](uint32_t i) {
+        setBlockHeaderNtime(header, 0x495fab29 + i);
+        updateMidstateCacheTail(&rolled, header);
+        return rolled.job.state3[0];
+    });
+    print_speedup(t, "version_roll");
+    TEST_ASSERT_TRUE(v.hps_median > 0);
+}
+
+// Same per-batch work as MiningWorker::processMiningRange: one sha256d_scan
+// call per SCAN_BATCH_SIZE nonces and one hash counter update per batch.
+static void bench_nonce_loop() {
+    MidstateCache cache;
+    initMidstateCache(&cache);
+    updateMidstateCache(&cache, genesis_header);
+
+    sha256d_target_t target;
+    sha256d_target_init(&target, 1);
+    uint32_t hits[SCAN_MAX_HITS];
+
+    // Scan results must match the single-nonce early-reject kernel
+    size_t found = sha256d_scan(&cache.job, 0, SCAN_BATCH_SIZE, &target, hits, SCAN_MAX_HITS);
+    size_t expected = 0;
+    for (uint32_t nonce = 0; nonce < SCAN_BATCH_SIZE; nonce++) {
+        uint8_t hash[32];
+        if (sha256d_job_check(&cache.job, nonce, 1, hash)) {
+            TEST_ASSERT_TRUE(expected < found);
+            TEST_ASSERT_EQUAL_UINT32(nonce, hits[expected]);
+            expected++;
+        }
+    }
+    TEST_ASSERT_EQUAL(expected, found);
+
+    // The worker's own batch step on the backend worker 0 is given; only the
+    // pool poll is left out
+    sha256_backend_register_builtin();
+    TEST_ASSERT_TRUE(sha256_backend_select_workers(1) == 1);
+    const sha256_backend_t* backend = sha256_backend_for_worker(0);
+    uint32_t candidates = 0;
+    scan_loop_t loop;
+    loop.scan = backend ? backend->scan : sha256d_scan;
+    loop.backend = backend;
+    loop.job = &cache.job;
+    loop.target = &target;
+    loop.generation = 1;
+    loop.on_hit = [](void* ctx, uint32_t) { (*(uint32_t*)ctx)++; };
+    loop.poll = NULL;
+    loop.ctx = &candidates;
+
+    uint32_t nonce = 0;
+    uint32_t aborts = 0;
+    const BenchResult& r = run_bench("processMiningRange_loop", "hashes", 4, [&](uint32_t) {
+        bool aborted;
+        nonce += scanBatch(&loop, nonce, SCAN_BATCH_SIZE, &aborted);
+        aborts += aborted;
+        return candidates;
+    }, SCAN_BATCH_SIZE);
+    TEST_ASSERT_TRUE(r.hps_median > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, aborts);
+    TEST_ASSERT_TRUE(sha256_backend_hashes(backend) > 0);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    UNITY_BEGIN();
+    RUN_TEST(bench_sha256_transform);
+    RUN_TEST(bench_sha256_esp32_double);
+    RUN_TEST(bench_sha256_bitcoin_hash_fast);
+    RUN_TEST(bench_sha256d_job_hash);
+    RUN_TEST(bench_sha256d_job_check);
+    RUN_TEST(bench_sha256d_scan);
+    RUN_TEST(bench_sha256d_scan_avx2);
+    RUN_TEST(bench_sha256d_scan_shani);
+    RUN_TEST(bench_sha256d_64);
+    RUN_TEST(bench_calculate_merkle_root);
+    RUN_TEST(bench_coinbase_merkle_root);
+    RUN_TEST(bench_header_rolling);
+    RUN_TEST(bench_nonce_loop);
+
+    write_json(stdout);
+    const char* json_path = getenv("YAMUNA_BENCH_JSON");
+    if (json_path && *json_path) {
+        FILE* out = fopen(json_path, "w");
+        if (out) {
+            write_json(out);
+            fclose(out);
+        }
+    }
+    return UNITY_END();
+}
@@ -2,8 +2,21 @@
 #include <unity.h>
 #include "../src/sha256_optimized.h"
 
+// Genesis block header (wire order); its nonce gives 32+ zero bits
+static const uint8_t GENESIS_HEADER[80] = {
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e,
+    0x67, 0x76, 0x8f, 0x61, 0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa,
+    0x4b, 0x1e, 0x5e, 0x4a, 0x29, 0xab, 0x5f, 0x49, 0xff, 0xff, 0x00, 0x1d, 0x1d, 0xac, 0x2b, 0x7c,
+};
+
+static sha256d_job_t genesis_job;
+
 void setUp(void) {
-    // set up operations if needed
+    uint32_t midstate[8];
+    sha256_compute_midstate(GENESIS_HEADER, 64, midstate);
+    sha256d_job_init(&genesis_job, midstate, GENESIS_HEADER);
 }
 
 void tearDown(void) {
@@ -12,7 +25,7 @@ void tearDown(void) {
 
 void test_sha256_performance(void) {
     sha256_benchmark_t result;
-    
+
     sha256_esp32_benchmark(&result);
 
 #if USE_HW_SHA256
@@ -23,12 +36,65 @@ void test_sha256_performance(void) {
 #endif
 }
 
+#if USE_HW_SHA256 && portNUM_PROCESSORS > 1
+static const unsigned long RATE_MS = 2000;
+
+typedef struct {
+    sha256d_scan_fn scan;
+    uint32_t hashes;
+    volatile bool done;
+} rate_task_t;
+
+// Scans 256-nonce batches like a mining worker until RATE_MS has passed
+static void rate_task(void *arg) {
+    rate_task_t *task = (rate_task_t *)arg;
+    sha256d_target_t target;
+    sha256d_target_init(&target, 1);
+    uint32_t hits[64];
+    uint32_t nonce = 0;
+    unsigned long start = millis();
+    while (millis() - start < RATE_MS) {
+        task->scan(&genesis_job, nonce, 256, &target, hits, 64);
+        nonce += 256;
+        task->hashes += 256;
+    }
+    task->done = true;
+    vTaskDelete(NULL);
+}
+
+// Combined hashes per second of one scan task per core
+static uint32_t combined_hps(sha256d_scan_fn core0, sha256d_scan_fn core1) {
+    rate_task_t tasks[2] = {{core0, 0, false}, {core1, 0, false}};
+    xTaskCreatePinnedToCore(rate_task, "rate0", 4096, &tasks[0], 1, NULL, 0);
+    xTaskCreatePinnedToCore(rate_task, "rate1", 4096, &tasks[1], 1, NULL, 1);
+    while (!tasks[0].done || !tasks[1].done) delay(10);
+    return (uint32_t)((uint64_t)(tasks[0].hashes + tasks[1].hashes) * 1000 / RATE_MS);
+}
+
+// The hardware kernel on both cores makes them contend for the engine, the
+// loser falling back to software inside mbedtls; the per-worker plan gives
+// the engine to core 0 and the software kernel to core 1
+void test_split_assignment_vs_shared_engine(void) {
+    uint32_t shared_hps = combined_hps(sha256d_scan_hw, sha256d_scan_hw);
+    uint32_t split_hps = combined_hps(sha256d_scan_hw, sha256d_scan);
+
+    Serial.printf("engine on both cores:     %u H/s\n", shared_hps);
+    Serial.printf("engine + software split:  %u H/s (%.2fx)\n", split_hps,
+                  shared_hps ? (float)split_hps / shared_hps : 0.0f);
+
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(shared_hps, split_hps);
+}
+#endif
+
 void setup() {
     // Wait for a moment to connect the serial monitor
     delay(2000);
 
     UNITY_BEGIN();
     RUN_TEST(test_sha256_performance);
+#if USE_HW_SHA256 && portNUM_PROCESSORS > 1
+    RUN_TEST(test_split_assignment_vs_shared_engine);
+#endif
     UNITY_END();
 }
 
@@ -0,0 +1,119 @@
+#define UNIT_TEST
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "share_filter.h"
+
+static share_filter_t filter;
+
+static StratumShare share_of(uint32_t job, uint32_t nonce) {
+    StratumShare share;
+    memset(&share, 0, sizeof(share));
+    share.job = job;
+    share.nonce = nonce;
+    share.ntime = 0x504e86b9;
+    share.version_bits = 0x00002000;
+    strcpy(share.extranonce2, "00000001");
+    return share;
+}
+
+void setUp() {
+    share_filter_init(&filter);
+}
+
+void tearDown() {}
+
+// A share goes through once; finding it again is suppressed and counted
+static void test_duplicate_is_suppressed() {
+    StratumShare share = share_of(1, 0x1234abcd);
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &share));
+    TEST_ASSERT_FALSE(share_filter_insert(&filter, &share));
+    TEST_ASSERT_FALSE(share_filter_insert(&filter, &share));
+    TEST_ASSERT_EQUAL_UINT32(3, filter.checked);
+    TEST_ASSERT_EQUAL_UINT32(2, filter.suppressed);
+}
+
+// Every field of the key makes a different share
+static void test_each_field_is_part_of_the_key() {
+    StratumShare share = share_of(1, 0x1234abcd);
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &share));
+
+    StratumShare other = share;
+    other.job = 2;
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &other));
+    other = share;
+    other.nonce++;
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &other));
+    other = share;
+    other.ntime++;
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &other));
+    other = share;
+    other.version_bits = 0x00004000;
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &other));
+    other = share;
+    strcpy(other.extranonce2, "00000002");
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &other));
+    TEST_ASSERT_EQUAL_UINT32(0, filter.suppressed);
+}
+
+// A new job clears the set but keeps the counters
+static void test_clear_forgets_shares() {
+    StratumShare share = share_of(1, 7);
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &share));
+    TEST_ASSERT_FALSE(share_filter_insert(&filter, &share));
+    share_filter_clear(&filter);
+    TEST_ASSERT_TRUE(share_filter_insert(&filter, &share));
+    TEST_ASSERT_EQUAL_UINT32(1, filter.suppressed);
+}
+
+// A crowded set lets new shares through unchecked rather than dropping
+// them, and still knows the ones it holds
+static void test_full_set_lets_shares_through() {
+    uint32_t inserted = 0;
+    while (filter.unchecked == 0) {
+        StratumShare share = share_of(1, inserted++);
+        TEST_ASSERT_TRUE(share_filter_insert(&filter, &share));
+    }
+    TEST_ASSERT_TRUE(inserted > SHARE_FILTER_SLOTS / 2);
+
+    for (uint32_t nonce = 0; nonce < inserted - 1; nonce++) {
+        StratumShare share = share_of(1, nonce);
+        TEST_ASSERT_FALSE(share_filter_insert(&filter, &share));
+    }
+    TEST_ASSERT_EQUAL_UINT32(inserted - 1, filter.suppressed);
+}
+
+// Workers finding the same shares at once submit each of them exactly once
+static void test_concurrent_inserts_pass_once() {
+    const int shares = SHARE_FILTER_SLOTS / 4;
+    for (int round = 0; round < 200; round++) {
+        share_filter_clear(&filter);
+        std::atomic<uint32_t> passed(0);
+        std::vector<std::thread> workers;
+        for (int w = 0; w < 4; w++) {
+            workers.emplace_back([&, round]() {
+                for (int i = 0; i < shares; i++) {
+                    StratumShare share = share_of(round + 1, (uint32_t)i * 977);
+                    if (share_filter_insert(&filter, &share)) passed++;
+                }
+            });
+        }
+        for (std::thread &worker : workers) worker.join();
+        TEST_ASSERT_EQUAL_UINT32(shares, passed.load());
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, filter.unchecked);
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_duplicate_is_suppressed);
+    RUN_TEST(test_each_field_is_part_of_the_key);
+    RUN_TEST(test_clear_forgets_shares);
+    RUN_TEST(test_full_set_lets_shares_through);
+    RUN_TEST(test_concurrent_inserts_pass_once);
+    return UNITY_END();
+}
@@ -0,0 +1,453 @@
+#define UNIT_TEST
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include <ArduinoJson.h>
+
+#include "configs.h"
+#include "webconfig.h"
+#include "pool_connection.h"
+#include "nonce_space.h"
+#include "job_slot.h"
+#include "share_filter.h"
+
+YamunaConfig config;
+
+static const char *NOTIFY =
+    "{\"id\": null, \"method\": \"mining.notify\", \"params\": [\"bf\", "
+    "\"4d16b6f85af6e2198f44ae2a6de67f78487ae5611b77c6c0440b921e00000000\", "
+    "\"01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff20020862062f503253482f04b8864e5008\", "
+    "\"072f736c7573682f000000000100f2052a010000001976a914d23fcdf86f7e756a64a7a9688ef9903327048ed988ac00000000\", "
+    "[], \"20000000\", \"1c2ac4af\", \"504e86b9\", false]}";
+
+// Lines the miner sent to the stand-in pool, in order
+static std::vector<std::string> sent;
+
+// Reply the stand-in pool gives to mining.configure; empty means no reply,
+// like a pool that ignores unknown methods
+static std::string configure_reply;
+
+static String method_of(const std::string &line) {
+    StaticJsonDocument<1024> doc;
+    deserializeJson(doc, line.c_str());
+    return doc["method"].as<String>();
+}
+
+// Answers configure with configure_reply, subscribe and authorize like a
+// regular pool
+static void stand_in_pool(const std::string &line) {
+    sent.push_back(line);
+    StaticJsonDocument<1024> doc;
+    if (deserializeJson(doc, line.c_str())) return;
+    unsigned int id = doc["id"].as<unsigned int>();
+    String method = doc["method"].as<String>();
+
+    char reply[256];
+    if (method == "mining.configure") {
+        if (configure_reply.empty()) return;
+        snprintf(reply, sizeof(reply), configure_reply.c_str(), id);
+    } else if (method == "mining.subscribe") {
+        snprintf(reply, sizeof(reply),
+                 "{\"id\": %u, \"result\": [[[\"mining.notify\", \"ae6812eb4cd7735a\"]], \"08000002\", 4], \"error\": null}",
+                 id);
+    } else if (method == "mining.authorize") {
+        snprintf(reply, sizeof(reply), "{\"id\": %u, \"result\": true, \"error\": null}", id);
+    } else {
+        return;
+    }
+    WiFiClient::reply(reply);
+}
+
+static void given_pool_grants(const char *mask) {
+    char reply[256];
+    snprintf(reply, sizeof(reply),
+             "{\"id\": %%u, \"result\": {\"version-rolling\": true, \"version-rolling.mask\": \"%s\"}, \"error\": null}",
+             mask);
+    configure_reply = reply;
+}
+
+void setUp() {
+    std::memset(&config, 0, sizeof(config));
+    std::strncpy(config.pool_url, "pool.example.org", sizeof(config.pool_url) - 1);
+    std::strncpy(config.btc_address, "bc1qsampleaddress", sizeof(config.btc_address) - 1);
+    std::strncpy(config.pool_password, "x", sizeof(config.pool_password) - 1);
+    config.pool_port = 3333;
+
+    sent.clear();
+    configure_reply.clear();
+    WiFiClient::reset();
+    WiFiClient::pool() = stand_in_pool;
+    PoolConnection::initialize();
+}
+
+void tearDown() {
+    PoolConnection::cleanup();
+    WiFiClient::reset();
+}
+
+static void test_handshake_negotiates_version_rolling() {
+    given_pool_grants("1fffe000");
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+
+    // mining.configure goes first, as BIP310 asks
+    TEST_ASSERT_EQUAL(3, sent.size());
+    TEST_ASSERT_EQUAL_STRING("mining.configure", method_of(sent[0]).c_str());
+    TEST_ASSERT_EQUAL_STRING("mining.subscribe", method_of(sent[1]).c_str());
+    TEST_ASSERT_EQUAL_STRING("mining.authorize", method_of(sent[2]).c_str());
+
+    StaticJsonDocument<1024> doc;
+    deserializeJson(doc, sent[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("version-rolling", doc["params"][0][0].as<String>().c_str());
+    TEST_ASSERT_EQUAL_STRING("1fffe000", doc["params"][1]["version-rolling.mask"].as<String>().c_str());
+    TEST_ASSERT_EQUAL(VERSION_ROLLING_MIN_BITS, doc["params"][1]["version-rolling.min-bit-count"].as<int>());
+
+    StratumState *state = PoolConnection::getStratumState();
+    TEST_ASSERT_TRUE(state->subscribed);
+    TEST_ASSERT_TRUE(state->authorized);
+    TEST_ASSERT_TRUE(state->version_rolling);
+    TEST_ASSERT_EQUAL_HEX32(0x1fffe000, state->version_mask);
+}
+
+// Only bits both the miner and the pool allow are rolled
+static void test_negotiated_mask_is_intersection() {
+    given_pool_grants("00ffe000");
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_EQUAL_HEX32(0x00ffe000, PoolConnection::getStratumState()->version_mask);
+
+    PoolConnection::cleanup();
+    PoolConnection::initialize();
+    given_pool_grants("ffffffff");
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_EQUAL_HEX32(VERSION_ROLLING_MASK, PoolConnection::getStratumState()->version_mask);
+}
+
+// Pools without BIP310 reject or ignore mining.configure; mining goes on
+// with nonce and extranonce2 only
+static void test_handshake_without_version_rolling() {
+    configure_reply = "{\"id\": %u, \"result\": null, \"error\": [20, \"Unsupported method\", null]}";
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_FALSE(PoolConnection::getStratumState()->version_rolling);
+    TEST_ASSERT_EQUAL_HEX32(0, PoolConnection::getStratumState()->version_mask);
+
+    PoolConnection::cleanup();
+    PoolConnection::initialize();
+    configure_reply = "{\"id\": %u, \"result\": {\"version-rolling\": false}, \"error\": null}";
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_FALSE(PoolConnection::getStratumState()->version_rolling);
+
+    PoolConnection::cleanup();
+    PoolConnection::initialize();
+    configure_reply.clear();
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_FALSE(PoolConnection::getStratumState()->version_rolling);
+    TEST_ASSERT_TRUE(PoolConnection::getStratumState()->authorized);
+}
+
+// A share found in the current job, extranonce2 1 at the notified ntime
+static StratumShare share_of_current_job(uint32_t nonce, uint32_t version_bits) {
+    StratumShare share;
+    share.job = nonce_space_generation(&mining_nonce_space);
+    share.nonce = nonce;
+    share.ntime = 0x504e86b9;
+    share.version_bits = version_bits;
+    strcpy(share.extranonce2, "00000001");
+    return share;
+}
+
+static void test_submit_carries_version_bits() {
+    given_pool_grants("1fffe000");
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(share_of_current_job(0x1234abcd, 0x00006000)));
+    StaticJsonDocument<1024> doc;
+    deserializeJson(doc, sent.back().c_str());
+    TEST_ASSERT_EQUAL_STRING("mining.submit", doc["method"].as<String>().c_str());
+    TEST_ASSERT_EQUAL(6, doc["params"].size());
+    TEST_ASSERT_EQUAL_STRING("bf", doc["params"][1].as<String>().c_str());
+    TEST_ASSERT_EQUAL_STRING("1234abcd", doc["params"][4].as<String>().c_str());
+    TEST_ASSERT_EQUAL_STRING("00006000", doc["params"][5].as<String>().c_str());
+}
+
+static void test_submit_without_version_rolling() {
+    configure_reply = "{\"id\": %u, \"result\": null, \"error\": [20, \"Unsupported method\", null]}";
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(share_of_current_job(0x1234abcd, 0)));
+    StaticJsonDocument<1024> doc;
+    deserializeJson(doc, sent.back().c_str());
+    TEST_ASSERT_EQUAL(5, doc["params"].size());
+}
+
+// Work of a notified job rolls the negotiated bits before extranonce2;
+// mining.set_version_mask applies from the next job on
+static void test_jobs_roll_negotiated_version_bits() {
+    given_pool_grants("1fffe000");
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_claim(&mining_nonce_space, 0xFFFFFFFFu, &unit));
+    TEST_ASSERT_TRUE(nonce_space_claim(&mining_nonce_space, 1, &unit));
+    TEST_ASSERT_TRUE(nonce_space_claim(&mining_nonce_space, 1, &unit));
+    TEST_ASSERT_TRUE(unit.extranonce2 == 0);
+    TEST_ASSERT_EQUAL_HEX32(0x00002000, unit.version_bits);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(
+        "{\"id\": null, \"method\": \"mining.set_version_mask\", \"params\": [\"00c00000\"]}"));
+    TEST_ASSERT_EQUAL_HEX32(0x00c00000, PoolConnection::getStratumState()->version_mask);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    const uint32_t versions[5] = {0x00000000, 0x00400000, 0x00800000, 0x00c00000, 0x00000000};
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(nonce_space_claim(&mining_nonce_space, 0xFFFFFFFFu, &unit));
+        TEST_ASSERT_EQUAL_HEX32(versions[i], unit.version_bits);
+        TEST_ASSERT_TRUE(unit.extranonce2 == (i < 4 ? 0 : 1));
+        TEST_ASSERT_TRUE(nonce_space_claim(&mining_nonce_space, 1, &unit));
+    }
+}
+
+// mining.notify like NOTIFY, job "c0", with branches copies of one branch
+// and the given coinb2
+static std::string notify_with(int branches, const std::string &coinb2) {
+    std::string merkle;
+    for (int i = 0; i < branches; i++) {
+        if (i) merkle += ", ";
+        merkle += "\"" + std::string(64, i % 2 ? 'a' : '5') + "\"";
+    }
+    return "{\"id\": null, \"method\": \"mining.notify\", \"params\": [\"c0\", "
+           "\"4d16b6f85af6e2198f44ae2a6de67f78487ae5611b77c6c0440b921e00000000\", \"0100\", \"" +
+           coinb2 + "\", [" + merkle + "], \"20000000\", \"1c2ac4af\", \"504e86b9\", true]}";
+}
+
+// mining.notify is decoded once into the binary job the header is built from
+static void test_notify_decodes_binary_job() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    StratumState *state = PoolConnection::getStratumState();
+    const uint8_t extranonce1[4] = {0x08, 0x00, 0x00, 0x02};
+    TEST_ASSERT_EQUAL(4, state->extranonce1_len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(extranonce1, state->extranonce1, 4);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    const StratumJob &job = state->current_job;
+    TEST_ASSERT_EQUAL_STRING("bf", job.job_id);
+    TEST_ASSERT_TRUE(PoolConnection::hasValidJob());
+
+    // Workers get the same job from the slot, under the generation of its units
+    job_snapshot_t snapshot;
+    TEST_ASSERT_TRUE(job_slot_read(&mining_job_slot, &snapshot));
+    TEST_ASSERT_EQUAL_UINT32(nonce_space_generation(&mining_nonce_space), snapshot.generation);
+    TEST_ASSERT_EQUAL_MEMORY(&job, &snapshot.job, sizeof(job));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(extranonce1, snapshot.extranonce1, 4);
+    TEST_ASSERT_EQUAL_STRING("bf", PoolConnection::getCurrentJobId().c_str());
+
+    // prevhash in header order: the notified words reversed byte for byte
+    TEST_ASSERT_EQUAL_HEX8(0x00, job.prevhash[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x1e, job.prevhash[4]);
+    TEST_ASSERT_EQUAL_HEX8(0x4d, job.prevhash[31]);
+
+    TEST_ASSERT_EQUAL(58, job.coinb1_len);
+    TEST_ASSERT_EQUAL_HEX8(0x01, job.coinb1[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x08, job.coinb1[57]);
+    TEST_ASSERT_EQUAL(51, job.coinb2_len);
+    TEST_ASSERT_EQUAL(0, job.merkle_count);
+    TEST_ASSERT_EQUAL_HEX32(0x20000000, job.version);
+    TEST_ASSERT_EQUAL_HEX32(0x1c2ac4af, job.nbits);
+    TEST_ASSERT_EQUAL_HEX32(0x504e86b9, job.ntime);
+    TEST_ASSERT_FALSE(job.clean_jobs);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(20, "00").c_str()));
+    TEST_ASSERT_EQUAL_STRING("c0", job.job_id);
+    TEST_ASSERT_EQUAL(20, job.merkle_count);
+    TEST_ASSERT_EQUAL_HEX8(0x55, job.merkle_branch[0][0]);
+    TEST_ASSERT_EQUAL_HEX8(0xaa, job.merkle_branch[19][31]);
+    TEST_ASSERT_TRUE(job.clean_jobs);
+}
+
+// Jobs that do not fit the bounds are refused whole, never truncated; the
+// previous job stays in place
+static void test_notify_out_of_bounds_is_refused() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(MAX_MERKLE_BRANCHES, "00").c_str()));
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    uint32_t generation = nonce_space_generation(&mining_nonce_space);
+
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(notify_with(MAX_MERKLE_BRANCHES + 1, "00").c_str()));
+    std::string long_coinb2((MAX_COINB2_BYTES + 1) * 2, '0');
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(notify_with(1, long_coinb2).c_str()));
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(notify_with(1, "0g").c_str()));
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(notify_with(1, "000").c_str()));
+
+    StratumState *state = PoolConnection::getStratumState();
+    TEST_ASSERT_EQUAL_STRING("bf", state->current_job.job_id);
+    TEST_ASSERT_EQUAL(0, state->current_job.merkle_count);
+    TEST_ASSERT_EQUAL(51, state->current_job.coinb2_len);
+    TEST_ASSERT_EQUAL_UINT32(generation, nonce_space_generation(&mining_nonce_space));
+}
+
+// notify with one parameter replaced
+static std::string replacing(std::string notify, const std::string &from, const std::string &to) {
+    notify.replace(notify.find(from), from.size(), to);
+    return notify;
+}
+
+// Each notify records what changed against the job it replaces
+static void test_notify_records_job_changes() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    StratumState *state = PoolConnection::getStratumState();
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(2, "00").c_str()));
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    TEST_ASSERT_EQUAL_HEX8(JOB_CHANGED_COINBASE | JOB_CHANGED_MERKLE, state->current_job.changes);
+
+    // A resend with a new id and ntime only
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(
+        replacing(replacing(NOTIFY, "[\"bf\"", "[\"c1\""), "\"504e86b9\"", "\"504e86d7\"").c_str()));
+    TEST_ASSERT_EQUAL_STRING("c1", state->current_job.job_id);
+    TEST_ASSERT_EQUAL_HEX8(JOB_CHANGED_NTIME, state->current_job.changes);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(
+        replacing(NOTIFY, "\"4d16b6f8", "\"5d16b6f8").c_str()));
+    TEST_ASSERT_EQUAL_HEX8(JOB_CHANGED_PREVHASH | JOB_CHANGED_NTIME, state->current_job.changes);
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(
+        replacing(NOTIFY, "\"20000000\"", "\"20000004\"").c_str()));
+    TEST_ASSERT_EQUAL_HEX8(JOB_CHANGED_PREVHASH | JOB_CHANGED_HEADER, state->current_job.changes);
+}
+
+// A mining.submit param of the last line sent; empty for any other line
+static std::string submitted(int param) {
+    StaticJsonDocument<1024> doc;
+    deserializeJson(doc, sent.back().c_str());
+    if (doc["method"].as<String>() != "mining.submit") return "";
+    return doc["params"][param].as<String>().c_str();
+}
+
+// A share goes out for the job it was hashed for, with its own extranonce2
+// and ntime, while that job is still valid; once clean_jobs retires it the
+// share is dropped without a round-trip
+static void test_share_submitted_for_its_own_job() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    StratumShare old_share = share_of_current_job(0x11111111, 0);
+    strcpy(old_share.extranonce2, "000000aa");
+    old_share.ntime = 0x504e86c0;
+
+    // A newer job without clean_jobs: the old one stays valid
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(replacing(NOTIFY, "[\"bf\"", "[\"c7\"").c_str()));
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(old_share));
+    TEST_ASSERT_EQUAL_STRING("bf", submitted(1).c_str());
+    TEST_ASSERT_EQUAL_STRING("000000aa", submitted(2).c_str());
+    TEST_ASSERT_EQUAL_STRING("504e86c0", submitted(3).c_str());
+    TEST_ASSERT_EQUAL_STRING("11111111", submitted(4).c_str());
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(share_of_current_job(0x22222222, 0)));
+    TEST_ASSERT_EQUAL_STRING("c7", submitted(1).c_str());
+
+    // clean_jobs retires both
+    StratumShare newer_share = share_of_current_job(0x33333333, 0);
+    uint32_t stale = PoolConnection::getStaleShares();
+    size_t lines = sent.size();
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(0, "00").c_str()));
+    TEST_ASSERT_FALSE(PoolConnection::submitStratumShare(old_share));
+    TEST_ASSERT_FALSE(PoolConnection::submitStratumShare(newer_share));
+    TEST_ASSERT_EQUAL(lines, sent.size());
+    TEST_ASSERT_EQUAL_UINT32(stale + 2, PoolConnection::getStaleShares());
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(share_of_current_job(0x44444444, 0)));
+    TEST_ASSERT_EQUAL_STRING("c0", submitted(1).c_str());
+
+    // So does a new session
+    StratumShare session_share = share_of_current_job(0x55555555, 0);
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_FALSE(PoolConnection::submitStratumShare(session_share));
+}
+
+// A new block, by clean_jobs or a new prevhash, stops the work of earlier
+// jobs from the notify's first fields; a notify the decode refuses takes the
+// abort back, so the current job is mined on
+static void test_new_block_aborts_before_decode() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    uint32_t generation = nonce_space_generation(&mining_nonce_space);
+    uint32_t aborts = mining_job_slot.aborts;
+
+    // Same block: work goes on
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(replacing(NOTIFY, "[\"bf\"", "[\"c1\"").c_str()));
+    TEST_ASSERT_FALSE(job_slot_aborted(&mining_job_slot, generation));
+    generation = nonce_space_generation(&mining_nonce_space);
+
+    // clean_jobs on a notify the full decode refuses, or that is not even JSON
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(notify_with(MAX_MERKLE_BRANCHES + 1, "00").c_str()));
+    TEST_ASSERT_EQUAL_UINT32(generation, nonce_space_generation(&mining_nonce_space));
+    TEST_ASSERT_FALSE(job_slot_aborted(&mining_job_slot, generation));
+    TEST_ASSERT_EQUAL_UINT32(aborts, mining_job_slot.aborts);
+    std::string truncated = notify_with(0, "00");
+    truncated.resize(truncated.size() - 1);
+    TEST_ASSERT_FALSE(PoolConnection::processStratumMessage(truncated.c_str()));
+    TEST_ASSERT_FALSE(job_slot_aborted(&mining_job_slot, generation));
+    TEST_ASSERT_EQUAL_UINT32(aborts, mining_job_slot.aborts);
+    StratumShare share = share_of_current_job(0x66666666, 0);
+    TEST_ASSERT_TRUE(PoolConnection::submitStratumShare(share));
+    TEST_ASSERT_EQUAL_STRING("c1", submitted(1).c_str());
+
+    // An accepted clean_jobs notify aborts and retires the earlier jobs
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(0, "00").c_str()));
+    TEST_ASSERT_TRUE(job_slot_aborted(&mining_job_slot, generation));
+    TEST_ASSERT_EQUAL_UINT32(aborts + 1, mining_job_slot.aborts);
+    TEST_ASSERT_FALSE(PoolConnection::submitStratumShare(share));
+
+    // The next job is not aborted
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    generation = nonce_space_generation(&mining_nonce_space);
+    TEST_ASSERT_FALSE(job_slot_aborted(&mining_job_slot, generation));
+
+    // A new prevhash without clean_jobs, keys in another order, no spaces
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(
+        "{\"params\":[\"d1\",\"5d16b6f85af6e2198f44ae2a6de67f78487ae5611b77c6c0440b921e00000000\",\"0100\",\"00\","
+        "[\"" + std::string(64, 'a') + "\"],\"20000000\",\"1c2ac4af\",\"504e86b9\",false],"
+        "\"id\":null,\"method\":\"mining.notify\"}"));
+    TEST_ASSERT_TRUE(job_slot_aborted(&mining_job_slot, generation));
+    TEST_ASSERT_EQUAL_UINT32(aborts + 2, mining_job_slot.aborts);
+    TEST_ASSERT_FALSE(job_slot_aborted(&mining_job_slot, nonce_space_generation(&mining_nonce_space)));
+    TEST_ASSERT_EQUAL_STRING("d1", PoolConnection::getStratumState()->current_job.job_id);
+}
+
+// Shares remembered against duplicates are kept while their job can still
+// be submitted, and forgotten once clean_jobs or a new session retires it
+static void test_notify_clears_share_filter() {
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(NOTIFY));
+    StratumShare share = share_of_current_job(0x1234abcd, 0);
+    TEST_ASSERT_TRUE(share_filter_insert(&mining_share_filter, &share));
+    TEST_ASSERT_FALSE(share_filter_insert(&mining_share_filter, &share));
+
+    // Same block, no clean_jobs: a rescan of the older job is still a duplicate
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(replacing(NOTIFY, "[\"bf\"", "[\"c1\"").c_str()));
+    TEST_ASSERT_FALSE(share_filter_insert(&mining_share_filter, &share));
+
+    TEST_ASSERT_TRUE(PoolConnection::processStratumMessage(notify_with(0, "00").c_str()));
+    TEST_ASSERT_TRUE(share_filter_insert(&mining_share_filter, &share));
+
+    TEST_ASSERT_TRUE(PoolConnection::performStratumHandshake());
+    TEST_ASSERT_TRUE(share_filter_insert(&mining_share_filter, &share));
+    TEST_ASSERT_FALSE(share_filter_insert(&mining_share_filter, &share));
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_handshake_negotiates_version_rolling);
+    RUN_TEST(test_negotiated_mask_is_intersection);
+    RUN_TEST(test_handshake_without_version_rolling);
+    RUN_TEST(test_submit_carries_version_bits);
+    RUN_TEST(test_submit_without_version_rolling);
+    RUN_TEST(test_jobs_roll_negotiated_version_bits);
+    RUN_TEST(test_notify_decodes_binary_job);
+    RUN_TEST(test_notify_out_of_bounds_is_refused);
+    RUN_TEST(test_notify_records_job_changes);
+    RUN_TEST(test_share_submitted_for_its_own_job);
+    RUN_TEST(test_new_block_aborts_before_decode);
+    RUN_TEST(test_notify_clears_share_filter);
+    return UNITY_END();
+}
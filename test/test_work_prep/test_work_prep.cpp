@@ -0,0 +1,392 @@
+#define UNIT_TEST
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unity.h>
+
+#include "configs.h"
+#include "mining_utils.h"
+#include "nonce_space.h"
+#include "job_slot.h"
+#include "work_prep.h"
+
+// Jobs are decoded into the test's own state
+static StratumState state;
+
+static nonce_space_t space;
+static job_slot_t slot;
+static work_prep_t prep;
+
+static const char *COINB1 =
+    "01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff20020862062f503253482f04b8864e5008";
+static const char *COINB2 =
+    "072f736c7573682f000000000100f2052a010000001976a914d23fcdf86f7e756a64a7a9688ef9903327048ed988ac00000000";
+static const char *PREVHASH = "4d16b6f85af6e2198f44ae2a6de67f78487ae5611b77c6c0440b921e00000000";
+static const char *BRANCHES[2] = {
+    "5555555555555555555555555555555555555555555555555555555555555555",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+};
+
+// A decoded job like mining.notify leaves it
+static void decode_job(const char *job_id) {
+    StratumJob &job = state.current_job;
+    memset(&job, 0, sizeof(job));
+    strncpy(job.job_id, job_id, MAX_JOB_ID_LEN);
+    to_byte_array(PREVHASH, 64, job.prevhash);
+    job.coinb1_len = to_byte_array(COINB1, strlen(COINB1), job.coinb1);
+    job.coinb2_len = to_byte_array(COINB2, strlen(COINB2), job.coinb2);
+    for (int i = 0; i < 2; i++) to_byte_array(BRANCHES[i], 64, job.merkle_branch[i]);
+    job.merkle_count = 2;
+    job.version = 0x20000000;
+    job.nbits = 0x1c2ac4af;
+    job.ntime = 0x504e86b9;
+    job.received_ms = 1234;
+}
+
+// The decoded job published and its nonce space started, as the pool
+// connection does, then the prep task's next step
+static void publish(uint32_t version_mask, int extranonce2_size) {
+    state.extranonce2_size = extranonce2_size;
+    state.version_rolling = version_mask != 0;
+    state.version_mask = version_mask;
+    job_slot_publish(&slot, &state, nonce_space_next_generation(&space));
+    nonce_space_begin_job(&space, extranonce2_size, version_mask, 0, 0);
+    TEST_ASSERT_TRUE(work_prep_run(&prep, &space, &slot));
+}
+
+static void notify(const char *job_id, uint32_t version_mask, int extranonce2_size) {
+    decode_job(job_id);
+    publish(version_mask, extranonce2_size);
+}
+
+// The header of unit built the way a worker builds it without preparation
+static void reference_header(const nonce_unit_t &unit, uint8_t *header) {
+    CoinbaseMidstate coinbase;
+    TEST_ASSERT_TRUE(initCoinbaseMidstate(&coinbase, &state.current_job, state.extranonce1, state.extranonce1_len));
+    uint8_t extranonce2[NONCE_SPACE_MAX_EXTRANONCE2_SIZE];
+    size_t extranonce2_len = nonce_space_extranonce2_bytes(&space, unit.extranonce2, extranonce2, sizeof(extranonce2));
+    TEST_ASSERT_TRUE(buildJobHeader(header, 0, &state.current_job, &coinbase, extranonce2, extranonce2_len));
+    setBlockHeaderVersionBits(header, state.version_mask, unit.version_bits);
+    setBlockHeaderNtime(header, rolledNtime(state.current_job.ntime, unit.ntime_roll, 0));
+}
+
+// The prepared kernel state hashes exactly the prepared header
+static void assert_hashes_header(const prepared_header_t &work, uint32_t nonce) {
+    uint8_t header[80];
+    memcpy(header, work.header, 80);
+    memcpy(header + 76, &nonce, 4);
+    uint8_t expected[32];
+    uint8_t hash[32];
+    sha256_esp32_double(header, 80, expected);
+    sha256d_job_hash(&work.cache.job, nonce, hash);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, hash, 32);
+}
+
+// Claims the rest of the cursor's header; unit is its first claim
+static void claim_header(nonce_unit_t *unit) {
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, unit));
+    nonce_unit_t rest;
+    if ((uint64_t)unit->nonce_start + unit->nonce_count < (1ULL << 32)) {
+        TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &rest));
+    }
+}
+
+// The prepared first header of the current job, checked against a direct build
+static void assert_first_header_prepared() {
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_header_unit(&space, nonce_space_generation(&space), 0, &unit));
+    prepared_header_t work;
+    TEST_ASSERT_TRUE(work_prep_take(&prep, &unit, &work));
+    uint8_t expected[80];
+    reference_header(unit, expected);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, work.header, 80);
+    assert_hashes_header(work, 42);
+}
+
+void setUp() {
+    state = StratumState();
+    const uint8_t extranonce1[4] = {0x08, 0x00, 0x00, 0x02};
+    memcpy(state.extranonce1, extranonce1, sizeof(extranonce1));
+    state.extranonce1_len = sizeof(extranonce1);
+    nonce_space_init(&space, NONCE_RANGE_SIZE);
+    job_slot_init(&slot);
+    work_prep_init(&prep);
+}
+
+void tearDown() {}
+
+// The first header is ready as soon as the job is accepted
+static void test_first_header_prepared_on_notify() {
+    notify("j1", 0, 4);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.prepared);
+
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 4096, &unit));
+    prepared_header_t work;
+    TEST_ASSERT_TRUE(work_prep_take(&prep, &unit, &work));
+
+    uint8_t expected[80];
+    reference_header(unit, expected);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, work.header, 80);
+    TEST_ASSERT_EQUAL_STRING("j1", work.cache.job_id);
+    TEST_ASSERT_EQUAL_HEX32(0x504e86b9, work.job_ntime);
+    TEST_ASSERT_EQUAL_UINT32(1234, work.received_ms);
+    assert_hashes_header(work, 0);
+    assert_hashes_header(work, 0xdeadbeef);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.taken);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.missed);
+}
+
+// The prep task waits for the nonce space of a published job; until then
+// the job's headers have no units
+static void test_job_prepared_once_nonce_space_starts() {
+    decode_job("j0");
+    state.extranonce2_size = 4;
+    job_slot_publish(&slot, &state, nonce_space_next_generation(&space));
+    TEST_ASSERT_FALSE(work_prep_run(&prep, &space, &slot));
+    TEST_ASSERT_EQUAL_UINT32(0, prep.prepared);
+
+    nonce_space_begin_job(&space, 4, 0, 0, 0);
+    TEST_ASSERT_TRUE(work_prep_run(&prep, &space, &slot));
+    TEST_ASSERT_EQUAL_UINT32(1, prep.prepared);
+    assert_first_header_prepared();
+
+    // Nothing else is worth preparing: header 1 needs a new coinbase
+    TEST_ASSERT_FALSE(work_prep_run(&prep, &space, &slot));
+    TEST_ASSERT_EQUAL_UINT32(1, prep.prepared);
+}
+
+// The header of unit is prepared and matches a direct build
+static void assert_prepared(const nonce_unit_t &unit) {
+    prepared_header_t work;
+    TEST_ASSERT_TRUE(work_prep_take(&prep, &unit, &work));
+    uint8_t expected[80];
+    reference_header(unit, expected);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, work.header, 80);
+    assert_hashes_header(work, 7);
+}
+
+// Versions sharing the merkle root are prepared WORK_PREP_SLOTS ahead of the
+// cursor, one per call; a new extranonce2 waits until the cursor is nearly
+// through the header before it
+static void test_refill_limits_new_coinbases_to_reachable_headers() {
+    notify("j2", 0x00006000, 4);
+    for (int i = 1; i < WORK_PREP_SLOTS; i++) {
+        TEST_ASSERT_TRUE(work_prep_refill(&prep, &space));
+    }
+    TEST_ASSERT_FALSE(work_prep_refill(&prep, &space));
+    TEST_ASSERT_EQUAL_UINT32(WORK_PREP_SLOTS, prep.prepared);
+
+    // Headers 0-3 roll the version of extranonce2 0; header 4 is far off
+    for (uint32_t header = 0; header < 3; header++) {
+        nonce_unit_t unit;
+        claim_header(&unit);
+        TEST_ASSERT_EQUAL_UINT32(header, unit.header);
+        assert_prepared(unit);
+        TEST_ASSERT_FALSE(work_prep_refill(&prep, &space));
+    }
+
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, WORK_PREP_NEAR_END - 1, &unit));
+    TEST_ASSERT_EQUAL_UINT32(3, unit.header);
+    assert_prepared(unit);
+    TEST_ASSERT_FALSE(work_prep_refill(&prep, &space));
+
+    // Nearly through header 3: extranonce2 1 gets its coinbase, and its
+    // versions follow up to WORK_PREP_SLOTS from the cursor
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 1, &unit));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(work_prep_refill(&prep, &space));
+    }
+    TEST_ASSERT_FALSE(work_prep_refill(&prep, &space));
+    TEST_ASSERT_EQUAL_UINT32(WORK_PREP_SLOTS + 3, prep.prepared);
+
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 0xFFFFFFFFu, &unit));
+    for (uint32_t header = 4; header < 7; header++) {
+        claim_header(&unit);
+        TEST_ASSERT_EQUAL_UINT32(header, unit.header);
+        assert_prepared(unit);
+    }
+}
+
+// Workers build headers themselves for a replaced job or a header the
+// table has not reached
+static void test_take_misses_stale_and_unprepared_headers() {
+    notify("j3", 0, 4);
+    nonce_unit_t first;
+    claim_header(&first);
+    nonce_unit_t second;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 4096, &second));
+    prepared_header_t work;
+    TEST_ASSERT_FALSE(work_prep_take(&prep, &second, &work));
+
+    notify("j4", 0, 4);
+    TEST_ASSERT_FALSE(work_prep_take(&prep, &first, &work));
+    TEST_ASSERT_EQUAL_UINT32(2, prep.missed);
+
+    nonce_unit_t unit;
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 4096, &unit));
+    TEST_ASSERT_TRUE(work_prep_take(&prep, &unit, &work));
+    TEST_ASSERT_EQUAL_STRING("j4", work.cache.job_id);
+}
+
+// Workers that outran the table do not make it prepare passed headers
+static void test_refill_skips_passed_headers() {
+    notify("j5", 0, 4);
+    nonce_unit_t unit;
+    for (int i = 0; i < 10; i++) {
+        claim_header(&unit);
+    }
+    TEST_ASSERT_TRUE(work_prep_refill(&prep, &space));
+    TEST_ASSERT_FALSE(work_prep_refill(&prep, &space));
+    TEST_ASSERT_TRUE(nonce_space_claim(&space, 4096, &unit));
+    TEST_ASSERT_EQUAL_UINT32(10, unit.header);
+    prepared_header_t work;
+    TEST_ASSERT_TRUE(work_prep_take(&prep, &unit, &work));
+}
+
+// Readers racing the preparer never take a torn header: whatever they take
+// hashes like the header it carries
+static void test_concurrent_take_is_consistent() {
+    notify("j6", 0x00006000, 4);
+    std::atomic<bool> done(false);
+    std::atomic<uint32_t> torn(0);
+    std::atomic<uint32_t> taken(0);
+
+    std::thread reader([&]() {
+        while (!done.load()) {
+            for (uint32_t header = 0; header < 8; header++) {
+                nonce_unit_t unit;
+                memset(&unit, 0, sizeof(unit));
+                unit.generation = nonce_space_generation(&space);
+                unit.header = header;
+                prepared_header_t work;
+                if (!work_prep_take(&prep, &unit, &work)) continue;
+                taken++;
+                uint8_t header_bytes[80];
+                memcpy(header_bytes, work.header, 80);
+                uint8_t expected[32];
+                uint8_t hash[32];
+                sha256_esp32_double(header_bytes, 80, expected);
+                sha256d_job_hash(&work.cache.job, 0, hash);
+                if (memcmp(expected, hash, 32) != 0 || work.header_index != header) torn++;
+            }
+        }
+    });
+
+    // At least a few hundred takes, however the threads are scheduled
+    for (int round = 0; round < 300 || (taken.load() < 300 && round < 100000); round++) {
+        notify(round % 2 ? "odd" : "even", 0x00006000, 4);
+        for (int i = 0; i < 8; i++) {
+            nonce_unit_t unit;
+            nonce_space_claim(&space, 0xFFFFFFFFu, &unit);
+            nonce_space_claim(&space, 0xFFFFFFFFu, &unit);
+            work_prep_refill(&prep, &space);
+        }
+    }
+    done = true;
+    reader.join();
+
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+    TEST_ASSERT_TRUE(taken.load() > 0);
+}
+
+// A job resent with a new ntime and id reuses the coinbase, the merkle root
+// and the first block's midstate
+static void test_resent_job_reuses_everything() {
+    notify("r1", 0, 4);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.coinbases_reused);
+
+    decode_job("r2");
+    state.current_job.ntime += 30;
+    publish(0, 4);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.coinbases_reused);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.roots_reused);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.midstates_reused);
+    assert_first_header_prepared();
+}
+
+// A new coinbase is computed; one seen a few jobs ago comes from the memo,
+// but a new prevhash still needs a new midstate
+static void test_memo_remembers_earlier_coinbases() {
+    notify("a", 0, 4);
+    decode_job("b");
+    state.current_job.coinb2[0] ^= 1;
+    publish(0, 4);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.coinbases_reused);
+    assert_first_header_prepared();
+
+    decode_job("a2");
+    state.current_job.prevhash[0] ^= 1;
+    publish(0, 4);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.roots_reused);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.midstates_reused);
+    assert_first_header_prepared();
+
+    // Another extranonce1 (a new session) is another coinbase
+    state.extranonce1[0] ^= 1;
+    notify("a3", 0, 4);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.roots_reused);
+    assert_first_header_prepared();
+
+    // So is another extranonce2 size
+    notify("a4", 0, 8);
+    TEST_ASSERT_EQUAL_UINT32(1, prep.roots_reused);
+    assert_first_header_prepared();
+}
+
+// An entry whose key matches but whose content differs is a hash collision,
+// not a hit: the coinbase is computed again
+static void test_memo_key_collision_is_not_reused() {
+    notify("a", 0, 4);
+    decode_job("b");
+    state.current_job.coinb2[0] ^= 1;
+    publish(0, 4);
+
+    // Give a's entry b's key, as a colliding hash would
+    prep.memo[0].key = prep.memo[1].key;
+    prep.memo[1].key = 0;
+
+    decode_job("b2");
+    state.current_job.coinb2[0] ^= 1;
+    publish(0, 4);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.coinbases_reused);
+    TEST_ASSERT_EQUAL_UINT32(0, prep.roots_reused);
+    assert_first_header_prepared();
+}
+
+// Every (ntime pass, clock second) pair gives its own ntime, within what
+// pools accept; the clock stops at the window instead of running into the
+// next pass
+static void test_ntime_passes_never_meet_the_clock() {
+    const uint32_t job_ntime = 0x504e86b9;
+    std::vector<bool> seen(NTIME_ROLL_LIMIT_S + 1, false);
+    for (uint32_t pass = 0; pass <= NTIME_ROLL_PASSES; pass++) {
+        for (uint32_t elapsed = 0; elapsed <= NTIME_CLOCK_WINDOW_S; elapsed++) {
+            uint32_t offset = rolledNtime(job_ntime, pass, elapsed) - job_ntime;
+            TEST_ASSERT_TRUE(offset <= NTIME_ROLL_LIMIT_S);
+            TEST_ASSERT_FALSE(seen[offset]);
+            seen[offset] = true;
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(rolledNtime(job_ntime, 1, NTIME_CLOCK_WINDOW_S),
+                             rolledNtime(job_ntime, 1, NTIME_CLOCK_WINDOW_S + 3600));
+    TEST_ASSERT_TRUE(rolledNtime(job_ntime, 1, 0) > rolledNtime(job_ntime, 0, 3600));
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_header_prepared_on_notify);
+    RUN_TEST(test_job_prepared_once_nonce_space_starts);
+    RUN_TEST(test_refill_limits_new_coinbases_to_reachable_headers);
+    RUN_TEST(test_take_misses_stale_and_unprepared_headers);
+    RUN_TEST(test_refill_skips_passed_headers);
+    RUN_TEST(test_concurrent_take_is_consistent);
+    RUN_TEST(test_resent_job_reuses_everything);
+    RUN_TEST(test_memo_remembers_earlier_coinbases);
+    RUN_TEST(test_memo_key_collision_is_not_reused);
+    RUN_TEST(test_ntime_passes_never_meet_the_clock);
+    return UNITY_END();
+}